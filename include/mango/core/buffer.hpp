@@ -40,4 +40,63 @@ namespace mango
         void write(const void* data, size_t size);
     };
 
+    // --------------------------------------------------------------
+    // ChunkedBuffer
+    // --------------------------------------------------------------
+
+    /* Output buffer which grows by adding segments; written data is never
+       moved. The segments start at 64 KB and double up to 4 MB, and freed
+       segments are kept in a process wide pool for the next buffer. The
+       contents are handed out as a list of segments for gather writes, or
+       copied into contiguous memory on demand with flatten(). Producers which
+       write in place (deflate, encoders) can append with reserve()/commit().
+    */
+
+    class ChunkedBuffer : public Stream
+    {
+    protected:
+        struct Segment
+        {
+            uint8* address;
+            size_t capacity;
+            size_t size;
+            uint64 offset; // in the buffer
+        };
+
+        std::vector<Segment> m_segments;
+        size_t m_current; // segment which was accessed last
+        uint64 m_size;
+        uint64 m_offset;
+        uint8* m_flat; // flatten() result; released when the contents change
+
+        void append(const uint8* data, size_t size);
+        size_t locate(uint64 offset);
+        void invalidate();
+
+    public:
+        ChunkedBuffer();
+        ~ChunkedBuffer();
+
+        void reset();
+
+        // contents in order; the memory is valid until the buffer is reset or destroyed
+        std::vector<Memory> segments() const;
+
+        // contiguous contents; valid until the next write
+        Memory flatten();
+
+        // free space at the end of the buffer, at least minimum bytes
+        Memory reserve(size_t minimum = 1);
+
+        // append size bytes written into the reserved space; the offset moves to the end
+        void commit(size_t size);
+
+        // stream
+        uint64 size() const;
+        uint64 offset() const;
+        void seek(uint64 distance, SeekMode mode);
+        void read(void* dest, size_t size);
+        void write(const void* data, size_t size);
+    };
+
 } // namespace mango
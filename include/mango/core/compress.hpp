@@ -4,9 +4,11 @@
 */
 #pragma once
 
+#include <vector>
 #include "configure.hpp"
 #include "memory.hpp"
 #include "object.hpp"
+#include "stream.hpp"
 
 namespace mango
 {
@@ -129,4 +131,206 @@ namespace mango
 
 #endif
 
+    // -----------------------------------------------------------------------
+    // dictionary compression
+    // -----------------------------------------------------------------------
+
+    // Small payloads compress poorly on their own because there is no history
+    // to find matches from. A dictionary trained from samples of similar payloads
+    // provides the history; the same dictionary is required to decompress.
+
+    // Builds a raw content dictionary of at most capacity bytes from the segments
+    // of the samples which contain the most common 8 byte sequences.
+    std::vector<uint8> trainDictionary(const std::vector<Memory>& samples, size_t capacity = 64 * 1024);
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
+
+    namespace lz4
+    {
+        // The dictionary is digested once; it is read-only after construction and
+        // can be shared between threads. lz4 uses up to the last 64 KB of the content.
+        // The levels map to the compressors as in compress(); above 6 is HC, but
+        // 9 and 10 are capped to the fastest of them, HC level 10.
+        class Dictionary : private NonCopyable
+        {
+        protected:
+            struct DictionaryContext* m_context;
+
+        public:
+            Dictionary(Memory content, int level = 6);
+            ~Dictionary();
+
+            const DictionaryContext* context() const;
+        };
+
+        size_t compress(Memory dest, Memory source, const Dictionary& dictionary);
+        void decompress(Memory dest, Memory source, const Dictionary& dictionary);
+    }
+
+    namespace zstd
+    {
+        // The dictionary is digested once; it is read-only after construction and
+        // can be shared between threads. The compression level is chosen here.
+        class Dictionary : private NonCopyable
+        {
+        protected:
+            struct DictionaryContext* m_context;
+
+        public:
+            Dictionary(Memory content, int level = 6);
+            ~Dictionary();
+
+            const DictionaryContext* context() const;
+        };
+
+        size_t compress(Memory dest, Memory source, const Dictionary& dictionary);
+        void decompress(Memory dest, Memory source, const Dictionary& dictionary);
+    }
+
+#endif
+
+    // -----------------------------------------------------------------------
+    // parallel block compression
+    // -----------------------------------------------------------------------
+
+    // The source is split into independent blocks which are compressed on the
+    // thread pool with one of the memory block compressors above. The result is
+    // a frame: a header, the offsets of the blocks and the blocks. The offsets
+    // locate every block, so a frame can be decompressed in parallel or one block
+    // at a time. Blocks which don't get smaller are stored.
+
+    // The memory allocation is caller's responsibility as above; the frame size
+    // is bounded by parallel::bound() and BlockFrame::size() is the size of the
+    // decompressed data.
+
+    enum class Codec : uint32
+    {
+        MINIZ = 1,
+        LZ4   = 2,
+        LZO   = 3,
+        ZSTD  = 4,
+        BZIP2 = 5,
+        LZFSE = 6
+    };
+
+    // the memory block compressor of a codec
+    struct Compressor
+    {
+        Codec codec;
+        const char* name;
+        size_t (*bound)(size_t size);
+        size_t (*compress)(Memory dest, Memory source, int level);
+        void (*decompress)(Memory dest, Memory source);
+    };
+
+    // throws when the codec is not in the build
+    Compressor getCompressor(Codec codec);
+
+    // the codecs in the build
+    std::vector<Compressor> getCompressors();
+
+    namespace parallel
+    {
+        // throws when the codec is not in the build
+        size_t bound(size_t size, Codec codec, size_t blockSize = 1024 * 1024);
+        size_t compress(Memory dest, Memory source, Codec codec, int level = 6, size_t blockSize = 1024 * 1024);
+        void decompress(Memory dest, Memory source);
+    }
+
+    class BlockFrame
+    {
+    protected:
+        Memory m_data;   // the blocks
+        Codec m_codec;
+        size_t m_block_size;
+        uint64 m_size;
+        std::vector<uint64> m_offsets; // blocks + 1 entries
+
+    public:
+        BlockFrame(Memory frame);
+        ~BlockFrame();
+
+        Codec codec() const;
+        uint64 size() const;
+        size_t blocks() const;
+        size_t blockSize() const;
+
+        // dest has room for size() bytes; the blocks are decompressed on the thread pool
+        void decompress(Memory dest) const;
+
+        // dest has room for the block, which is blockSize() bytes except for the last block
+        void decompress(Memory dest, size_t block) const;
+    };
+
+    // -----------------------------------------------------------------------
+    // streaming compression
+    // -----------------------------------------------------------------------
+
+    // Stream adaptors which compress the data written into them to an output
+    // stream, or decompress an input stream as it is read. The data goes through
+    // fixed size windows so the memory use does not depend on the stream size.
+
+    // MINIZ writes a zlib stream, ZSTD a zstd frame and BZIP2 a bzip2 stream.
+    // LZ4, LZO and LZFSE don't have a stream format in the bundled libraries;
+    // the data is written as independently compressed blocks, each with the
+    // uncompressed and compressed size in front, terminated by a zero size.
+
+    struct CompressContext;
+    struct DecompressContext;
+
+    class CompressStream : public Stream
+    {
+    protected:
+        CompressContext* m_context;
+        uint64 m_offset;
+
+    public:
+        CompressStream(Stream& output, Codec codec, int level = 6);
+        ~CompressStream();
+
+        // writes the end of the stream; called by the destructor when not called before
+        void finish();
+
+        uint64 size() const;
+        uint64 offset() const;
+        void seek(uint64 distance, SeekMode mode);
+        void read(void* dest, size_t size);
+        void write(const void* data, size_t size);
+    };
+
+    class DecompressStream : public Stream
+    {
+    protected:
+        DecompressContext* m_context;
+        Stream& m_input;
+        uint64 m_start; // of the compressed data in the input
+        Codec m_codec;
+        uint64 m_offset;
+        bool m_end;
+
+    public:
+        // the input is read from the current offset; once the end of the compressed
+        // stream has been reached, the input is positioned right after it
+        DecompressStream(Stream& input, Codec codec);
+        ~DecompressStream();
+
+        // the end of the compressed stream has been reached by a read
+        bool eof() const;
+
+        // the decompressed size is not known in advance: size() is the bytes decompressed so far
+        uint64 size() const;
+        uint64 offset() const;
+
+        // seeking backwards restarts the decompression from the start
+        void seek(uint64 distance, SeekMode mode);
+
+        // returns the bytes read, which is less than size only at the end of the stream
+        size_t readUpTo(void* dest, size_t size);
+
+        // throws when the stream ends before size bytes; the bytes up to the end
+        // are consumed. Use readUpTo() when the decompressed size is not known.
+        void read(void* dest, size_t size);
+        void write(const void* data, size_t size);
+    };
+
 } // namespace mango
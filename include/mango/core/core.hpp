@@ -21,6 +21,7 @@
 #include "timer.hpp"
 #include "buffer.hpp"
 #include "memory.hpp"
+#include "object_pool.hpp"
 #include "string.hpp"
 #include "thread.hpp"
 #include "dynamic_library.hpp"
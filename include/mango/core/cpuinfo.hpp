@@ -4,6 +4,7 @@
 */
 #pragma once
 
+#include <vector>
 #include "configure.hpp"
 
 namespace mango
@@ -55,4 +56,37 @@ namespace mango
 
 	uint64 getCPUFlags();
 
+    // ----------------------------------------------------------------------------
+    // getCPUTopology()
+    // ----------------------------------------------------------------------------
+
+    /*
+        Logical processors available to the process (affinity mask applied) with
+        their NUMA node and last level cache domain. The processors are sorted so that
+        the ones sharing a node and a cache are adjacent. Platforms without topology
+        information report every processor in node 0 and cache domain 0.
+    */
+
+    struct CPUTopology
+    {
+        struct Processor
+        {
+            int id;      // operating system processor number
+            int core;    // physical core
+            int package; // physical package (socket)
+            int node;    // NUMA node (0 .. nodes - 1)
+            int cache;   // last level cache domain (0 .. caches - 1)
+        };
+
+        std::vector<Processor> processors;
+        std::vector<int> nodeIds; // operating system number of each node
+        int nodes;
+        int caches;
+    };
+
+    const CPUTopology& getCPUTopology();
+
+    // NUMA node of the memory at address, -1 if unknown
+    int getMemoryNode(const void* address);
+
 } // namespace mango
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <limits>
 #include <algorithm>
 #include "configure.hpp"
@@ -53,8 +54,25 @@ namespace mango
         Memory memory;
 
     public:
+        enum Advice
+        {
+            NORMAL,     // default read-ahead
+            SEQUENTIAL, // aggressive read-ahead; the pages can be dropped soon after access
+            RANDOM,     // no read-ahead
+            WILLNEED,   // start reading the range in the background
+            POPULATE    // fault the range in before returning
+        };
+
         VirtualMemory() = default;
-        ~VirtualMemory() {}
+        virtual ~VirtualMemory() {}
+
+        // access pattern hint for a range (size 0 is to the end); used by file mappings
+        virtual void advise(Advice advice, size_t offset = 0, size_t size = 0)
+        {
+            MANGO_UNREFERENCED_PARAMETER(advice);
+            MANGO_UNREFERENCED_PARAMETER(offset);
+            MANGO_UNREFERENCED_PARAMETER(size);
+        }
 
         const Memory* operator -> () const
         {
@@ -74,6 +92,87 @@ namespace mango
     void* aligned_malloc(size_t size, size_t alignment = MANGO_DEFAULT_ALIGNMENT);
     void aligned_free(void* aligned);
 
+    // -----------------------------------------------------------------------
+    // large buffer malloc/free
+    // -----------------------------------------------------------------------
+
+    // Allocations of 2 MB and more are aligned to 2 MB and backed by transparent
+    // huge pages where the platform supports them; this cuts the page faults and
+    // TLB misses 512x when a large image is decoded into the buffer.
+    void* large_malloc(size_t size);
+    void large_free(void* address);
+
+    // -----------------------------------------------------------------------
+    // Arena
+    // -----------------------------------------------------------------------
+
+    /* Bump allocator for transient buffers. The allocations are released in
+       stack order by rewinding to a marker (ArenaScope does it on scope exit);
+       the blocks are kept for reuse, so decoding a stream of images stops
+       calling malloc after the first few. Rewinding to empty releases the
+       blocks above the retained capacity of 64 MB.
+    */
+
+    class Arena : private NonCopyable
+    {
+    public:
+        struct Marker
+        {
+            size_t block;
+            size_t used;
+        };
+
+    protected:
+        struct Block
+        {
+            uint8* address;
+            size_t size;
+        };
+
+        std::vector<Block> m_blocks;
+        size_t m_block_size;
+        size_t m_current; // block being allocated from
+        size_t m_used; // bytes allocated from the current block
+
+    public:
+        Arena(size_t block_size = 256 * 1024);
+        ~Arena();
+
+        // uninitialized memory; alignment up to MANGO_DEFAULT_ALIGNMENT
+        uint8* allocate(size_t size, size_t alignment = 16);
+
+        Marker mark() const;
+        void rewind(const Marker& marker);
+        void reset();
+    };
+
+    // arena of the calling thread
+    Arena& getThreadArena();
+
+    class ArenaScope : private NonCopyable
+    {
+    protected:
+        Arena& m_arena;
+        Arena::Marker m_marker;
+
+    public:
+        ArenaScope(Arena& arena = getThreadArena())
+            : m_arena(arena)
+            , m_marker(arena.mark())
+        {
+        }
+
+        ~ArenaScope()
+        {
+            m_arena.rewind(m_marker);
+        }
+
+        uint8* allocate(size_t size, size_t alignment = 16)
+        {
+            return m_arena.allocate(size, alignment);
+        }
+    };
+
     // -----------------------------------------------------------------------
     // aligned memory allocator
     // -----------------------------------------------------------------------
@@ -0,0 +1,98 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <utility>
+#include "configure.hpp"
+#include "object.hpp"
+
+namespace mango
+{
+
+    // ----------------------------------------------------------------------------
+    // ObjectPoolBase
+    // ----------------------------------------------------------------------------
+
+    /* Fixed size slot allocator. Every thread caches a few slots per pool and
+       exchanges them with the pool in batches through a lock-free stack, so the
+       shared state is touched once per BATCH_SIZE operations at most. The storage
+       grows in segments (each twice the size of the previous one) which are never
+       moved or reallocated; the memory is released when the pool is destroyed.
+    */
+
+    class ObjectPoolBase : private NonCopyable
+    {
+    protected:
+        enum { BATCH_SIZE = 32, MAX_SEGMENTS = 32 };
+
+        struct Slot;
+        struct Cache;
+        struct ThreadCache;
+
+        const uint64 m_id;
+        const size_t m_slot_size;
+        const uint32 m_block_size; // slots in the first segment
+        alignas(64) std::atomic<uint64> m_head; // tag << 32 | (index + 1)
+        std::atomic<int> m_segment_count;
+        std::atomic<uint8*> m_segments[MAX_SEGMENTS];
+
+        Slot* getSlot(uint32 index) const;
+        uint32 getIndex(const Slot* slot) const;
+        Cache& getCache();
+        void grow();
+        void pushBatch(Slot* head, uint32 count);
+        Slot* popBatch(uint32& count);
+
+    public:
+        ObjectPoolBase(size_t size, size_t alignment, uint32 block_size);
+        ~ObjectPoolBase();
+
+        void* allocate();
+        void free(void* pointer);
+    };
+
+    // ----------------------------------------------------------------------------
+    // ObjectPool
+    // ----------------------------------------------------------------------------
+
+    template <typename T>
+    class ObjectPool : private ObjectPoolBase
+    {
+    public:
+        static_assert(alignof(T) <= 64, "ObjectPool: alignment is not supported.");
+
+        ObjectPool(uint32 block_size = 64)
+            : ObjectPoolBase(sizeof(T), alignof(T), block_size)
+        {
+        }
+
+        template <typename... Args>
+        T* acquire(Args&&... args)
+        {
+            void* pointer = allocate();
+            try
+            {
+                return new (pointer) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                free(pointer);
+                throw;
+            }
+        }
+
+        void discard(T* object)
+        {
+            if (object)
+            {
+                object->~T();
+                free(object);
+            }
+        }
+    };
+
+} // namespace mango
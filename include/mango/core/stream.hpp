@@ -4,6 +4,7 @@
 */
 #pragma once
 
+#include <cstring>
 #include "configure.hpp"
 #include "endian.hpp"
 #include "memory.hpp"
@@ -47,6 +48,76 @@ namespace mango
         }
     };
 
+    // --------------------------------------------------------------
+    // BufferedStream
+    // --------------------------------------------------------------
+
+    /* Stream adaptor which reads ahead and collects writes in a window so
+       that small reads and writes don't each go through the wrapped stream.
+       The endian streams constructed from a BufferedStream access the window
+       inline; the class is final so those calls are not virtual. Large
+       transfers bypass the window. Pending writes are flushed and read-ahead
+       is given back (the wrapped stream is seeked back to the logical offset)
+       by flush(), seek() and the destructor; use flush() before accessing
+       the wrapped stream directly. The destructor swallows errors, so call
+       flush() explicitly to find out if the writes failed.
+    */
+
+    class BufferedStream final : public Stream
+    {
+    protected:
+        Stream& m_stream;
+        uint8* m_buffer;
+        size_t m_capacity;
+        uint8* m_pointer;
+        size_t m_read_left;  // read-ahead bytes at m_pointer
+        size_t m_write_left; // free space at m_pointer; pending data is [m_buffer, m_pointer)
+        bool m_dirty;        // there is pending data
+
+        void readBuffered(void* dest, size_t size);
+        void writeBuffered(const void* data, size_t size);
+
+    public:
+        BufferedStream(Stream& stream, size_t capacity = 64 * 1024);
+        ~BufferedStream();
+
+        void flush();
+
+        uint64 size() const;
+        uint64 offset() const;
+        void seek(uint64 distance, SeekMode mode);
+
+        void read(void* dest, size_t size)
+        {
+            if (size <= m_read_left)
+            {
+                std::memcpy(dest, m_pointer, size);
+                m_pointer += size;
+                m_read_left -= size;
+            }
+            else
+            {
+                readBuffered(dest, size);
+            }
+        }
+
+        void write(const void* data, size_t size)
+        {
+            if (size <= m_write_left)
+            {
+                std::memcpy(m_pointer, data, size);
+                m_pointer += size;
+                m_write_left -= size;
+            }
+            else
+            {
+                writeBuffered(data, size);
+            }
+        }
+
+        using Stream::write;
+    };
+
     namespace detail
     {
 
@@ -58,43 +129,65 @@ namespace mango
         {
         private:
             Stream& s;
+            BufferedStream* b; // non-virtual fast path
+
+            void get(void* dest, size_t size)
+            {
+                if (b)
+                    b->read(dest, size);
+                else
+                    s.read(dest, size);
+            }
+
+            void put(const void* data, size_t size)
+            {
+                if (b)
+                    b->write(data, size);
+                else
+                    s.write(data, size);
+            }
 
         public:
             SameEndianStream(Stream& stream)
-            : s(stream)
+            : s(stream), b(nullptr)
+            {
+            }
+
+            SameEndianStream(BufferedStream& stream)
+            : s(stream), b(&stream)
             {
             }
 
             void read(void* dest, size_t size)
             {
-                s.read(dest, size);
+                get(dest, size);
             }
 
             uint8 read8()
             {
                 uint8 value;
-                s.read(&value, sizeof(uint8));
+                get(&value, sizeof(uint8));
                 return value;
             }
 
             uint16 read16()
             {
                 uint16 value;
-                s.read(&value, sizeof(uint16));
+                get(&value, sizeof(uint16));
                 return value;
             }
 
             uint32 read32()
             {
                 uint32 value;
-                s.read(&value, sizeof(uint32));
+                get(&value, sizeof(uint32));
                 return value;
             }
 
             uint64 read64()
             {
                 uint64 value;
-                s.read(&value, sizeof(uint64));
+                get(&value, sizeof(uint64));
                 return value;
             }
 
@@ -121,33 +214,33 @@ namespace mango
 
             void write(const void* data, size_t size)
             {
-                s.write(data, size);
+                put(data, size);
             }
 
             void write(Memory memory)
             {
-                s.write(memory);
+                put(memory.address, memory.size);
             }
 
             void write8(uint8 value)
             {
-                s.write(&value, sizeof(uint8));
+                put(&value, sizeof(uint8));
 
             }
 
             void write16(uint16 value)
             {
-                s.write(&value, sizeof(uint16));
+                put(&value, sizeof(uint16));
             }
 
             void write32(uint32 value)
             {
-                s.write(&value, sizeof(uint32));
+                put(&value, sizeof(uint32));
             }
 
             void write64(uint64 value)
             {
-                s.write(&value, sizeof(uint64));
+                put(&value, sizeof(uint64));
             }
 
             void write16f(Half value)
@@ -174,29 +267,51 @@ namespace mango
         {
         private:
             Stream& s;
+            BufferedStream* b; // non-virtual fast path
+
+            void get(void* dest, size_t size)
+            {
+                if (b)
+                    b->read(dest, size);
+                else
+                    s.read(dest, size);
+            }
+
+            void put(const void* data, size_t size)
+            {
+                if (b)
+                    b->write(data, size);
+                else
+                    s.write(data, size);
+            }
 
         public:
             SwapEndianStream(Stream& stream)
-            : s(stream)
+            : s(stream), b(nullptr)
+            {
+            }
+
+            SwapEndianStream(BufferedStream& stream)
+            : s(stream), b(&stream)
             {
             }
 
             void read(void* dest, size_t size)
             {
-                s.read(dest, size);
+                get(dest, size);
             }
 
             uint8 read8()
             {
                 uint8 value;
-                s.read(&value, sizeof(uint8));
+                get(&value, sizeof(uint8));
                 return value;
             }
 
             uint16 read16()
             {
                 uint16 value;
-                s.read(&value, sizeof(uint16));
+                get(&value, sizeof(uint16));
                 value = byteswap16(value);
                 return value;
             }
@@ -204,7 +319,7 @@ namespace mango
             uint32 read32()
             {
                 uint32 value;
-                s.read(&value, sizeof(uint32));
+                get(&value, sizeof(uint32));
                 value = byteswap32(value);
                 return value;
             }
@@ -212,7 +327,7 @@ namespace mango
             uint64 read64()
             {
                 uint64 value;
-                s.read(&value, sizeof(uint64));
+                get(&value, sizeof(uint64));
                 value = byteswap64(value);
                 return value;
             }
@@ -240,35 +355,35 @@ namespace mango
 
             void write(const void* data, size_t size)
             {
-                s.write(data, size);
+                put(data, size);
             }
 
             void write(Memory memory)
             {
-                s.write(memory);
+                put(memory.address, memory.size);
             }
 
             void write8(uint8 value)
             {
-                s.write(&value, 1);
+                put(&value, 1);
             }
 
             void write16(uint16 value)
             {
                 value = byteswap16(value);
-                s.write(&value, 2);
+                put(&value, 2);
             }
 
             void write32(uint32 value)
             {
                 value = byteswap32(value);
-                s.write(&value, 4);
+                put(&value, 4);
             }
 
             void write64(uint64 value)
             {
                 value = byteswap64(value);
-                s.write(&value, 8);
+                put(&value, 8);
             }
 
             void write16f(Half value)
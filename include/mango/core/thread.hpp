@@ -5,94 +5,91 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <initializer_list>
 #include <thread>
 #include <mutex>
 #include <functional>
 #include <condition_variable>
+#include <exception>
 #include <future>
 #include "exception.hpp"
 #include "object.hpp"
 #include "atomic.hpp"
+#include "object_pool.hpp"
 
 namespace mango
 {
 
-    template <typename T>
-    class ObjectCache
-    {
-    protected:
-        int m_block_size;
-        std::vector<T*> m_blocks;
-        T** m_stack { nullptr };
-        int m_stack_capacity { 0 };
-        int m_stack_size { 0 };
-        SpinLock m_lock;
+    // ----------------------------------------------------------------------------
+    // EventCount
+    // ----------------------------------------------------------------------------
 
-    public:
-        ObjectCache(int block_size)
-            : m_block_size(block_size)
-        {
-        }
+    /* Futex-style wait primitive. The waiter takes a key with prepare(),
+       re-checks its wait condition and either calls cancel() or blocks in
+       wait(key) until notify() is called. notify() only touches the mutex
+       when there are threads waiting so the signaling side stays cheap.
+    */
 
-        ~ObjectCache()
-        {
-            for (auto block : m_blocks) {
-                delete[] block;
-            }
-
-            delete[] m_stack;
-        }
-
-        T* acquire()
-        {
-            SpinLockGuard guard(m_lock);
-            if (!m_stack_size)
-            {
-                T* block = new T[m_block_size];
-                m_blocks.push_back(block);
-
-                m_stack_capacity += m_block_size;
-
-                delete[] m_stack;
-                m_stack = new T*[m_stack_capacity];
-
-                for (int i = 0; i < m_block_size; ++i)
-                    m_stack[i] = block + i;
-
-                m_stack_size = m_block_size;
-            }
+    class EventCount : private NonCopyable
+    {
+    private:
+        std::atomic<uint32> m_epoch { 0 };
+        std::atomic<int> m_waiters { 0 };
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
 
-            T* object = m_stack[--m_stack_size];
-            return object;
-        }
+    public:
+        EventCount() = default;
+        ~EventCount() = default;
 
-        void discard(T* object)
-        {
-            SpinLockGuard guard(m_lock);
-            m_stack[m_stack_size++] = object;
-        }
+        uint32 prepare();
+        void cancel();
+        void wait(uint32 key);
+        void notify(bool all = false);
     };
 
+    // ----------------------------------------------------------------------------
+    // ThreadPool
+    // ----------------------------------------------------------------------------
+
     struct TaskQueue;
+    struct WorkerQueue;
+    struct QueueProfile;
+    struct PoolProfile;
+    class TaskGraph;
+
+    namespace detail
+    {
+        class FutureStateBase;
+    }
 
     class ThreadPool : private NonCopyable
     {
     private:
         friend struct TaskQueue;
+        friend struct WorkerQueue;
+        friend class detail::FutureStateBase;
         friend class ConcurrentQueue;
         friend class SerialQueue;
+        friend class TaskGraph;
 
         struct Queue
         {
             ThreadPool* pool;
             int priority;
+            int node; // preferred NUMA node, -1 for the node of the submitting thread
+            std::atomic<QueueProfile*> profile; // null unless profiling is enabled
             std::atomic<int> reference_count;
             std::atomic<int> task_input_count;
             std::atomic<int> task_complete_count;
             std::atomic<int> stamp_cancel;
             int stamp_barrier;
             std::string name;
+            EventCount event; // signaled on task enqueue and completion
 
             void retain()
             {
@@ -107,47 +104,178 @@ namespace mango
             }
         };
 
+        // Move-only task with inline storage for the callable. Tasks and
+        // callables which don't fit into the inline storage are allocated
+        // from pooled blocks so the enqueue does not go through malloc.
         struct Task
         {
+            enum { STORAGE_SIZE = 64 };
+
             Queue* queue;
             int stamp;
             int barrier;
-            std::function<void()> func;
+            uint64 time; // enqueue time when profiling
+            Task* next; // link while the task is not yet submitted
+            void (*execute)(Task* task, bool invoke);
+            void* callable;
+            std::aligned_storage<STORAGE_SIZE>::type storage;
+
+            template <typename F>
+            void bind(F&& func)
+            {
+                using Callable = typename std::decay<F>::type;
+
+                if (sizeof(Callable) <= STORAGE_SIZE && alignof(Callable) <= alignof(decltype(storage)))
+                {
+                    callable = &storage;
+                    new (callable) Callable(std::forward<F>(func));
+                    execute = [] (Task* task, bool invoke)
+                    {
+                        Callable* func = reinterpret_cast<Callable*>(task->callable);
+                        if (invoke)
+                            (*func)();
+                        func->~Callable();
+                    };
+                }
+                else
+                {
+                    callable = allocateBlock(sizeof(Callable));
+                    new (callable) Callable(std::forward<F>(func));
+                    execute = [] (Task* task, bool invoke)
+                    {
+                        Callable* func = reinterpret_cast<Callable*>(task->callable);
+                        if (invoke)
+                            (*func)();
+                        func->~Callable();
+                        freeBlock(func, sizeof(Callable));
+                    };
+                }
+            }
+
+            // invoke (unless cancelled) and destroy the callable
+            void run(bool invoke)
+            {
+                execute(this, invoke);
+            }
         };
 
+        static Task* allocateTask();
+        static void freeTask(Task* task);
+        static void* allocateBlock(size_t size);
+        static void freeBlock(void* block, size_t size);
+
     public:
+        // The pool runs size workers. A non-empty processor set restricts (and pins)
+        // the workers to those processors, so pools doing different kinds of work
+        // can be kept apart. getInstance() is the default pool used by the queues.
         ThreadPool(size_t size);
+        ThreadPool(size_t size, const std::vector<int>& processors);
         ~ThreadPool();
 
         static ThreadPool& getInstance();
         static int getInstanceSize();
 
+        // Limit of workers running tasks at the same time across all pools; zero
+        // (the default) is unlimited. Threads waiting on queues help regardless.
+        static void setWorkerLimit(int limit);
+        static int getWorkerLimit();
+
         int size() const;
 
-        void enqueue(std::function<void()>&& func)
+        // Workers are spread over the NUMA nodes and pinned to the processors of
+        // their node when the system has more than one node. Each node has its own
+        // shared queues; idle workers look for work in their own node first.
+        int getNodeCount() const;
+
+        // How long (in microseconds) idle or waiting threads spin before they
+        // park themselves. Zero parks immediately; the default is 50 us.
+        void setSpinBudget(int microseconds);
+        int getSpinBudget() const;
+
+        template <typename F>
+        void enqueue(F&& func)
         {
-            enqueue(m_static_queue, std::move(func));
+            enqueue(m_static_queue, std::forward<F>(func));
         }
 
+        // Opt-in instrumentation. The statistics are collected per queue name and
+        // per worker; tracing also records every task as a span. The queues created
+        // while profiling is disabled are not profiled. Times are in nanoseconds.
+
+        enum { LATENCY_BUCKETS = 24 };
+
+        struct QueueStatistics
+        {
+            std::string name;
+            uint64 tasks;
+            uint64 run_time;
+            uint64 latency_time; // enqueue to start
+            uint64 latency_max;
+
+            // bucket 0: below 1 us, bucket N: [2^(N-1), 2^N) us, the last one is open ended
+            uint64 latency_histogram[LATENCY_BUCKETS];
+        };
+
+        struct WorkerStatistics
+        {
+            uint64 tasks;
+            uint64 steals;
+            uint64 run_time;
+            uint64 idle_time;  // spinning for work
+            uint64 sleep_time; // parked
+        };
+
+        void setProfiling(bool enable, bool trace = false);
+        void resetProfiling();
+
+        std::vector<QueueStatistics> getQueueStatistics() const;
+        std::vector<WorkerStatistics> getWorkerStatistics() const;
+        std::string getProfileReport() const;
+
+        // Chrome trace event format; load with chrome://tracing or Perfetto
+        std::string getTrace() const;
+
     protected:
         void thread(size_t threadID);
 
         Queue* createQueue(const std::string& name, int priority);
         void deleteQueue(Queue* queue);
 
-        void enqueue(Queue* queue, std::function<void()>&& func);
-        bool dequeue_process();
+        template <typename F>
+        void enqueue(Queue* queue, F&& func)
+        {
+            Task* task = allocateTask();
+            task->bind(std::forward<F>(func));
+            submit(queue, task);
+        }
+
+        void submit(Queue* queue, Task* task);
+        Task* dequeue(WorkerQueue* worker);
+        Task* steal(WorkerQueue* worker, int priority, int node);
+        int currentNode() const;
+        bool pending() const;
+        bool dequeue_process(bool woken = false);
         void cancel(Queue* queue);
         void wait(Queue* queue);
 
     private:
-        alignas(64) ObjectCache<Queue> m_queue_cache;
-        alignas(64) TaskQueue* m_queues;
+        alignas(64) ObjectPool<Queue> m_queue_cache;
+        alignas(64) TaskQueue* m_queues; // [node][priority]
+        WorkerQueue* m_workers;
+        int m_nodes;
+        std::vector<int> m_node_workers; // first worker of each node (and end)
+        std::vector<int> m_processor_node;
+        std::vector<std::vector<int>> m_node_processors;
+        bool m_affinity;
 
         std::atomic<bool> m_stop { false };
-        std::atomic<int> m_sleep_count { 0 };
-        std::mutex m_queue_mutex;
-        std::condition_variable m_condition;
+        std::atomic<int> m_spin_budget { 50 };
+        std::atomic<int> m_spinning { 0 };
+        EventCount m_idle_event;
+
+        std::atomic<bool> m_profiling { false };
+        std::atomic<bool> m_tracing { false };
+        PoolProfile* m_profile;
 
         Queue* m_static_queue;
         std::vector<std::thread> m_threads;
@@ -169,8 +297,18 @@ namespace mango
     public:
         ConcurrentQueue();
         ConcurrentQueue(const std::string& name, Priority priority = Priority::NORMAL);
+        ConcurrentQueue(ThreadPool& pool, const std::string& name, Priority priority = Priority::NORMAL);
         ~ConcurrentQueue();
 
+        ThreadPool& getPool() const
+        {
+            return m_pool;
+        }
+
+        // run the tasks on the NUMA node which holds the memory at address
+        void setLocality(const void* address);
+        void setLocality(int node);
+
         template <class F, class... Args>
         void enqueue(F&& f, Args&&... args)
         {
@@ -191,8 +329,18 @@ namespace mango
     public:
         SerialQueue();
         SerialQueue(const std::string& name, Priority priority = Priority::NORMAL);
+        SerialQueue(ThreadPool& pool, const std::string& name, Priority priority = Priority::NORMAL);
         ~SerialQueue();
 
+        ThreadPool& getPool() const
+        {
+            return m_pool;
+        }
+
+        // run the tasks on the NUMA node which holds the memory at address
+        void setLocality(const void* address);
+        void setLocality(int node);
+
         template <class F, class... Args>
         void enqueue(F&& f, Args&&... args)
         {
@@ -213,89 +361,681 @@ namespace mango
             ThreadPool& pool = ThreadPool::getInstance();
             pool.enqueue(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
         }
+
+        template <class F, class... Args>
+        Task(ThreadPool& pool, F&& f, Args&&... args)
+        {
+            pool.enqueue(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        }
     };
 
-#if 0
-    // TODO: should probably be deprecated and/or refactored into
-    //       SharedPromise<T> class which only assists in capturing promises.
+    // ----------------------------------------------------------------------------
+    // TaskGraph
+    // ----------------------------------------------------------------------------
 
-    template <typename T>
-    class FutureTask
+    /* Tasks with dependencies. Every task declares the tasks it depends on
+       and is enqueued as soon as all of them have completed, so independent
+       chains (eg. different images in a loading pipeline) overlap instead of
+       being serialized by queue barriers. Tasks can be added while the graph
+       is running; a predecessor which has already completed is ignored.
+
+       The nodes are recycled when their task has completed, so a long-lived
+       graph only holds the tasks in flight. A Handle stays valid after that;
+       it refers to a completed task once its node has been reused.
+
+       TaskGraph graph("pipeline");
+       auto a = graph.add(load, filename);
+       auto b = graph.add({ a }, decode, &image);
+       graph.add({ b }, upload, &image);
+       graph.wait();
+    */
+
+    class TaskGraph : private NonCopyable
     {
-    private:
-        using Future = std::future<T>;
-        using Promise = std::promise<T>;
-        using SharedPromise = std::shared_ptr<Promise>;
-        using Function = std::function<T()>;
+    public:
+        struct Node
+        {
+            ThreadPool::Task task; // only the callable is used
+            std::atomic<int> pending { 1 };
+            SpinLock lock;
+            uint32 serial { 0 }; // incremented when the task completes
+            std::vector<Node*> successors;
+            Node* next { nullptr }; // free list
+        };
 
-        Future m_future;
+        struct Handle
+        {
+            Node* node;
+            uint32 serial;
+        };
+
+    protected:
+        ConcurrentQueue m_queue;
+        SpinLock m_lock;
+        std::vector<std::unique_ptr<Node>> m_nodes;
+        Node* m_free { nullptr };
+
+        Handle submit(Node* node, const Handle* predecessors, size_t count);
+        Node* acquire();
+        void recycle(Node* node);
+        void schedule(Node* node);
+        void execute(Node* node);
+
+        template <typename F>
+        Handle submit(F&& func, const Handle* predecessors, size_t count)
+        {
+            Node* node = acquire();
+
+            try
+            {
+                node->task.bind(std::forward<F>(func));
+            }
+            catch (...)
+            {
+                recycle(node);
+                throw;
+            }
+
+            return submit(node, predecessors, count);
+        }
 
     public:
+        TaskGraph();
+        TaskGraph(const std::string& name, Priority priority = Priority::NORMAL);
+        TaskGraph(ThreadPool& pool, const std::string& name, Priority priority = Priority::NORMAL);
+        ~TaskGraph();
+
+        template <class F, class... Args,
+                  class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, std::vector<Handle>>::value>::type>
+        Handle add(F&& f, Args&&... args)
+        {
+            return submit(std::bind(std::forward<F>(f), std::forward<Args>(args)...), nullptr, 0);
+        }
+
         template <class F, class... Args>
-        FutureTask(F&& f, Args&&... args)
+        Handle add(std::initializer_list<Handle> predecessors, F&& f, Args&&... args)
         {
-            SharedPromise shared_promise = std::make_shared<Promise>();
-            m_future = std::move(shared_promise->get_future());
+            return submit(std::bind(std::forward<F>(f), std::forward<Args>(args)...),
+                predecessors.begin(), predecessors.size());
+        }
 
-            Function func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-            auto container = std::bind([shared_promise] (Function func) {
-                T value = func();
-                shared_promise->set_value(value);
-            }, func);
+        template <class F, class... Args>
+        Handle add(const std::vector<Handle>& predecessors, F&& f, Args&&... args)
+        {
+            return submit(std::bind(std::forward<F>(f), std::forward<Args>(args)...),
+                predecessors.data(), predecessors.size());
+        }
 
-            ThreadPool& pool = ThreadPool::getInstance();
-            pool.enqueue(container);
+        void wait();
+    };
+
+    // ----------------------------------------------------------------------------
+    // parallel_for / parallel_reduce
+    // ----------------------------------------------------------------------------
+
+    /* The range [begin, end) is split recursively in halves until the pieces
+       are no larger than the grain; the first half is enqueued and the second
+       half is kept, so the idle threads steal the large pieces first.
+
+       grain is the smallest piece worth a task of its own (0 = no limit);
+       the range is never split into more than ~8 pieces per thread.
+
+       When function throws, the pieces which haven't started are skipped and
+       the first exception is rethrown after all of the tasks have finished.
+    */
+
+    namespace detail
+    {
+
+        inline int parallel_grain(const ConcurrentQueue& queue, int count, int grain)
+        {
+            const int threads = queue.getPool().size() + 1;
+            const int automatic = std::max(1, count / (threads * 8));
+            return std::max(grain, automatic);
+        }
+
+        // first exception thrown by the pieces of a parallel_for
+        class ParallelError : private NonCopyable
+        {
+        protected:
+            std::atomic<bool> m_failed { false };
+            std::mutex m_mutex;
+            std::exception_ptr m_exception;
+
+        public:
+            bool failed() const
+            {
+                return m_failed.load(std::memory_order_relaxed);
+            }
+
+            void capture()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_exception)
+                    m_exception = std::current_exception();
+                m_failed.store(true, std::memory_order_relaxed);
+            }
+
+            void rethrow() const
+            {
+                if (m_exception)
+                    std::rethrow_exception(m_exception);
+            }
+        };
+
+        template <typename Function>
+        void parallel_split(ConcurrentQueue& queue, ParallelError& error, int begin, int end, int grain, const Function& function)
+        {
+            try
+            {
+                while (end - begin > grain && !error.failed())
+                {
+                    const int middle = begin + (end - begin) / 2;
+                    queue.enqueue([&queue, &error, begin, middle, grain, &function]
+                    {
+                        parallel_split(queue, error, begin, middle, grain, function);
+                    });
+                    begin = middle;
+                }
+
+                if (!error.failed())
+                    function(begin, end);
+            }
+            catch (...)
+            {
+                // the enqueued pieces reference this stack frame; they are
+                // drained by the caller before the exception is rethrown
+                error.capture();
+            }
         }
 
-        T get()
+    } // namespace detail
+
+    // function(int begin, int end) is called for non-overlapping sub-ranges
+    template <typename Function>
+    void parallel_for(ConcurrentQueue& queue, int begin, int end, int grain, Function&& function)
+    {
+        if (begin >= end)
+            return;
+
+        grain = detail::parallel_grain(queue, end - begin, grain);
+
+        if (end - begin <= grain)
         {
-            return m_future.get();
+            // not worth the trouble
+            function(begin, end);
+            return;
         }
 
-        void wait()
+        detail::ParallelError error;
+        detail::parallel_split(queue, error, begin, end, grain, function);
+        queue.wait();
+        error.rethrow();
+    }
+
+    template <typename Function>
+    void parallel_for(int begin, int end, int grain, Function&& function)
+    {
+        ConcurrentQueue queue("parallel_for");
+        parallel_for(queue, begin, end, grain, std::forward<Function>(function));
+    }
+
+    // function(int begin, int end) returns the partial result for a sub-range
+    // and reduce(T, T) combines two results. The pieces are always combined in
+    // the same order so the result doesn't depend on the scheduling.
+    template <typename T, typename Function, typename Reduce>
+    T parallel_reduce(ConcurrentQueue& queue, int begin, int end, int grain, T identity, Function&& function, Reduce&& reduce)
+    {
+        if (begin >= end)
+            return identity;
+
+        grain = detail::parallel_grain(queue, end - begin, grain);
+
+        const int count = (end - begin + grain - 1) / grain;
+        std::vector<T> partial(count, identity);
+
+        parallel_for(queue, 0, count, 1, [&] (int first, int last)
         {
-            m_future.wait();
+            for (int i = first; i < last; ++i)
+            {
+                const int x0 = begin + i * grain;
+                const int x1 = std::min(x0 + grain, end);
+                partial[i] = function(x0, x1);
+            }
+        });
+
+        T value = identity;
+        for (auto& result : partial)
+        {
+            value = reduce(value, result);
         }
-    };
 
-    template <>
-    class FutureTask<void>
+        return value;
+    }
+
+    template <typename T, typename Function, typename Reduce>
+    T parallel_reduce(int begin, int end, int grain, T identity, Function&& function, Reduce&& reduce)
     {
-    private:
-        using Future = std::future<void>;
-        using Promise = std::promise<void>;
-        using SharedPromise = std::shared_ptr<Promise>;
-        using Function = std::function<void()>;
+        ConcurrentQueue queue("parallel_reduce");
+        return parallel_reduce(queue, begin, end, grain, identity, std::forward<Function>(function), std::forward<Reduce>(reduce));
+    }
+
+    // ----------------------------------------------------------------------------
+    // Future
+    // ----------------------------------------------------------------------------
+
+    /* Result of an asynchronous task. The shared state is reference counted
+       and allocated from the task allocator; continuations attached with
+       then() are enqueued into the ThreadPool when the value is ready, so
+       nobody has to block a thread to wait for the result.
+
+       FutureTask<Header> task(parseHeader, memory);
+       Future<int> size = task.then([] (const Header& header) {
+           return header.width * header.height;
+       });
+       int value = size.get();
+    */
+
+    template <typename T>
+    class Future;
+
+    namespace detail
+    {
+
+        class FutureStateBase : private NonCopyable
+        {
+        protected:
+            std::atomic<int> m_reference_count { 1 };
+            std::atomic<bool> m_ready { false };
+            SpinLock m_lock;
+            ThreadPool::Task* m_continuations { nullptr };
+            ThreadPool::Task* m_callbacks { nullptr };
+            std::exception_ptr m_exception;
+            ThreadPool* m_pool { nullptr }; // continuations run here; null is the default pool
+
+            void attach(ThreadPool::Task* task, bool callback);
+            void setReady();
+            void dispatch(ThreadPool::Task* task, bool callback);
+
+        public:
+            FutureStateBase() = default;
+            virtual ~FutureStateBase() = default;
+
+            static void* operator new (size_t size);
+            static void operator delete (void* pointer, size_t size);
+
+            void retain()
+            {
+                m_reference_count.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void release()
+            {
+                if (m_reference_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    delete this;
+                }
+            }
+
+            bool ready() const
+            {
+                return m_ready.load(std::memory_order_acquire);
+            }
+
+            ThreadPool& getPool() const
+            {
+                return m_pool ? *m_pool : ThreadPool::getInstance();
+            }
+
+            void setPool(ThreadPool& pool)
+            {
+                m_pool = &pool;
+            }
+
+            bool failed() const
+            {
+                return m_exception != nullptr;
+            }
+
+            std::exception_ptr exception() const
+            {
+                return m_exception;
+            }
+
+            void setException(std::exception_ptr exception)
+            {
+                m_exception = exception;
+                setReady();
+            }
+
+            void wait();
 
-        Future m_future;
+            // func is enqueued into the ThreadPool when the state is ready;
+            // a callback is invoked directly by the thread which sets the state
+            template <typename F>
+            void attach(F&& func, bool callback)
+            {
+                ThreadPool::Task* task = ThreadPool::allocateTask();
+                task->bind(std::forward<F>(func));
+                attach(task, callback);
+            }
+        };
+
+        template <typename T>
+        class FutureState : public FutureStateBase
+        {
+        protected:
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+
+        public:
+            using reference = const T&;
+
+            ~FutureState()
+            {
+                if (ready() && !failed())
+                {
+                    reinterpret_cast<T*>(&m_storage)->~T();
+                }
+            }
+
+            template <typename V>
+            void setValue(V&& value)
+            {
+                new (&m_storage) T(std::forward<V>(value));
+                setReady();
+            }
+
+            const T& get() const
+            {
+                if (m_exception)
+                    std::rethrow_exception(m_exception);
+                return *reinterpret_cast<const T*>(&m_storage);
+            }
+        };
+
+        template <>
+        class FutureState<void> : public FutureStateBase
+        {
+        public:
+            using reference = void;
+
+            void setValue()
+            {
+                setReady();
+            }
+
+            void get() const
+            {
+                if (m_exception)
+                    std::rethrow_exception(m_exception);
+            }
+        };
+
+        // store the result of func(args...) into the state
+        template <typename R>
+        struct FutureResult
+        {
+            template <typename F, typename... Args>
+            static void apply(FutureState<R>* state, F& func, Args&&... args)
+            {
+                try
+                {
+                    state->setValue(func(std::forward<Args>(args)...));
+                }
+                catch (...)
+                {
+                    state->setException(std::current_exception());
+                }
+            }
+        };
+
+        template <>
+        struct FutureResult<void>
+        {
+            template <typename F, typename... Args>
+            static void apply(FutureState<void>* state, F& func, Args&&... args)
+            {
+                try
+                {
+                    func(std::forward<Args>(args)...);
+                    state->setValue();
+                }
+                catch (...)
+                {
+                    state->setException(std::current_exception());
+                }
+            }
+        };
+
+        // invoke a continuation with the value of the previous state
+        template <typename T, typename F>
+        struct FutureContinuation
+        {
+            using type = typename std::result_of<F(const T&)>::type;
+
+            static void apply(FutureState<type>* next, F& func, FutureState<T>* state)
+            {
+                FutureResult<type>::apply(next, func, state->get());
+            }
+        };
+
+        template <typename F>
+        struct FutureContinuation<void, F>
+        {
+            using type = typename std::result_of<F()>::type;
+
+            static void apply(FutureState<type>* next, F& func, FutureState<void>* state)
+            {
+                MANGO_UNREFERENCED_PARAMETER(state);
+                FutureResult<type>::apply(next, func);
+            }
+        };
+
+    } // namespace detail
+
+    template <typename T>
+    class Future
+    {
+    protected:
+        template <typename U>
+        friend class Future;
+
+        template <typename U>
+        friend Future<std::vector<U>> when_all(const std::vector<Future<U>>& futures);
+        friend Future<void> when_all(const std::vector<Future<void>>& futures);
+
+        detail::FutureState<T>* m_state { nullptr };
+
+        // adopts the reference
+        explicit Future(detail::FutureState<T>* state)
+            : m_state(state)
+        {
+        }
 
     public:
-        template <class F, class... Args>
-        FutureTask(F&& f, Args&&... args)
+        Future() = default;
+
+        Future(const Future& future)
+            : m_state(future.m_state)
+        {
+            if (m_state)
+                m_state->retain();
+        }
+
+        Future(Future&& future)
+            : m_state(future.m_state)
         {
-            SharedPromise shared_promise = std::make_shared<Promise>();
-            m_future = std::move(shared_promise->get_future());
+            future.m_state = nullptr;
+        }
 
-            Function func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-            auto container = std::bind([shared_promise] (Function func) {
-                func();
-                shared_promise->set_value();
-            }, func);
+        ~Future()
+        {
+            if (m_state)
+                m_state->release();
+        }
 
-            ThreadPool& pool = ThreadPool::getInstance();
-            pool.enqueue(container);
+        Future& operator = (const Future& future)
+        {
+            if (future.m_state)
+                future.m_state->retain();
+            if (m_state)
+                m_state->release();
+            m_state = future.m_state;
+            return *this;
+        }
+
+        Future& operator = (Future&& future)
+        {
+            std::swap(m_state, future.m_state);
+            return *this;
+        }
+
+        bool valid() const
+        {
+            return m_state != nullptr;
+        }
+
+        bool ready() const
+        {
+            return m_state->ready();
+        }
+
+        // the waiting thread processes other tasks while the value is not ready
+        void wait() const
+        {
+            m_state->wait();
+        }
+
+        typename detail::FutureState<T>::reference get() const
+        {
+            m_state->wait();
+            return m_state->get();
+        }
+
+        // func(const T&) is called when the value is ready; an exception skips
+        // the continuation and is passed on to the returned future
+        template <typename F>
+        Future<typename detail::FutureContinuation<T, typename std::decay<F>::type>::type> then(F&& func) const
+        {
+            using Function = typename std::decay<F>::type;
+            using Continuation = detail::FutureContinuation<T, Function>;
+            using R = typename Continuation::type;
+
+            detail::FutureState<T>* state = m_state;
+            detail::FutureState<R>* next = new detail::FutureState<R>();
+            next->setPool(state->getPool());
+
+            state->retain();
+            next->retain();
+
+            state->attach([state, next, func] () mutable
+            {
+                if (state->failed())
+                    next->setException(state->exception());
+                else
+                    Continuation::apply(next, func, state);
+
+                state->release();
+                next->release();
+            }, false);
+
+            return Future<R>(next);
         }
+    };
 
-        void get()
+    template <typename T>
+    class FutureTask : public Future<T>
+    {
+    public:
+        template <class F, class... Args>
+        FutureTask(F&& f, Args&&... args)
+            : Future<T>(new detail::FutureState<T>())
         {
-            m_future.get();
+            launch(ThreadPool::getInstance(), std::bind(std::forward<F>(f), std::forward<Args>(args)...));
         }
 
-        void wait()
+        template <class F, class... Args>
+        FutureTask(ThreadPool& pool, F&& f, Args&&... args)
+            : Future<T>(new detail::FutureState<T>())
+        {
+            launch(pool, std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        }
+
+    protected:
+        template <typename F>
+        void launch(ThreadPool& pool, F&& func)
         {
-            m_future.wait();
+            detail::FutureState<T>* state = this->m_state;
+            state->retain();
+            state->setPool(pool);
+
+            pool.enqueue([state, func] () mutable
+            {
+                detail::FutureResult<T>::apply(state, func);
+                state->release();
+            });
         }
     };
-#endif
+
+    // The returned future is ready when all of the futures are ready. The values
+    // are in the same order as the futures; the first exception is passed on.
+    template <typename T>
+    Future<std::vector<T>> when_all(const std::vector<Future<T>>& futures)
+    {
+        // the join is the state of the returned future, so it is allocated
+        // from the same pooled blocks as the other future states
+        struct Join : detail::FutureState<std::vector<T>>
+        {
+            std::atomic<int> count;
+            std::vector<Future<T>> futures;
+
+            void complete()
+            {
+                if (--count)
+                    return;
+
+                // the inputs are not needed after this
+                std::vector<Future<T>> inputs;
+                std::swap(inputs, futures);
+
+                std::vector<T> values;
+                values.reserve(inputs.size());
+
+                for (auto& future : inputs)
+                {
+                    if (future.m_state->failed())
+                    {
+                        this->setException(future.m_state->exception());
+                        break;
+                    }
+
+                    values.push_back(future.m_state->get());
+                }
+
+                if (!this->ready())
+                    this->setValue(std::move(values));
+
+                this->release();
+            }
+        };
+
+        Join* join = new Join();
+        join->count = int(futures.size()) + 1;
+        join->futures = futures;
+        join->retain(); // released by complete()
+
+        Future<std::vector<T>> result(join);
+
+        for (auto& future : futures)
+        {
+            future.m_state->attach([join] { join->complete(); }, true);
+        }
+
+        join->complete();
+        return result;
+    }
+
+    Future<void> when_all(const std::vector<Future<void>>& futures);
+
 
 } // namespace mango
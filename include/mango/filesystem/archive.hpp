@@ -0,0 +1,72 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include "../core/configure.hpp"
+#include "../core/memory.hpp"
+#include "../core/buffer.hpp"
+#include "file.hpp"
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------
+    // ArchiveWriter
+    // -----------------------------------------------------------------
+
+    /* Writes .mgx archives, which are read through the Path and File
+       interfaces like the other archives ("assets.mgx/textures/a.png").
+
+       The files are split into independently compressed blocks with a
+       checksum each, so a file can be decoded in parallel and streamed with
+       random access. Files which don't compress are stored uncompressed at
+       page aligned offsets and mapped from the archive without copying.
+       The directory is written at the end of the archive by close().
+    */
+
+    class ArchiveWriter : protected NonCopyable
+    {
+    public:
+        enum Compression : uint32
+        {
+            STORE = 0,
+            LZ4   = 1,
+            ZSTD  = 2,
+        };
+
+    protected:
+        FileStream m_file;
+        uint64 m_offset;
+        uint32 m_block_size;
+        uint32 m_file_count;
+        uint32 m_block_count;
+        Buffer m_files;
+        Buffer m_blocks;
+        std::string m_names;
+        std::unordered_set<std::string> m_lookup;
+        bool m_closed;
+
+        void align(uint32 alignment);
+        void addBlock(uint32 method, Memory memory, uint32 size);
+
+    public:
+        // blockSize is the uncompressed size of the blocks, clamped to [4 KB, 64 MB]
+        ArchiveWriter(const std::string& filename, uint32 blockSize = 256 * 1024);
+        ~ArchiveWriter();
+
+        // the name is the path in the archive, with '/' as the folder separator
+        void write(const std::string& name, Memory memory, Compression compression = LZ4, int level = 6);
+
+        // writes the directory; called by the destructor when not called before
+        void close();
+    };
+
+} // namespace mango
+
+#endif // MANGO_ENABLE_LICENSE_BSD
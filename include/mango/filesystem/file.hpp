@@ -33,6 +33,35 @@ namespace mango
         operator Memory () const;
 		operator const uint8* () const;
         const uint8* data() const;
+        void advise(VirtualMemory::Advice advice, size_t offset = 0, size_t size = 0);
+
+        // stream
+        uint64 size() const;
+        uint64 offset() const;
+        void seek(uint64 distance, SeekMode mode);
+        void read(void* dest, size_t size);
+        void write(const void* data, size_t size);
+    };
+
+    /* Read-only stream of a file in a Path. The file is not mapped as a whole
+       like with File: compressed archive entries are decompressed as they are
+       read, so the memory use does not depend on the size of the entry.
+       Seeking backwards in a compressed entry restarts the decompression.
+       Reading past the end, or from an entry which decodes short, throws.
+    */
+
+    class FileReader : public Mapper, public Stream
+    {
+    protected:
+        std::string m_filename;
+        std::unique_ptr<Stream> m_stream;
+
+    public:
+        FileReader(const Path& path, const std::string& filename);
+        FileReader(const std::string& filename);
+        ~FileReader();
+
+        const std::string& filename() const;
 
         // stream
         uint64 size() const;
@@ -48,7 +77,16 @@ namespace mango
 		struct FileHandle* m_handle;
 
     public:
-        FileStream(const std::string& filename, OpenMode mode);
+        enum IOMode
+        {
+            BUFFERED, // through the C library and the page cache
+            DIRECT    // bypass the page cache (O_DIRECT) with aligned block transfers
+        };
+
+        // DIRECT keeps up to queueDepth blocks (at most 64) in flight using io_uring on
+        // Linux and falls back to synchronous pread/pwrite when io_uring is not available
+        // or queueDepth is zero. Platforms without direct I/O use the BUFFERED mode.
+        FileStream(const std::string& filename, OpenMode mode, IOMode io = BUFFERED, int queueDepth = 4);
         ~FileStream();
 
         const std::string& filename() const;
@@ -58,6 +96,9 @@ namespace mango
         void seek(uint64 distance, SeekMode mode);
         void read(void* dest, size_t size);
         void write(const void* data, size_t size);
+
+        // gather write; one system call for the buffers where supported (writev)
+        void write(const std::vector<Memory>& buffers);
     };
 
 } // namespace mango
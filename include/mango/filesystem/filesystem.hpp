@@ -7,4 +7,6 @@
 #include "mapper.hpp"
 #include "path.hpp"
 #include "file.hpp"
+#include "reader.hpp"
+#include "archive.hpp"
 #include "fileobserver.hpp"
@@ -6,8 +6,13 @@
 
 #include <string>
 #include <vector>
+#include <list>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
 #include "../core/configure.hpp"
 #include "../core/memory.hpp"
+#include "../core/stream.hpp"
 
 namespace mango
 {
@@ -36,6 +41,126 @@ namespace mango
 
 	using FileIndex = std::vector<FileInfo>;
 
+    // -----------------------------------------------------------------
+    // FileTree
+    // -----------------------------------------------------------------
+
+    /* Directory tree for the archive mappers. The paths are interned in one
+       string pool and found through a hash table, so a lookup is O(1) and
+       listing a folder is O(children) no matter how large the archive is.
+       Missing parent folders are created when an entry is inserted.
+    */
+
+    class FileTree
+    {
+    public:
+        enum : uint32 { NONE = 0xffffffff };
+
+        struct Node
+        {
+            uint32 offset;  // path in the string pool
+            uint32 length;
+            uint32 hash;
+            uint32 parent;
+            uint32 child;   // first child
+            uint32 sibling; // next child of the parent
+            uint32 flags;   // FileInfo flags
+            uint32 data;    // mapper specific, NONE for generated folders
+            uint64 size;
+        };
+
+    protected:
+        std::vector<Node> m_nodes; // the root is the first node
+        std::vector<uint32> m_table;
+        std::string m_names;
+
+        uint32 slot(const char* name, uint32 length, uint32 hash) const;
+        uint32 lookup(const char* name, uint32 length) const;
+        uint32 create(const char* name, uint32 length);
+
+    public:
+        FileTree();
+        ~FileTree();
+
+        // the name is the full path without the trailing '/'
+        void insert(const std::string& name, uint64 size, uint32 flags, uint32 data);
+        const Node* find(const std::string& name) const;
+        void index(FileIndex& index, const std::string& pathname) const;
+
+        // flat image of the tree for the index cache; load() returns the bytes consumed, zero when the image is malformed
+        void save(Stream& stream) const;
+        size_t load(Memory memory);
+    };
+
+    // -----------------------------------------------------------------
+    // EntryCache
+    // -----------------------------------------------------------------
+
+    /* LRU of decompressed archive entries, shared by all archive mappers
+       and bounded by a byte budget. The memory is reference counted: the
+       VirtualMemory returned from mmap() stays valid after the entry has been
+       evicted. The entries are keyed by an archive hash computed by the
+       mapper and the entry offset, so the same archive opened through
+       different mappers shares the entries. Encrypted entries are never cached
+       since the key doesn't include the password. A zero budget disables the cache.
+    */
+
+    class EntryCache : private NonCopyable
+    {
+    public:
+        struct Statistics
+        {
+            uint64 hits;
+            uint64 misses;
+            uint64 evictions;
+            uint64 bytes;   // currently cached
+            uint64 entries; // currently cached
+        };
+
+    protected:
+        struct Entry
+        {
+            uint64 archive;
+            uint64 offset;
+            std::shared_ptr<VirtualMemory> memory;
+        };
+
+        struct KeyHash
+        {
+            size_t operator () (const std::pair<uint64, uint64>& key) const
+            {
+                return size_t(key.first ^ (key.second * 0x9e3779b97f4a7c15ull));
+            }
+        };
+
+        using EntryList = std::list<Entry>;
+
+        mutable std::mutex m_mutex;
+        EntryList m_entries; // most recently used first
+        std::unordered_map<std::pair<uint64, uint64>, EntryList::iterator, KeyHash> m_lookup;
+        size_t m_budget;
+        Statistics m_statistics;
+
+        void evict(size_t budget);
+
+    public:
+        EntryCache(size_t budget = 64 * 1024 * 1024);
+        ~EntryCache();
+
+        // returns the cached entry, or calls load() and caches the result; the caller owns the returned object
+        VirtualMemory* mmap(uint64 archive, uint64 offset, const std::function<VirtualMemory* ()>& load);
+
+        void setBudget(size_t bytes);
+        size_t getBudget() const;
+        Statistics getStatistics() const;
+        void clear();
+    };
+
+    // cache shared by the archive mappers
+    EntryCache& getEntryCache();
+
+    class AbstractReader;
+
     class AbstractMapper
     {
 	public:
@@ -45,6 +170,12 @@ namespace mango
         virtual bool isfile(const std::string& filename) const = 0;
         virtual void index(FileIndex& index, const std::string& pathname) = 0;
         virtual VirtualMemory* mmap(const std::string& filename) = 0;
+
+        // asynchronous reads; the default maps the files on a pool of I/O threads
+        virtual AbstractReader* createReader(int depth);
+
+        // sequential read-only stream; the default reads from mmap()
+        virtual Stream* open(const std::string& filename);
     };
 
     class Mapper : protected NonCopyable
@@ -65,6 +196,10 @@ namespace mango
 
         operator AbstractMapper* () const;
         static bool isCustomMapper(const std::string& filename);
+
+        // folder where the archive mappers cache the parsed directories; empty disables the cache (default)
+        static void setIndexCache(const std::string& folder);
+        static std::string getIndexCache();
     };
 
 	void emplace(FileIndex &index, const std::string &name, uint64 size, uint32 flags);
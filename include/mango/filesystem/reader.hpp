@@ -0,0 +1,82 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <memory>
+#include "../core/configure.hpp"
+#include "../core/memory.hpp"
+#include "mapper.hpp"
+#include "path.hpp"
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------
+    // ReadResult
+    // -----------------------------------------------------------------
+
+    struct ReadResult
+    {
+        std::string filename;
+        uint64 offset;
+        void* user;
+        std::unique_ptr<VirtualMemory> memory; // null when the read failed
+
+        ReadResult();
+    };
+
+    // -----------------------------------------------------------------
+    // AbstractReader
+    // -----------------------------------------------------------------
+
+    class AbstractReader
+    {
+    public:
+        AbstractReader() = default;
+        virtual ~AbstractReader() = default;
+
+        virtual void submit(const std::string& filename, uint64 offset, uint64 size, void* user) = 0;
+        virtual bool next(ReadResult& result, bool wait) = 0;
+        virtual size_t pending() const = 0;
+    };
+
+    // -----------------------------------------------------------------
+    // AsyncReader
+    // -----------------------------------------------------------------
+
+    /* Batched reads which complete out of order. The reads are queued with
+       submit() and up to depth of them are in flight at any time; the
+       completions are picked up with wait() or poll(). The reads happen
+       off the calling thread so the disk latency overlaps with whatever the
+       caller is doing with the previous results. The Unix file system mapper
+       reads with io_uring; the other mappers map the files on I/O threads.
+
+       The reader is used from one thread at a time.
+    */
+
+    class AsyncReader : public Mapper
+    {
+    protected:
+        std::unique_ptr<AbstractReader> m_reader;
+
+    public:
+        AsyncReader(int depth = 32);
+        AsyncReader(const Path& path, int depth = 32);
+        ~AsyncReader();
+
+        // size 0 reads to the end of file; user is returned in the result
+        void submit(const std::string& filename, uint64 offset = 0, uint64 size = 0, void* user = nullptr);
+
+        // blocks until a read completes; false when nothing is pending
+        bool wait(ReadResult& result);
+
+        // false when no read has completed yet
+        bool poll(ReadResult& result);
+
+        size_t pending() const;
+    };
+
+} // namespace mango
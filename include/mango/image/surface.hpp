@@ -47,6 +47,9 @@ namespace mango
 
     class Bitmap : private NonCopyable, public Surface
     {
+    protected:
+        bool m_large; // image is from large_malloc(); the image given to the constructor is from new[]
+
     public:
         Bitmap(int width, int height, const Format& format, int stride = 0, uint8* image = nullptr);
         Bitmap(Memory memory, const std::string& extension);
@@ -0,0 +1,43 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------------
+    // Arguments
+    // -----------------------------------------------------------------------
+
+    // "-name value" options and the remaining arguments in order
+    class Arguments
+    {
+    protected:
+        std::map<std::string, std::string> m_options;
+        std::vector<std::string> m_values;
+
+    public:
+        Arguments(int argc, const char* const* argv);
+        ~Arguments();
+
+        const std::vector<std::string>& values() const;
+
+        std::string get(const std::string& name, const std::string& defaultValue) const;
+        int get(const std::string& name, int defaultValue) const;
+
+        // comma separated list of integers
+        std::vector<int> list(const std::string& name, const std::vector<int>& defaultValue) const;
+    };
+
+    // the commands; the return value is the exit code
+    int compressionCommand(const Arguments& args);
+    int threadsCommand(const Arguments& args);
+    int dictionaryCommand(const Arguments& args);
+
+} // namespace mango
@@ -0,0 +1,438 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <algorithm>
+#include <thread>
+#include <mango/core/exception.hpp>
+#include <mango/core/thread.hpp>
+#include <mango/core/timer.hpp>
+#include "benchmark.hpp"
+#include "compression.hpp"
+#include "corpus.hpp"
+
+namespace
+{
+    using namespace mango;
+
+    struct Block
+    {
+        Memory source;
+        Memory compressed;   // slot of bound() bytes
+        Memory decompressed; // slot of source.size bytes
+        size_t bytes;        // compressed size
+    };
+
+    // -----------------------------------------------------------------------
+    // peak memory
+    // -----------------------------------------------------------------------
+
+#if defined(MANGO_PLATFORM_LINUX)
+
+    uint64 readStatus(const char* field)
+    {
+        FILE* file = std::fopen("/proc/self/status", "r");
+        if (!file)
+            return 0;
+
+        const size_t length = std::strlen(field);
+        uint64 value = 0;
+        char line[256];
+
+        while (std::fgets(line, sizeof(line), file))
+        {
+            if (!std::strncmp(line, field, length))
+            {
+                unsigned long long kb = 0;
+                if (std::sscanf(line + length, ": %llu", &kb) == 1)
+                    value = uint64(kb) * 1024;
+                break;
+            }
+        }
+
+        std::fclose(file);
+        return value;
+    }
+
+    class PeakMemory
+    {
+    protected:
+        uint64 m_base;
+
+    public:
+        PeakMemory()
+            : m_base(0)
+        {
+            // writing "5" resets the peak resident size to the current one
+            FILE* file = std::fopen("/proc/self/clear_refs", "w");
+            if (file)
+            {
+                const bool written = std::fputs("5", file) >= 0;
+                if (!std::fclose(file) && written)
+                {
+                    m_base = readStatus("VmRSS");
+                }
+            }
+        }
+
+        uint64 growth() const
+        {
+            if (!m_base)
+                return 0;
+
+            const uint64 peak = readStatus("VmHWM");
+            return peak > m_base ? peak - m_base : 0;
+        }
+    };
+
+#else
+
+    class PeakMemory
+    {
+    public:
+        uint64 growth() const
+        {
+            return 0;
+        }
+    };
+
+#endif
+
+    // -----------------------------------------------------------------------
+    // run
+    // -----------------------------------------------------------------------
+
+    template <typename Func>
+    void runBlocks(ThreadPool* pool, size_t count, Func func)
+    {
+        if (!pool)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                func(i);
+            }
+            return;
+        }
+
+        ConcurrentQueue queue(*pool, "benchmark");
+        parallel_for(queue, 0, int(count), 1, [&] (int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                func(size_t(i));
+            }
+        });
+    }
+
+    double speed(uint64 bytes, double seconds)
+    {
+        return seconds > 0 ? double(bytes) / (1024.0 * 1024.0) / seconds : 0.0;
+    }
+
+    // one codec and level on the pool, or on the calling thread when there is no pool
+    CompressionResult measure(ThreadPool* pool, const std::vector<std::vector<uint8>>& corpus, uint64 total,
+                              const Compressor& compressor, int level, size_t blockSize, int repeat)
+    {
+        // split the corpus into blocks with a compressed and a decompressed slot each;
+        // the slots are packed so small files don't reserve a whole block
+        std::vector<Block> blocks;
+        size_t capacity = 0;
+
+        for (const auto& data : corpus)
+        {
+            for (size_t offset = 0; offset < data.size(); offset += blockSize)
+            {
+                Block block;
+                block.source = Memory(const_cast<uint8*>(data.data()) + offset, std::min(blockSize, data.size() - offset));
+                block.bytes = 0;
+                blocks.push_back(block);
+                capacity += compressor.bound(block.source.size);
+            }
+        }
+
+        std::vector<uint8> compressed(capacity);
+        std::vector<uint8> decompressed(static_cast<size_t>(total));
+
+        uint8* slot = compressed.data();
+        uint8* output = decompressed.data();
+        for (auto& block : blocks)
+        {
+            const size_t bound = compressor.bound(block.source.size);
+            block.compressed = Memory(slot, bound);
+            block.decompressed = Memory(output, block.source.size);
+            slot += bound;
+            output += block.source.size;
+        }
+
+        // the vectors are zero filled so their pages are resident before the peak is reset;
+        // the growth is the memory used by the codec
+        PeakMemory peak;
+
+        double compressTime = 0;
+        double decompressTime = 0;
+
+        for (int i = 0; i < repeat; ++i)
+        {
+            Timer timer;
+
+            runBlocks(pool, blocks.size(), [&] (size_t index)
+            {
+                Block& block = blocks[index];
+                block.bytes = compressor.compress(block.compressed, block.source, level);
+            });
+
+            const double seconds = timer.time();
+            compressTime = i ? std::min(compressTime, seconds) : seconds;
+        }
+
+        for (int i = 0; i < repeat; ++i)
+        {
+            Timer timer;
+
+            runBlocks(pool, blocks.size(), [&] (size_t index)
+            {
+                const Block& block = blocks[index];
+                compressor.decompress(block.decompressed, Memory(block.compressed.address, block.bytes));
+            });
+
+            const double seconds = timer.time();
+            decompressTime = i ? std::min(decompressTime, seconds) : seconds;
+        }
+
+        CompressionResult result;
+        result.codec = compressor.name;
+        result.level = level;
+        result.threads = pool ? pool->size() + 1 : 1;
+        result.size = total;
+        result.compressed = 0;
+        result.compress = speed(total, compressTime);
+        result.decompress = speed(total, decompressTime);
+        result.memory = peak.growth();
+        result.pareto_compress = false;
+        result.pareto_decompress = false;
+
+        for (const Block& block : blocks)
+        {
+            if (std::memcmp(block.decompressed.address, block.source.address, block.source.size))
+            {
+                MANGO_EXCEPTION("[CompressionBenchmark] Round trip mismatch with " + result.codec + ".");
+            }
+            result.compressed += block.bytes;
+        }
+
+        return result;
+    }
+
+    void markPareto(std::vector<CompressionResult>& results)
+    {
+        for (auto& a : results)
+        {
+            a.pareto_compress = true;
+            a.pareto_decompress = true;
+
+            for (const auto& b : results)
+            {
+                if (&a == &b || a.threads != b.threads)
+                    continue;
+
+                const double ra = a.ratio();
+                const double rb = b.ratio();
+
+                if (rb >= ra && b.compress >= a.compress && (rb > ra || b.compress > a.compress))
+                    a.pareto_compress = false;
+
+                if (rb >= ra && b.decompress >= a.decompress && (rb > ra || b.decompress > a.decompress))
+                    a.pareto_decompress = false;
+            }
+        }
+    }
+
+    std::string format(const char* fmt, ...)
+    {
+        char buffer[512];
+        va_list args;
+        va_start(args, fmt);
+        std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+        return buffer;
+    }
+
+} // namespace
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------------
+    // CompressionResult
+    // -----------------------------------------------------------------------
+
+    double CompressionResult::ratio() const
+    {
+        return compressed ? double(size) / double(compressed) : 0.0;
+    }
+
+    // -----------------------------------------------------------------------
+    // CompressionBenchmark
+    // -----------------------------------------------------------------------
+
+    CompressionBenchmark::CompressionBenchmark()
+    {
+    }
+
+    CompressionBenchmark::~CompressionBenchmark()
+    {
+    }
+
+    void CompressionBenchmark::add(Memory memory)
+    {
+        if (memory.size)
+        {
+            m_corpus.emplace_back(memory.address, memory.address + memory.size);
+        }
+    }
+
+    uint64 CompressionBenchmark::size() const
+    {
+        uint64 bytes = 0;
+        for (const auto& data : m_corpus)
+        {
+            bytes += data.size();
+        }
+        return bytes;
+    }
+
+    std::vector<CompressionResult> CompressionBenchmark::run(const std::vector<Compressor>& compressors,
+                                                             const std::vector<int>& levels,
+                                                             const std::vector<int>& threads,
+                                                             size_t blockSize, int repeat) const
+    {
+        blockSize = std::max(blockSize, size_t(4096));
+        repeat = std::max(repeat, 1);
+
+        const uint64 total = size();
+        if (!total)
+        {
+            MANGO_EXCEPTION("[CompressionBenchmark] Empty corpus.");
+        }
+
+        std::vector<CompressionResult> results;
+
+        for (const auto& compressor : compressors)
+        {
+            for (int level : levels)
+            {
+                for (int count : threads)
+                {
+                    count = std::max(count, 1);
+
+                    if (count > 1)
+                    {
+                        // the waiting thread processes blocks as well
+                        ThreadPool pool(count - 1);
+                        results.push_back(measure(&pool, m_corpus, total, compressor, level, blockSize, repeat));
+                    }
+                    else
+                    {
+                        results.push_back(measure(nullptr, m_corpus, total, compressor, level, blockSize, repeat));
+                    }
+                }
+            }
+        }
+
+        markPareto(results);
+        return results;
+    }
+
+    std::string CompressionBenchmark::csv(const std::vector<CompressionResult>& results)
+    {
+        std::string s = "codec,level,threads,size,compressed,ratio,compress_mbps,decompress_mbps,memory,pareto_compress,pareto_decompress\n";
+
+        for (const auto& result : results)
+        {
+            s += format("%s,%d,%d,%llu,%llu,%.3f,%.1f,%.1f,%llu,%d,%d\n",
+                result.codec.c_str(), result.level, result.threads,
+                (unsigned long long)result.size, (unsigned long long)result.compressed,
+                result.ratio(), result.compress, result.decompress,
+                (unsigned long long)result.memory,
+                int(result.pareto_compress), int(result.pareto_decompress));
+        }
+
+        return s;
+    }
+
+    std::string CompressionBenchmark::json(const std::vector<CompressionResult>& results)
+    {
+        std::string s = "[\n";
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto& result = results[i];
+            s += format("  { \"codec\": \"%s\", \"level\": %d, \"threads\": %d, \"size\": %llu, \"compressed\": %llu, "
+                        "\"ratio\": %.3f, \"compress_mbps\": %.1f, \"decompress_mbps\": %.1f, \"memory\": %llu, "
+                        "\"pareto_compress\": %s, \"pareto_decompress\": %s }%s\n",
+                result.codec.c_str(), result.level, result.threads,
+                (unsigned long long)result.size, (unsigned long long)result.compressed,
+                result.ratio(), result.compress, result.decompress,
+                (unsigned long long)result.memory,
+                result.pareto_compress ? "true" : "false",
+                result.pareto_decompress ? "true" : "false",
+                i + 1 < results.size() ? "," : "");
+        }
+
+        s += "]\n";
+        return s;
+    }
+
+    // -----------------------------------------------------------------------
+    // compression command
+    // -----------------------------------------------------------------------
+
+    int compressionCommand(const Arguments& args)
+    {
+        CompressionBenchmark benchmark;
+
+        for (const auto& pathname : args.values())
+        {
+            loadCorpus(pathname, [&] (Memory memory)
+            {
+                benchmark.add(memory);
+            });
+        }
+
+        if (!benchmark.size())
+        {
+            std::fprintf(stderr, "compression: no corpus given.\n");
+            return 1;
+        }
+
+        // every codec in the build unless listed by name
+        std::vector<Compressor> compressors;
+        const std::string codecs = "," + args.get("codec", "") + ",";
+
+        for (const Compressor& compressor : getCompressors())
+        {
+            if (codecs == ",," || codecs.find("," + std::string(compressor.name) + ",") != std::string::npos)
+            {
+                compressors.push_back(compressor);
+            }
+        }
+
+        const int hardware = int(std::thread::hardware_concurrency());
+        const std::vector<int> levels = args.list("level", { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 });
+        const std::vector<int> threads = args.list("threads", { 1, std::max(hardware, 1) });
+        const size_t blockSize = size_t(std::max(args.get("block", 1024), 4)) * 1024;
+        const int repeat = args.get("repeat", 3);
+
+        std::vector<CompressionResult> results = benchmark.run(compressors, levels, threads, blockSize, repeat);
+
+        const std::string text = args.get("format", "csv") == "json" ?
+            CompressionBenchmark::json(results) : CompressionBenchmark::csv(results);
+        std::fputs(text.c_str(), stdout);
+
+        return 0;
+    }
+
+} // namespace mango
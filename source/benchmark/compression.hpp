@@ -0,0 +1,74 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mango/core/configure.hpp>
+#include <mango/core/memory.hpp>
+#include <mango/core/object.hpp>
+#include <mango/core/compress.hpp>
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------------
+    // CompressionBenchmark
+    // -----------------------------------------------------------------------
+
+    /* Measures the memory block compressors over a corpus so that the codec and
+       level can be chosen per asset class with data. The corpus is split into
+       blocks which are compressed and decompressed on the given number of
+       threads; every combination of codec, level and thread count is one result.
+       The results are written as CSV or JSON, and the ones which no other result
+       with the same thread count beats in both ratio and speed are marked as the
+       Pareto front.
+
+       The speeds are in MB/s (2^20 bytes) of uncompressed data, the fastest of
+       the repeated runs. The memory is the growth of the peak resident memory
+       during the run, not counting the output buffers; zero where it can't be
+       measured.
+    */
+
+    struct CompressionResult
+    {
+        std::string codec;
+        int level;
+        int threads;
+        uint64 size;       // uncompressed bytes
+        uint64 compressed; // bytes
+        double compress;   // MB/s
+        double decompress; // MB/s
+        uint64 memory;     // bytes
+        bool pareto_compress;   // on the front of ratio and compression speed
+        bool pareto_decompress; // on the front of ratio and decompression speed
+
+        double ratio() const;
+    };
+
+    class CompressionBenchmark : private NonCopyable
+    {
+    protected:
+        std::vector<std::vector<uint8>> m_corpus;
+
+    public:
+        CompressionBenchmark();
+        ~CompressionBenchmark();
+
+        // adds a copy of the memory to the corpus
+        void add(Memory memory);
+
+        uint64 size() const;
+
+        std::vector<CompressionResult> run(const std::vector<Compressor>& compressors,
+                                           const std::vector<int>& levels,
+                                           const std::vector<int>& threads,
+                                           size_t blockSize = 1024 * 1024, int repeat = 3) const;
+
+        static std::string csv(const std::vector<CompressionResult>& results);
+        static std::string json(const std::vector<CompressionResult>& results);
+    };
+
+} // namespace mango
@@ -0,0 +1,54 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <mango/filesystem/path.hpp>
+#include <mango/filesystem/file.hpp>
+#include "corpus.hpp"
+
+namespace
+{
+    using namespace mango;
+
+    void loadFolder(const Path& path, const std::function<void(Memory)>& func)
+    {
+        for (const auto& info : path)
+        {
+            if (info.isContainer())
+            {
+                // the archive file itself is in the index as well; measure it as it is
+                continue;
+            }
+
+            if (info.isDirectory())
+            {
+                Path folder(path, info.name);
+                loadFolder(folder, func);
+            }
+            else
+            {
+                File file(path, info.name);
+                func(Memory(file));
+            }
+        }
+    }
+
+} // namespace
+
+namespace mango
+{
+
+    void loadCorpus(const std::string& pathname, std::function<void(Memory)> func)
+    {
+        if (pathname.empty() || pathname.back() != '/')
+        {
+            File file(pathname);
+            func(Memory(file));
+            return;
+        }
+
+        Path path(pathname);
+        loadFolder(path, func);
+    }
+
+} // namespace mango
@@ -0,0 +1,23 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <functional>
+#include <mango/core/memory.hpp>
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------------
+    // corpus
+    // -----------------------------------------------------------------------
+
+    // Calls func with the contents of a file, or of every file in a folder
+    // recursively when the pathname ends with '/'. Archives are folders as
+    // well ("textures/", "assets.zip/"). The memory is valid during the call.
+    void loadCorpus(const std::string& pathname, std::function<void(Memory)> func);
+
+} // namespace mango
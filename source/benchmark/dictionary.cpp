@@ -0,0 +1,279 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <mango/core/exception.hpp>
+#include <mango/core/compress.hpp>
+#include <mango/core/timer.hpp>
+#include "benchmark.hpp"
+#include "corpus.hpp"
+
+/*
+    Small tiles compressed one by one, without and with a trained dictionary.
+
+    The corpus is cut into tiles of the given size. Every fourth tile is a
+    training sample and the rest are measured, so the dictionary has not seen
+    the tiles it compresses. The speeds are on the calling thread and do not
+    include the training.
+*/
+
+namespace
+{
+    using namespace mango;
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
+
+    struct LZ4
+    {
+        using Dictionary = lz4::Dictionary;
+        static const char* name() { return "lz4"; }
+        static size_t bound(size_t size) { return lz4::bound(size); }
+        static size_t compress(Memory dest, Memory source, int level) { return lz4::compress(dest, source, level); }
+        static void decompress(Memory dest, Memory source) { lz4::decompress(dest, source); }
+        static size_t compress(Memory dest, Memory source, const Dictionary& dictionary) { return lz4::compress(dest, source, dictionary); }
+        static void decompress(Memory dest, Memory source, const Dictionary& dictionary) { lz4::decompress(dest, source, dictionary); }
+    };
+
+    struct ZSTD
+    {
+        using Dictionary = zstd::Dictionary;
+        static const char* name() { return "zstd"; }
+        static size_t bound(size_t size) { return zstd::bound(size); }
+        static size_t compress(Memory dest, Memory source, int level) { return zstd::compress(dest, source, level); }
+        static void decompress(Memory dest, Memory source) { zstd::decompress(dest, source); }
+        static size_t compress(Memory dest, Memory source, const Dictionary& dictionary) { return zstd::compress(dest, source, dictionary); }
+        static void decompress(Memory dest, Memory source, const Dictionary& dictionary) { zstd::decompress(dest, source, dictionary); }
+    };
+
+    struct Tile
+    {
+        Memory source;
+        Memory compressed;   // slot of bound() bytes
+        Memory decompressed; // slot of source.size bytes
+        size_t bytes;        // compressed size
+    };
+
+    // the fastest of the runs
+    template <typename Func>
+    double best(int repeat, Func func)
+    {
+        double seconds = 0;
+        for (int i = 0; i < repeat; ++i)
+        {
+            Timer timer;
+            func();
+            const double time = timer.time();
+            seconds = i ? std::min(seconds, time) : time;
+        }
+        return seconds;
+    }
+
+    double speed(uint64 bytes, double seconds)
+    {
+        return seconds > 0 ? double(bytes) / (1024.0 * 1024.0) / seconds : 0.0;
+    }
+
+    template <typename Codec>
+    class TileBenchmark
+    {
+    protected:
+        std::vector<Tile> m_tiles;
+        std::vector<uint8> m_compressed;
+        std::vector<uint8> m_decompressed;
+        uint64 m_size;
+
+        void report(const char* mode, int level, size_t tileSize, double compressTime, double decompressTime)
+        {
+            uint64 compressed = 0;
+            for (const Tile& tile : m_tiles)
+            {
+                if (std::memcmp(tile.decompressed.address, tile.source.address, tile.source.size))
+                {
+                    MANGO_EXCEPTION("[DictionaryBenchmark] Round trip mismatch with " + std::string(Codec::name()) + ".");
+                }
+                compressed += tile.bytes;
+            }
+
+            std::printf("%s,%d,%d,%d,%llu,%s,%llu,%.3f,%.1f,%.1f\n",
+                Codec::name(), level, int(tileSize), int(m_tiles.size()),
+                (unsigned long long)m_size, mode, (unsigned long long)compressed,
+                compressed ? double(m_size) / double(compressed) : 0.0,
+                speed(m_size, compressTime), speed(m_size, decompressTime));
+        }
+
+    public:
+        TileBenchmark(const std::vector<Memory>& tiles)
+            : m_size(0)
+        {
+            size_t capacity = 0;
+            for (const Memory& memory : tiles)
+            {
+                capacity += Codec::bound(memory.size);
+                m_size += memory.size;
+            }
+
+            m_compressed.resize(capacity);
+            m_decompressed.resize(size_t(m_size));
+
+            uint8* slot = m_compressed.data();
+            uint8* output = m_decompressed.data();
+
+            for (const Memory& memory : tiles)
+            {
+                const size_t bound = Codec::bound(memory.size);
+
+                Tile tile;
+                tile.source = memory;
+                tile.compressed = Memory(slot, bound);
+                tile.decompressed = Memory(output, memory.size);
+                tile.bytes = 0;
+                m_tiles.push_back(tile);
+
+                slot += bound;
+                output += memory.size;
+            }
+        }
+
+        void plain(int level, size_t tileSize, int repeat)
+        {
+            const double compressTime = best(repeat, [&]
+            {
+                for (Tile& tile : m_tiles)
+                {
+                    tile.bytes = Codec::compress(tile.compressed, tile.source, level);
+                }
+            });
+
+            const double decompressTime = best(repeat, [&]
+            {
+                for (const Tile& tile : m_tiles)
+                {
+                    Codec::decompress(tile.decompressed, Memory(tile.compressed.address, tile.bytes));
+                }
+            });
+
+            report("plain", level, tileSize, compressTime, decompressTime);
+        }
+
+        void dictionary(Memory content, int level, size_t tileSize, int repeat)
+        {
+            typename Codec::Dictionary dictionary(content, level);
+
+            const double compressTime = best(repeat, [&]
+            {
+                for (Tile& tile : m_tiles)
+                {
+                    tile.bytes = Codec::compress(tile.compressed, tile.source, dictionary);
+                }
+            });
+
+            const double decompressTime = best(repeat, [&]
+            {
+                for (const Tile& tile : m_tiles)
+                {
+                    Codec::decompress(tile.decompressed, Memory(tile.compressed.address, tile.bytes), dictionary);
+                }
+            });
+
+            report("dictionary", level, tileSize, compressTime, decompressTime);
+        }
+    };
+
+#endif
+
+} // namespace
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------------
+    // dictionary command
+    // -----------------------------------------------------------------------
+
+    int dictionaryCommand(const Arguments& args)
+    {
+#ifdef MANGO_ENABLE_LICENSE_BSD
+        std::vector<std::vector<uint8>> corpus;
+
+        for (const auto& pathname : args.values())
+        {
+            loadCorpus(pathname, [&] (Memory memory)
+            {
+                if (memory.size)
+                {
+                    corpus.emplace_back(memory.address, memory.address + memory.size);
+                }
+            });
+        }
+
+        if (corpus.empty())
+        {
+            std::fprintf(stderr, "dictionary: no corpus given.\n");
+            return 1;
+        }
+
+        const std::string codecs = "," + args.get("codec", "lz4,zstd") + ",";
+        const std::vector<int> levels = args.list("level", { 6 });
+        const std::vector<int> tileSizes = args.list("tile", { 1024, 4096, 16384 });
+        const size_t capacity = size_t(std::max(args.get("dict", 64), 1)) * 1024;
+        const int repeat = std::max(args.get("repeat", 3), 1);
+
+        std::printf("codec,level,tile,tiles,size,mode,compressed,ratio,compress_mbps,decompress_mbps\n");
+
+        for (int tileSize : tileSizes)
+        {
+            const size_t size = size_t(std::max(tileSize, 64));
+
+            // every fourth tile trains the dictionary and the rest are measured
+            std::vector<Memory> samples;
+            std::vector<Memory> tiles;
+            for (const auto& data : corpus)
+            {
+                for (size_t offset = 0; offset < data.size(); offset += size)
+                {
+                    Memory tile(const_cast<uint8*>(data.data()) + offset, std::min(size, data.size() - offset));
+                    if ((samples.size() + tiles.size()) % 4)
+                        tiles.push_back(tile);
+                    else
+                        samples.push_back(tile);
+                }
+            }
+
+            if (tiles.empty())
+            {
+                continue;
+            }
+
+            const std::vector<uint8> content = trainDictionary(samples, capacity);
+            const Memory dictionary(const_cast<uint8*>(content.data()), content.size());
+
+            for (int level : levels)
+            {
+                if (codecs.find(",lz4,") != std::string::npos)
+                {
+                    TileBenchmark<LZ4> benchmark(tiles);
+                    benchmark.plain(level, size, repeat);
+                    benchmark.dictionary(dictionary, level, size, repeat);
+                }
+
+                if (codecs.find(",zstd,") != std::string::npos)
+                {
+                    TileBenchmark<ZSTD> benchmark(tiles);
+                    benchmark.plain(level, size, repeat);
+                    benchmark.dictionary(dictionary, level, size, repeat);
+                }
+            }
+        }
+
+        return 0;
+#else
+        (void) args;
+        std::fprintf(stderr, "dictionary: the dictionary codecs are not in this build.\n");
+        return 1;
+#endif
+    }
+
+} // namespace mango
@@ -0,0 +1,137 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include "benchmark.hpp"
+
+namespace
+{
+    using namespace mango;
+
+    struct Command
+    {
+        const char* name;
+        int (*run)(const Arguments& args);
+        const char* usage;
+    };
+
+    const Command g_commands[] =
+    {
+        { "compression", compressionCommand,
+          "compression [-codec lz4,zstd,...] [-level 0,1,...] [-threads 1,4,...] [-block KB] [-repeat n] [-format csv|json] <file|folder/>..." },
+        { "threads", threadsCommand,
+          "threads [-threads max] [-tasks n] [-work iterations] [-repeat n]" },
+        { "dictionary", dictionaryCommand,
+          "dictionary [-codec lz4,zstd] [-level 6,...] [-tile 1024,4096,...] [-dict KB] [-repeat n] <file|folder/>..." },
+    };
+
+    void usage()
+    {
+        std::printf("usage: mango-benchmark <command> [options]\n");
+        for (const Command& command : g_commands)
+        {
+            std::printf("  %s\n", command.usage);
+        }
+    }
+
+} // namespace
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------------
+    // Arguments
+    // -----------------------------------------------------------------------
+
+    Arguments::Arguments(int argc, const char* const* argv)
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            if (argv[i][0] == '-' && argv[i][1] && i + 1 < argc)
+            {
+                m_options[argv[i] + 1] = argv[i + 1];
+                ++i;
+            }
+            else
+            {
+                m_values.push_back(argv[i]);
+            }
+        }
+    }
+
+    Arguments::~Arguments()
+    {
+    }
+
+    const std::vector<std::string>& Arguments::values() const
+    {
+        return m_values;
+    }
+
+    std::string Arguments::get(const std::string& name, const std::string& defaultValue) const
+    {
+        auto i = m_options.find(name);
+        return i != m_options.end() ? i->second : defaultValue;
+    }
+
+    int Arguments::get(const std::string& name, int defaultValue) const
+    {
+        auto i = m_options.find(name);
+        return i != m_options.end() ? std::atoi(i->second.c_str()) : defaultValue;
+    }
+
+    std::vector<int> Arguments::list(const std::string& name, const std::vector<int>& defaultValue) const
+    {
+        auto i = m_options.find(name);
+        if (i == m_options.end())
+            return defaultValue;
+
+        std::vector<int> values;
+        const char* s = i->second.c_str();
+
+        while (*s)
+        {
+            char* end;
+            values.push_back(int(std::strtol(s, &end, 10)));
+            s = *end == ',' ? end + 1 : end;
+            if (end == s && *s)
+                break; // not a number
+        }
+
+        return values;
+    }
+
+} // namespace mango
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    for (const Command& command : g_commands)
+    {
+        if (!std::strcmp(argv[1], command.name))
+        {
+            try
+            {
+                Arguments args(argc - 2, argv + 2);
+                return command.run(args);
+            }
+            catch (const std::exception& e)
+            {
+                std::fprintf(stderr, "%s: %s\n", command.name, e.what());
+                return 1;
+            }
+        }
+    }
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,137 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <mango/core/thread.hpp>
+#include <mango/core/timer.hpp>
+#include "benchmark.hpp"
+
+/*
+    Task throughput of the ThreadPool from one worker up to the given count.
+
+    flat:   the calling thread enqueues all of the tasks and waits
+    nested: root tasks enqueue the tasks from the workers, which puts them in
+            the workers' own deques so that the others have to steal them
+
+    Each task runs a short dependent integer loop of the given length; with a
+    short loop the result is the scheduling overhead.
+*/
+
+namespace
+{
+    using namespace mango;
+
+    std::atomic<uint32> g_sink { 0 };
+
+    inline void work(uint32 seed, int iterations)
+    {
+        uint32 x = seed;
+        for (int i = 0; i < iterations; ++i)
+        {
+            x = x * 1664525 + 1013904223;
+        }
+
+        // keeps the loop from being optimized away
+        if (!x)
+        {
+            g_sink.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    double flat(ThreadPool& pool, int tasks, int iterations)
+    {
+        ConcurrentQueue queue(pool, "flat");
+        Timer timer;
+
+        for (int i = 0; i < tasks; ++i)
+        {
+            queue.enqueue([=]
+            {
+                work(uint32(i), iterations);
+            });
+        }
+
+        queue.wait();
+        return timer.time();
+    }
+
+    double nested(ThreadPool& pool, int tasks, int iterations)
+    {
+        ConcurrentQueue queue(pool, "nested");
+        const int roots = 64;
+        const int children = tasks / roots;
+        Timer timer;
+
+        for (int i = 0; i < roots; ++i)
+        {
+            queue.enqueue([&queue, i, children, iterations]
+            {
+                for (int j = 0; j < children; ++j)
+                {
+                    const uint32 seed = uint32(i * children + j);
+                    queue.enqueue([=]
+                    {
+                        work(seed, iterations);
+                    });
+                }
+            });
+        }
+
+        queue.wait();
+        return timer.time();
+    }
+
+} // namespace
+
+namespace mango
+{
+
+    int threadsCommand(const Arguments& args)
+    {
+        const int hardware = std::max(int(std::thread::hardware_concurrency()), 1);
+        const int maxWorkers = std::max(args.get("threads", hardware), 1);
+        // a multiple of the nested roots so both patterns run the same count
+        const int tasks = std::max(args.get("tasks", 1000000) / 64, 1) * 64;
+        const int iterations = std::max(args.get("work", 100), 0);
+        const int repeat = std::max(args.get("repeat", 3), 1);
+
+        std::printf("pattern,workers,tasks,work,seconds,mtasks_per_second,speedup\n");
+
+        const char* names[] = { "flat", "nested" };
+        double (*patterns[])(ThreadPool&, int, int) = { flat, nested };
+
+        for (int p = 0; p < 2; ++p)
+        {
+            double base = 0;
+
+            for (int workers = 1; workers <= maxWorkers; ++workers)
+            {
+                ThreadPool pool(workers);
+
+                // the fastest of the runs; the first one also warms up the pool
+                double best = 0;
+                for (int i = 0; i < repeat; ++i)
+                {
+                    const double seconds = patterns[p](pool, tasks, iterations);
+                    best = i ? std::min(best, seconds) : seconds;
+                }
+
+                const double rate = best > 0 ? tasks / best / 1000000.0 : 0;
+                if (workers == 1)
+                {
+                    base = rate;
+                }
+
+                std::printf("%s,%d,%d,%d,%.4f,%.3f,%.2f\n", names[p], workers, tasks, iterations,
+                    best, rate, base > 0 ? rate / base : 0.0);
+            }
+        }
+
+        return 0;
+    }
+
+} // namespace mango
@@ -2,13 +2,87 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
+#include <algorithm>
+#include <mutex>
 #include <mango/core/buffer.hpp>
 #include <mango/core/exception.hpp>
 
 #define ID "Buffer: "
 
+namespace {
+
+    using namespace mango;
+
+    const size_t MIN_SEGMENT_SIZE = 64 * 1024;
+    const size_t MAX_SEGMENT_SIZE = 4 * 1024 * 1024;
+    const size_t POOL_SIZE = 32 * 1024 * 1024;
+
+    // Segments of the standard sizes released by the ChunkedBuffers, up to POOL_SIZE bytes.
+    struct SegmentPool
+    {
+        std::mutex mutex;
+        std::vector<Memory> segments;
+        size_t bytes = 0;
+
+        uint8* acquire(size_t size)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 0; i < segments.size(); ++i)
+                {
+                    if (segments[i].size == size)
+                    {
+                        uint8* address = segments[i].address;
+                        segments[i] = segments.back();
+                        segments.pop_back();
+                        bytes -= size;
+                        return address;
+                    }
+                }
+            }
+
+            uint8* address = reinterpret_cast<uint8*>(large_malloc(size));
+            if (!address)
+            {
+                throw std::bad_alloc();
+            }
+
+            return address;
+        }
+
+        void release(uint8* address, size_t size)
+        {
+            const bool standard = size >= MIN_SEGMENT_SIZE && size <= MAX_SEGMENT_SIZE && !(size & (size - 1));
+            if (standard)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (bytes + size <= POOL_SIZE)
+                {
+                    segments.emplace_back(address, size);
+                    bytes += size;
+                    return;
+                }
+            }
+
+            large_free(address);
+        }
+    };
+
+    SegmentPool& getSegmentPool()
+    {
+        // never destroyed; buffers can be released by the static destructors
+        static SegmentPool* pool = new SegmentPool();
+        return *pool;
+    }
+
+} // namespace
+
 namespace mango {
 
+    // -----------------------------------------------------------------------
+    // Buffer
+    // -----------------------------------------------------------------------
+
     Buffer::Buffer()
         : m_offset(0)
     {
@@ -95,15 +169,14 @@ namespace mango {
     void Buffer::write(const void* data, size_t size)
     {
         const uint8 *source = reinterpret_cast<const uint8 *>(data);
-        const size_t left = m_buffer.size() - m_offset;
+        const size_t left = std::min(m_buffer.size() - m_offset, size);
         const size_t right = size - left;
 
         if (left > 0) {
             // write into existing array
-            size = std::min(size, left);
-            std::memcpy(&m_buffer[m_offset], source, size);
-            source += size;
-            m_offset += size;
+            std::memcpy(&m_buffer[m_offset], source, left);
+            source += left;
+            m_offset += left;
         }
 
         if (right > 0) {
@@ -113,4 +186,243 @@ namespace mango {
         }
     }
 
+    // -----------------------------------------------------------------------
+    // ChunkedBuffer
+    // -----------------------------------------------------------------------
+
+    ChunkedBuffer::ChunkedBuffer()
+        : m_current(0)
+        , m_size(0)
+        , m_offset(0)
+        , m_flat(nullptr)
+    {
+    }
+
+    ChunkedBuffer::~ChunkedBuffer()
+    {
+        reset();
+    }
+
+    void ChunkedBuffer::reset()
+    {
+        invalidate();
+
+        SegmentPool& pool = getSegmentPool();
+        for (Segment& segment : m_segments)
+        {
+            pool.release(segment.address, segment.capacity);
+        }
+
+        m_segments.clear();
+        m_current = 0;
+        m_size = 0;
+        m_offset = 0;
+    }
+
+    void ChunkedBuffer::invalidate()
+    {
+        large_free(m_flat);
+        m_flat = nullptr;
+    }
+
+    std::vector<Memory> ChunkedBuffer::segments() const
+    {
+        std::vector<Memory> result;
+        for (const Segment& segment : m_segments)
+        {
+            if (segment.size)
+                result.emplace_back(segment.address, segment.size);
+        }
+        return result;
+    }
+
+    Memory ChunkedBuffer::flatten()
+    {
+        if (m_segments.empty() || m_segments[0].size == m_size)
+        {
+            // already contiguous
+            return m_segments.empty() ? Memory() : Memory(m_segments[0].address, size_t(m_size));
+        }
+
+        if (!m_flat)
+        {
+            m_flat = reinterpret_cast<uint8*>(large_malloc(size_t(m_size)));
+            if (!m_flat)
+            {
+                throw std::bad_alloc();
+            }
+
+            for (const Segment& segment : m_segments)
+            {
+                std::memcpy(m_flat + segment.offset, segment.address, segment.size);
+            }
+        }
+
+        return Memory(m_flat, size_t(m_size));
+    }
+
+    Memory ChunkedBuffer::reserve(size_t minimum)
+    {
+        SegmentPool& pool = getSegmentPool();
+
+        size_t capacity = MIN_SEGMENT_SIZE;
+        if (!m_segments.empty())
+        {
+            Segment& last = m_segments.back();
+            if (last.capacity - last.size >= minimum)
+            {
+                return Memory(last.address + last.size, last.capacity - last.size);
+            }
+
+            capacity = std::min(last.capacity * 2, MAX_SEGMENT_SIZE);
+
+            if (!last.size)
+            {
+                // too small to be of any use
+                pool.release(last.address, last.capacity);
+                m_segments.pop_back();
+            }
+        }
+
+        Segment segment;
+        segment.capacity = std::max(capacity, minimum);
+        segment.address = pool.acquire(segment.capacity);
+        segment.size = 0;
+        segment.offset = m_size;
+        m_segments.push_back(segment);
+
+        return Memory(segment.address, segment.capacity);
+    }
+
+    void ChunkedBuffer::commit(size_t size)
+    {
+        invalidate();
+
+        Segment& last = m_segments.back();
+        last.size += size;
+        m_size += size;
+        m_offset = m_size;
+    }
+
+    void ChunkedBuffer::append(const uint8* data, size_t size)
+    {
+        while (size > 0)
+        {
+            Memory space = reserve();
+            const size_t bytes = std::min(size, space.size);
+
+            if (data)
+            {
+                std::memcpy(space.address, data, bytes);
+                data += bytes;
+            }
+            else
+            {
+                std::memset(space.address, 0, bytes);
+            }
+
+            commit(bytes);
+            size -= bytes;
+        }
+    }
+
+    size_t ChunkedBuffer::locate(uint64 offset)
+    {
+        // sequential access stays in the current segment or moves to the next one
+        for (size_t i = m_current; i < std::min(m_current + 2, m_segments.size()); ++i)
+        {
+            const Segment& segment = m_segments[i];
+            if (offset >= segment.offset && offset < segment.offset + segment.size)
+            {
+                m_current = i;
+                return i;
+            }
+        }
+
+        auto i = std::upper_bound(m_segments.begin(), m_segments.end(), offset, [] (uint64 offset, const Segment& segment)
+        {
+            return offset < segment.offset;
+        });
+
+        m_current = size_t(i - m_segments.begin()) - 1;
+        return m_current;
+    }
+
+    uint64 ChunkedBuffer::size() const
+    {
+        return m_size;
+    }
+
+    uint64 ChunkedBuffer::offset() const
+    {
+        return m_offset;
+    }
+
+    void ChunkedBuffer::seek(uint64 distance, SeekMode mode)
+    {
+        switch (mode)
+        {
+            case BEGIN:
+                m_offset = distance;
+                break;
+
+            case CURRENT:
+                m_offset += distance;
+                break;
+
+            case END:
+                m_offset = m_size - distance;
+                break;
+        }
+    }
+
+    void ChunkedBuffer::read(void* dest, size_t size)
+    {
+        if (m_offset > m_size || m_size - m_offset < size) {
+            MANGO_EXCEPTION(ID"Reading past end of buffer.");
+        }
+
+        uint8* d = reinterpret_cast<uint8*>(dest);
+        while (size > 0)
+        {
+            const Segment& segment = m_segments[locate(m_offset)];
+            const size_t position = size_t(m_offset - segment.offset);
+            const size_t bytes = std::min(size, segment.size - position);
+
+            std::memcpy(d, segment.address + position, bytes);
+            d += bytes;
+            size -= bytes;
+            m_offset += bytes;
+        }
+    }
+
+    void ChunkedBuffer::write(const void* data, size_t size)
+    {
+        invalidate();
+
+        if (m_offset > m_size)
+        {
+            // seeked past the end; the gap is zero filled
+            append(nullptr, size_t(m_offset - m_size));
+        }
+
+        const uint8* s = reinterpret_cast<const uint8*>(data);
+
+        // overwrite
+        while (size > 0 && m_offset < m_size)
+        {
+            const Segment& segment = m_segments[locate(m_offset)];
+            const size_t position = size_t(m_offset - segment.offset);
+            const size_t bytes = std::min(size, segment.size - position);
+
+            std::memcpy(segment.address + position, s, bytes);
+            s += bytes;
+            size -= bytes;
+            m_offset += bytes;
+        }
+
+        // append
+        append(s, size);
+    }
+
 } // namespace mango
@@ -4,12 +4,16 @@
 */
 
 #include <vector>
+#include <memory>
+#include <cstring>
+#include <algorithm>
 
 #include <mango/core/compress.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/core/buffer.hpp>
 #include <mango/core/bits.hpp>
 #include <mango/core/endian.hpp>
+#include <mango/core/thread.hpp>
 
 #define MINIZ_HEADER_FILE_ONLY
 #define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
@@ -141,6 +145,132 @@ namespace lz4 {
         }
     }
 
+    // dictionary
+
+    struct DictionaryContext
+    {
+        std::vector<uint8> content;
+        LZ4_stream_t stream; // digested content
+        LZ4_streamHC_t* streamHC; // digested content for the levels above 6
+        int acceleration;
+    };
+
+    // the HC state is too large for the stack; each thread copies the digested
+    // state into its own buffer
+    struct StreamHC
+    {
+        LZ4_streamHC_t* stream;
+
+        StreamHC()
+            : stream(LZ4_createStreamHC())
+        {
+        }
+
+        ~StreamHC()
+        {
+            LZ4_freeStreamHC(stream);
+        }
+    };
+
+    static LZ4_streamHC_t* getStreamHC()
+    {
+        static thread_local StreamHC state;
+        if (!state.stream)
+        {
+            MANGO_EXCEPTION("lz4: out of memory.");
+        }
+        return state.stream;
+    }
+
+    Dictionary::Dictionary(Memory content, int level)
+        : m_context(new DictionaryContext)
+    {
+        // lz4 only refers to the last 64 KB
+        const size_t size = std::min(content.size, size_t(64 * 1024));
+        m_context->content.assign(content.address + content.size - size, content.address + content.size);
+
+        const char* dict = reinterpret_cast<const char*>(m_context->content.data());
+
+        level = clamp(level, 0, 10);
+        m_context->acceleration = 19 - std::min(level, 6) * 3;
+        m_context->streamHC = nullptr;
+
+        if (level > 6)
+        {
+            // the levels of lz4::compress(), up to the last hash chain level; the
+            // optimal parser is two orders of magnitude slower with a dictionary
+            const int compression = std::min(1 + (level - 7) * 5, LZ4HC_CLEVEL_OPT_MIN - 1);
+
+            m_context->streamHC = LZ4_createStreamHC();
+            if (!m_context->streamHC)
+            {
+                delete m_context;
+                MANGO_EXCEPTION("lz4: dictionary creation failed.");
+            }
+
+            LZ4_resetStreamHC(m_context->streamHC, compression);
+            LZ4_loadDictHC(m_context->streamHC, dict, int(size));
+        }
+        else
+        {
+            LZ4_resetStream(&m_context->stream);
+            LZ4_loadDict(&m_context->stream, dict, int(size));
+        }
+    }
+
+    Dictionary::~Dictionary()
+    {
+        LZ4_freeStreamHC(m_context->streamHC);
+        delete m_context;
+    }
+
+    const DictionaryContext* Dictionary::context() const
+    {
+        return m_context;
+    }
+
+    size_t compress(Memory dest, Memory source, const Dictionary& dictionary)
+    {
+        const DictionaryContext& context = *dictionary.context();
+
+        int written;
+
+        // the digested state is copied so that the dictionary stays read-only
+        if (context.streamHC)
+        {
+            LZ4_streamHC_t* stream = getStreamHC();
+            std::memcpy(stream, context.streamHC, sizeof(LZ4_streamHC_t));
+
+            written = LZ4_compress_HC_continue(stream, source, dest, int(source.size), int(dest.size));
+        }
+        else
+        {
+            LZ4_stream_t stream = context.stream;
+
+            written = LZ4_compress_fast_continue(&stream, source, dest,
+                int(source.size), int(dest.size), context.acceleration);
+        }
+
+        if (written <= 0)
+        {
+            MANGO_EXCEPTION("lz4: compression failed.");
+        }
+
+        return written;
+    }
+
+    void decompress(Memory dest, Memory source, const Dictionary& dictionary)
+    {
+        const DictionaryContext& context = *dictionary.context();
+
+        const int status = LZ4_decompress_safe_usingDict(source, dest, int(source.size), int(dest.size),
+            reinterpret_cast<const char*>(context.content.data()), int(context.content.size()));
+        if (status < 0)
+        {
+            MANGO_EXCEPTION("lz4: decompression failed.");
+        }
+    }
+
     // stream
 
     class StreamEncoderLZ4 : public StreamEncoder
@@ -361,6 +491,97 @@ namespace zstd {
         }
     }
 
+    // dictionary
+
+    struct DictionaryContext
+    {
+        ZSTD_CDict* cdict;
+        ZSTD_DDict* ddict;
+    };
+
+    // the contexts are reused by the calls on each thread; the payloads are small
+    // and creating the contexts would cost more than compressing
+    struct ThreadContext
+    {
+        ZSTD_CCtx* cctx;
+        ZSTD_DCtx* dctx;
+
+        ThreadContext()
+            : cctx(ZSTD_createCCtx())
+            , dctx(ZSTD_createDCtx())
+        {
+        }
+
+        ~ThreadContext()
+        {
+            ZSTD_freeCCtx(cctx);
+            ZSTD_freeDCtx(dctx);
+        }
+    };
+
+    static ThreadContext& getThreadContext()
+    {
+        static thread_local ThreadContext context;
+        return context;
+    }
+
+    Dictionary::Dictionary(Memory content, int level)
+        : m_context(new DictionaryContext)
+    {
+        level = clamp(level * 2, 1, 20);
+
+        m_context->cdict = ZSTD_createCDict(content.address, content.size, level);
+        m_context->ddict = ZSTD_createDDict(content.address, content.size);
+
+        if (!m_context->cdict || !m_context->ddict)
+        {
+            ZSTD_freeCDict(m_context->cdict);
+            ZSTD_freeDDict(m_context->ddict);
+            delete m_context;
+            MANGO_EXCEPTION("ZSTD: dictionary creation failed.");
+        }
+    }
+
+    Dictionary::~Dictionary()
+    {
+        ZSTD_freeCDict(m_context->cdict);
+        ZSTD_freeDDict(m_context->ddict);
+        delete m_context;
+    }
+
+    const DictionaryContext* Dictionary::context() const
+    {
+        return m_context;
+    }
+
+    size_t compress(Memory dest, Memory source, const Dictionary& dictionary)
+    {
+        const size_t x = ZSTD_compress_usingCDict(getThreadContext().cctx, dest.address, dest.size,
+                                                  source.address, source.size, dictionary.context()->cdict);
+        if (ZSTD_isError(x))
+        {
+            const char* error = ZSTD_getErrorName(x);
+            std::string s = "ZSTD: ";
+            s += error;
+            MANGO_EXCEPTION(s);
+        }
+
+        return x;
+    }
+
+    void decompress(Memory dest, Memory source, const Dictionary& dictionary)
+    {
+        const size_t x = ZSTD_decompress_usingDDict(getThreadContext().dctx, dest.address, dest.size,
+                                                    source.address, source.size, dictionary.context()->ddict);
+        if (ZSTD_isError(x))
+        {
+            const char* error = ZSTD_getErrorName(x);
+            std::string s = "ZSTD: ";
+            s += error;
+            MANGO_EXCEPTION(s);
+        }
+    }
+
     // stream
 
     class StreamEncoderZSTD : public StreamEncoder
@@ -596,4 +817,1306 @@ namespace lzfse {
 
 #endif // MANGO_ENABLE_LICENSE_ZLIB
 
+// ----------------------------------------------------------------------------
+// trainDictionary
+// ----------------------------------------------------------------------------
+
+namespace {
+
+    const size_t DMER_SIZE = 8;
+    const int DMER_HASH_BITS = 20;
+
+    inline uint32 hashDmer(const uint8* p)
+    {
+        return uint32((uload64(p) * 0xcf1bbcdcb7a56463ull) >> (64 - DMER_HASH_BITS));
+    }
+
+} // namespace
+
+// The samples are concatenated and divided into epochs, one for each segment of
+// the dictionary. The segment of an epoch which contains the most frequent d-mers
+// (8 byte sequences) is selected, after which its d-mers don't score again. The
+// first selections go to the end of the dictionary, closest to the payload.
+
+std::vector<uint8> trainDictionary(const std::vector<Memory>& samples, size_t capacity)
+{
+    std::vector<uint8> corpus;
+    std::vector<uint32> frequency(size_t(1) << DMER_HASH_BITS, 0);
+
+    for (const Memory& sample : samples)
+    {
+        corpus.insert(corpus.end(), sample.address, sample.address + sample.size);
+
+        // the d-mers which don't cross the sample boundaries
+        for (size_t i = 0; i + DMER_SIZE <= sample.size; ++i)
+        {
+            ++frequency[hashDmer(sample.address + i)];
+        }
+    }
+
+    if (corpus.size() <= capacity)
+    {
+        return corpus;
+    }
+
+    const size_t segment = clamp(capacity / 64, size_t(64), size_t(1024));
+    const size_t epochs = std::max(capacity / segment, size_t(1));
+    const size_t epoch = std::max(corpus.size() / epochs, segment);
+
+    std::vector<uint8> dictionary(capacity);
+    std::vector<uint16> active(size_t(1) << DMER_HASH_BITS, 0);
+    size_t tail = capacity;
+    bool progress = true;
+
+    // select segments until the dictionary is full or a pass over the epochs adds nothing
+    while (tail && progress)
+    {
+        progress = false;
+
+        for (size_t begin = 0; begin + DMER_SIZE <= corpus.size() && tail; begin += epoch)
+        {
+            const size_t end = std::min(begin + epoch, corpus.size());
+            const uint8* data = corpus.data();
+
+            uint64 score = 0;
+            uint64 best = 0;
+            size_t best_start = begin;
+            size_t start = begin;
+
+            // sliding window of the segment size; a d-mer scores once in the window
+            for (size_t i = begin; i + DMER_SIZE <= end; ++i)
+            {
+                const uint32 h = hashDmer(data + i);
+                if (!active[h]++)
+                    score += frequency[h];
+
+                if (i + DMER_SIZE - start > segment)
+                {
+                    const uint32 r = hashDmer(data + start);
+                    if (!--active[r])
+                        score -= frequency[r];
+                    ++start;
+                }
+
+                if (score > best)
+                {
+                    best = score;
+                    best_start = start;
+                }
+            }
+
+            for (size_t i = start; i + DMER_SIZE <= end; ++i)
+            {
+                --active[hashDmer(data + i)];
+            }
+
+            if (!best)
+                continue;
+
+            const size_t best_end = std::min(best_start + segment, end);
+            for (size_t i = best_start; i + DMER_SIZE <= best_end; ++i)
+            {
+                frequency[hashDmer(data + i)] = 0;
+            }
+
+            const size_t size = std::min(best_end - best_start, tail);
+            tail -= size;
+            std::memcpy(dictionary.data() + tail, data + best_end - size, size);
+            progress = true;
+        }
+    }
+
+    dictionary.erase(dictionary.begin(), dictionary.begin() + tail);
+    return dictionary;
+}
+
+// ----------------------------------------------------------------------------
+// parallel
+// ----------------------------------------------------------------------------
+
+namespace {
+
+    // frame header: signature, codec, block size, block count, size; followed by the block offsets
+    const uint32 FRAME_SIGNATURE = 0x3146424d; // "MBF1"
+    const size_t FRAME_HEADER_SIZE = 24;
+
+    // calls func(index) for each index on the thread pool; the first exception is rethrown
+    template <typename Func>
+    void parallelFor(size_t count, Func func)
+    {
+        if (count > 1 && ThreadPool::getInstanceSize() > 1)
+        {
+            ConcurrentQueue queue("compress");
+            parallel_for(queue, 0, int(count), 1, [&] (int begin, int end)
+            {
+                for (int i = begin; i < end; ++i)
+                {
+                    func(size_t(i));
+                }
+            });
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                func(i);
+            }
+        }
+    }
+
+    // Decodes a block of the block formats; dest.size is the size of the block.
+    // lz4::decompress() and lzo::decompress() trust the input, so those use
+    // the bounds checked decoders here and the decoded size must match.
+    void decodeBlock(const Compressor& compressor, Memory dest, Memory source)
+    {
+        switch (compressor.codec)
+        {
+#ifdef MANGO_ENABLE_LICENSE_BSD
+            case Codec::LZ4:
+            {
+                const int bytes = LZ4_decompress_safe(source, dest, int(source.size), int(dest.size));
+                if (bytes < 0 || size_t(bytes) != dest.size)
+                {
+                    MANGO_EXCEPTION("lz4: decompression failed.");
+                }
+                break;
+            }
+
+            case Codec::LZO:
+            {
+                lzo_uint bytes = lzo_uint(dest.size);
+                const int x = lzo1x_decompress_safe(source.address, lzo_uint(source.size), dest.address, &bytes, NULL);
+                if (x != LZO_E_OK || bytes != dest.size)
+                {
+                    MANGO_EXCEPTION("lzo: decompression failed.");
+                }
+                break;
+            }
+#endif
+
+            default:
+                compressor.decompress(dest, source);
+                break;
+        }
+    }
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// getCompressor()
+// ----------------------------------------------------------------------------
+
+std::vector<Compressor> getCompressors()
+{
+    std::vector<Compressor> compressors;
+
+    compressors.push_back({ Codec::MINIZ, "miniz", miniz::bound, miniz::compress, miniz::decompress });
+#ifdef MANGO_ENABLE_LICENSE_BSD
+    compressors.push_back({ Codec::LZ4, "lz4", lz4::bound, lz4::compress, lz4::decompress });
+    compressors.push_back({ Codec::LZO, "lzo", lzo::bound, lzo::compress, lzo::decompress });
+    compressors.push_back({ Codec::ZSTD, "zstd", zstd::bound, zstd::compress, zstd::decompress });
+#endif
+#ifdef MANGO_ENABLE_LICENSE_ZLIB
+    compressors.push_back({ Codec::BZIP2, "bzip2", bzip2::bound, bzip2::compress, bzip2::decompress });
+    compressors.push_back({ Codec::LZFSE, "lzfse", lzfse::bound, lzfse::compress, lzfse::decompress });
+#endif
+
+    return compressors;
+}
+
+Compressor getCompressor(Codec codec)
+{
+    for (const Compressor& compressor : getCompressors())
+    {
+        if (compressor.codec == codec)
+            return compressor;
+    }
+
+    MANGO_EXCEPTION("Compressor: codec is not supported.");
+}
+
+namespace parallel {
+
+    size_t bound(size_t size, Codec codec, size_t blockSize)
+    {
+        const Compressor compressor = getCompressor(codec);
+
+        blockSize = std::max(blockSize, size_t(1));
+        const size_t blocks = (size + blockSize - 1) / blockSize;
+
+        // every block is compressed into a slot of the worst case size and the slots are packed at the end
+        const size_t slot = std::max(compressor.bound(std::min(size, blockSize)), std::min(size, blockSize));
+        return FRAME_HEADER_SIZE + (blocks + 1) * 8 + blocks * slot;
+    }
+
+    size_t compress(Memory dest, Memory source, Codec codec, int level, size_t blockSize)
+    {
+        const Compressor compressor = getCompressor(codec);
+
+        blockSize = clamp(blockSize, size_t(1), size_t(0xffffffff));
+        const size_t blocks = (source.size + blockSize - 1) / blockSize;
+
+        if (dest.size < bound(source.size, codec, blockSize))
+        {
+            MANGO_EXCEPTION("parallel: not enough room in the output buffer.");
+        }
+
+        uint8* header = dest.address;
+        uint8* offsets = header + FRAME_HEADER_SIZE;
+        uint8* data = offsets + (blocks + 1) * 8;
+
+        const size_t slot = std::max(compressor.bound(std::min(source.size, blockSize)), std::min(source.size, blockSize));
+        std::vector<size_t> sizes(blocks);
+
+        parallelFor(blocks, [&] (size_t i)
+        {
+            const size_t offset = i * blockSize;
+            Memory input(source.address + offset, std::min(blockSize, source.size - offset));
+            Memory output(data + i * slot, slot);
+
+            size_t bytes = 0;
+            try
+            {
+                bytes = compressor.compress(output, input, level);
+            }
+            catch (Exception&)
+            {
+                // stored
+            }
+
+            if (!bytes || bytes >= input.size)
+            {
+                std::memcpy(output.address, input.address, input.size);
+                bytes = input.size;
+            }
+
+            sizes[i] = bytes;
+        });
+
+        // pack the slots; the blocks only move towards the start
+        size_t position = 0;
+
+        for (size_t i = 0; i < blocks; ++i)
+        {
+            std::memmove(data + position, data + i * slot, sizes[i]);
+            ustore64le(offsets + i * 8, position);
+            position += sizes[i];
+        }
+
+        ustore64le(offsets + blocks * 8, position);
+
+        ustore32le(header + 0, FRAME_SIGNATURE);
+        ustore32le(header + 4, uint32(codec));
+        ustore32le(header + 8, uint32(blockSize));
+        ustore32le(header + 12, uint32(blocks));
+        ustore64le(header + 16, source.size);
+
+        return size_t(data - dest.address) + position;
+    }
+
+    void decompress(Memory dest, Memory source)
+    {
+        BlockFrame frame(source);
+        frame.decompress(dest);
+    }
+
+} // namespace parallel
+
+// ----------------------------------------------------------------------------
+// BlockFrame
+// ----------------------------------------------------------------------------
+
+BlockFrame::BlockFrame(Memory frame)
+{
+    if (frame.size < FRAME_HEADER_SIZE || uload32le(frame.address) != FRAME_SIGNATURE)
+    {
+        MANGO_EXCEPTION("BlockFrame: incorrect signature.");
+    }
+
+    m_codec = Codec(uload32le(frame.address + 4));
+    m_block_size = uload32le(frame.address + 8);
+    const uint64 blocks = uload32le(frame.address + 12);
+    m_size = uload64le(frame.address + 16);
+
+    const uint64 header = FRAME_HEADER_SIZE + (blocks + 1) * 8;
+    if (!m_block_size || blocks != (m_size + m_block_size - 1) / m_block_size || header > frame.size)
+    {
+        MANGO_EXCEPTION("BlockFrame: incorrect header.");
+    }
+
+    m_data = Memory(frame.address + header, frame.size - size_t(header));
+
+    m_offsets.resize(size_t(blocks + 1));
+    for (size_t i = 0; i <= blocks; ++i)
+    {
+        m_offsets[i] = uload64le(frame.address + FRAME_HEADER_SIZE + i * 8);
+        if (m_offsets[i] > m_data.size || (i && m_offsets[i] < m_offsets[i - 1]))
+        {
+            MANGO_EXCEPTION("BlockFrame: incorrect block offset.");
+        }
+    }
+}
+
+BlockFrame::~BlockFrame()
+{
+}
+
+Codec BlockFrame::codec() const
+{
+    return m_codec;
+}
+
+uint64 BlockFrame::size() const
+{
+    return m_size;
+}
+
+size_t BlockFrame::blocks() const
+{
+    return m_offsets.size() - 1;
+}
+
+size_t BlockFrame::blockSize() const
+{
+    return m_block_size;
+}
+
+void BlockFrame::decompress(Memory dest) const
+{
+    if (dest.size < m_size)
+    {
+        MANGO_EXCEPTION("BlockFrame: not enough room in the output buffer.");
+    }
+
+    parallelFor(blocks(), [&] (size_t i)
+    {
+        const size_t offset = i * m_block_size;
+        decompress(Memory(dest.address + offset, dest.size - offset), i);
+    });
+}
+
+void BlockFrame::decompress(Memory dest, size_t block) const
+{
+    if (block >= blocks())
+    {
+        MANGO_EXCEPTION("BlockFrame: incorrect block.");
+    }
+
+    const uint64 offset = uint64(block) * m_block_size;
+    const size_t size = size_t(std::min(uint64(m_block_size), m_size - offset));
+    if (dest.size < size)
+    {
+        MANGO_EXCEPTION("BlockFrame: not enough room in the output buffer.");
+    }
+
+    Memory input(m_data.address + m_offsets[block], size_t(m_offsets[block + 1] - m_offsets[block]));
+    Memory output(dest.address, size);
+
+    if (input.size == size)
+    {
+        // stored
+        std::memcpy(output.address, input.address, size);
+    }
+    else
+    {
+        const Compressor compressor = getCompressor(m_codec);
+        decodeBlock(compressor, output, input);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// streaming contexts
+// ----------------------------------------------------------------------------
+
+static const size_t STREAM_WINDOW_SIZE = 256 * 1024;
+
+// the codec interfaces take 32 bit sizes
+static const size_t STREAM_CHUNK_SIZE = 1 << 30;
+
+struct CompressContext
+{
+    Stream& output;
+    std::vector<uint8> window;
+
+    CompressContext(Stream& output)
+        : output(output)
+        , window(STREAM_WINDOW_SIZE)
+    {
+    }
+
+    virtual ~CompressContext()
+    {
+    }
+
+    virtual void compress(const uint8* data, size_t size) = 0;
+    virtual void finish() = 0;
+};
+
+struct DecompressContext
+{
+    Stream& input;
+    std::vector<uint8> window;
+    size_t position;
+    size_t available;
+
+    DecompressContext(Stream& input, size_t windowSize = STREAM_WINDOW_SIZE)
+        : input(input)
+        , window(windowSize)
+        , position(0)
+        , available(0)
+    {
+    }
+
+    virtual ~DecompressContext()
+    {
+    }
+
+    // returns the bytes decompressed, less than size only at the end of the stream
+    virtual size_t decompress(uint8* dest, size_t size) = 0;
+
+    // refills the input window when it has been consumed; false at the end of the input
+    bool refill()
+    {
+        if (position < available)
+            return true;
+
+        const uint64 offset = input.offset();
+        const uint64 remain = input.size() > offset ? input.size() - offset : 0;
+
+        position = 0;
+        available = size_t(std::min(uint64(window.size()), remain));
+
+        if (available)
+        {
+            input.read(window.data(), available);
+        }
+
+        return available > 0;
+    }
+
+    // seeks the input back over the window left unconsumed at the end of the stream,
+    // so that the input continues right after the compressed data
+    void rewind()
+    {
+        if (position < available)
+        {
+            input.seek(input.offset() - (available - position), Stream::BEGIN);
+        }
+
+        position = 0;
+        available = 0;
+    }
+
+    // reads the rest of the window and then exactly the missing bytes from the input;
+    // false when the input ends first
+    bool read(uint8* dest, size_t size)
+    {
+        const size_t bytes = std::min(size, available - position);
+        if (bytes)
+        {
+            std::memcpy(dest, window.data() + position, bytes);
+            position += bytes;
+            dest += bytes;
+            size -= bytes;
+        }
+
+        if (size)
+        {
+            const uint64 offset = input.offset();
+            const uint64 remain = input.size() > offset ? input.size() - offset : 0;
+            if (remain < size)
+                return false;
+
+            input.read(dest, size);
+        }
+
+        return true;
+    }
+};
+
+namespace {
+
+    // ------------------------------------------------------------------------
+    // deflate
+    // ------------------------------------------------------------------------
+
+    class DeflateCompressContext : public CompressContext
+    {
+    protected:
+        mz_stream z;
+
+        bool deflate(int flush)
+        {
+            z.next_out = window.data();
+            z.avail_out = static_cast<unsigned int>(window.size());
+
+            const int status = mz_deflate(&z, flush);
+            if (status != MZ_OK && status != MZ_STREAM_END && status != MZ_BUF_ERROR)
+            {
+                MANGO_EXCEPTION("miniz: compression failed.");
+            }
+
+            output.write(window.data(), window.size() - z.avail_out);
+            return status == MZ_STREAM_END;
+        }
+
+    public:
+        DeflateCompressContext(Stream& output, int level)
+            : CompressContext(output)
+        {
+            std::memset(&z, 0, sizeof(z));
+            if (mz_deflateInit(&z, clamp(level, 0, 10)) != MZ_OK)
+            {
+                MANGO_EXCEPTION("miniz: compression failed.");
+            }
+        }
+
+        ~DeflateCompressContext()
+        {
+            mz_deflateEnd(&z);
+        }
+
+        void compress(const uint8* data, size_t size) override
+        {
+            while (size)
+            {
+                const size_t bytes = std::min(size, STREAM_CHUNK_SIZE);
+                z.next_in = data;
+                z.avail_in = static_cast<unsigned int>(bytes);
+
+                while (z.avail_in)
+                {
+                    deflate(MZ_NO_FLUSH);
+                }
+
+                data += bytes;
+                size -= bytes;
+            }
+        }
+
+        void finish() override
+        {
+            while (!deflate(MZ_FINISH))
+            {
+            }
+        }
+    };
+
+    class InflateDecompressContext : public DecompressContext
+    {
+    protected:
+        mz_stream z;
+        bool end;
+
+    public:
+        InflateDecompressContext(Stream& input)
+            : DecompressContext(input)
+            , end(false)
+        {
+            std::memset(&z, 0, sizeof(z));
+            if (mz_inflateInit(&z) != MZ_OK)
+            {
+                MANGO_EXCEPTION("miniz: decompression failed.");
+            }
+        }
+
+        ~InflateDecompressContext()
+        {
+            mz_inflateEnd(&z);
+        }
+
+        size_t decompress(uint8* dest, size_t size) override
+        {
+            size_t total = 0;
+
+            while (total < size && !end)
+            {
+                // the codec can have output pending when the input has been consumed
+                const bool input = refill();
+
+                z.next_in = window.data() + position;
+                z.avail_in = static_cast<unsigned int>(available - position);
+                z.next_out = dest + total;
+                z.avail_out = static_cast<unsigned int>(std::min(size - total, STREAM_CHUNK_SIZE));
+
+                const unsigned int avail_out = z.avail_out;
+                const int status = mz_inflate(&z, MZ_NO_FLUSH);
+
+                position = available - z.avail_in;
+                total += avail_out - z.avail_out;
+
+                if (status == MZ_STREAM_END)
+                {
+                    end = true;
+                    rewind();
+                }
+                else if (status != MZ_OK && status != MZ_BUF_ERROR)
+                {
+                    MANGO_EXCEPTION("miniz: corrupted input data.");
+                }
+                else if (!input && avail_out == z.avail_out)
+                {
+                    MANGO_EXCEPTION("miniz: unexpected end of input.");
+                }
+            }
+
+            return total;
+        }
+    };
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
+
+    // ------------------------------------------------------------------------
+    // zstd
+    // ------------------------------------------------------------------------
+
+    class ZstdCompressContext : public CompressContext
+    {
+    protected:
+        ZSTD_CStream* z;
+
+        void check(size_t status)
+        {
+            if (ZSTD_isError(status))
+            {
+                std::string s = "ZSTD: ";
+                s += ZSTD_getErrorName(status);
+                MANGO_EXCEPTION(s);
+            }
+        }
+
+    public:
+        ZstdCompressContext(Stream& output, int level)
+            : CompressContext(output)
+        {
+            z = ZSTD_createCStream();
+            check(ZSTD_initCStream(z, clamp(level * 2, 1, 20)));
+        }
+
+        ~ZstdCompressContext()
+        {
+            ZSTD_freeCStream(z);
+        }
+
+        void compress(const uint8* data, size_t size) override
+        {
+            ZSTD_inBuffer in = { data, size, 0 };
+
+            while (in.pos < in.size)
+            {
+                ZSTD_outBuffer out = { window.data(), window.size(), 0 };
+                check(ZSTD_compressStream(z, &out, &in));
+                output.write(window.data(), out.pos);
+            }
+        }
+
+        void finish() override
+        {
+            size_t remain;
+            do
+            {
+                ZSTD_outBuffer out = { window.data(), window.size(), 0 };
+                remain = ZSTD_endStream(z, &out);
+                check(remain);
+                output.write(window.data(), out.pos);
+            } while (remain);
+        }
+    };
+
+    class ZstdDecompressContext : public DecompressContext
+    {
+    protected:
+        ZSTD_DStream* z;
+        bool end;
+
+    public:
+        ZstdDecompressContext(Stream& input)
+            : DecompressContext(input)
+            , end(false)
+        {
+            z = ZSTD_createDStream();
+            ZSTD_initDStream(z);
+        }
+
+        ~ZstdDecompressContext()
+        {
+            ZSTD_freeDStream(z);
+        }
+
+        size_t decompress(uint8* dest, size_t size) override
+        {
+            ZSTD_outBuffer out = { dest, size, 0 };
+
+            while (out.pos < out.size && !end)
+            {
+                // the codec can have output pending when the input has been consumed
+                const bool input = refill();
+                const size_t previous = out.pos;
+
+                ZSTD_inBuffer in = { window.data(), available, position };
+                const size_t status = ZSTD_decompressStream(z, &out, &in);
+                position = in.pos;
+
+                if (ZSTD_isError(status))
+                {
+                    std::string s = "ZSTD: ";
+                    s += ZSTD_getErrorName(status);
+                    MANGO_EXCEPTION(s);
+                }
+
+                end = status == 0;
+                if (end)
+                {
+                    rewind();
+                }
+
+                if (!end && !input && out.pos == previous)
+                {
+                    MANGO_EXCEPTION("ZSTD: unexpected end of input.");
+                }
+            }
+
+            return out.pos;
+        }
+    };
+
+#endif // MANGO_ENABLE_LICENSE_BSD
+
+#ifdef MANGO_ENABLE_LICENSE_ZLIB
+
+    // ------------------------------------------------------------------------
+    // bzip2
+    // ------------------------------------------------------------------------
+
+    class Bzip2CompressContext : public CompressContext
+    {
+    protected:
+        bz_stream z;
+
+        int run(int action)
+        {
+            z.next_out = reinterpret_cast<char*>(window.data());
+            z.avail_out = static_cast<unsigned int>(window.size());
+
+            const int status = BZ2_bzCompress(&z, action);
+            if (status != BZ_RUN_OK && status != BZ_FINISH_OK && status != BZ_STREAM_END)
+            {
+                MANGO_EXCEPTION("bzip2: compression failed.");
+            }
+
+            output.write(window.data(), window.size() - z.avail_out);
+            return status;
+        }
+
+    public:
+        Bzip2CompressContext(Stream& output, int level)
+            : CompressContext(output)
+        {
+            std::memset(&z, 0, sizeof(z));
+            if (BZ2_bzCompressInit(&z, clamp(level, 1, 9), 0, 30) != BZ_OK)
+            {
+                MANGO_EXCEPTION("bzip2: compression failed.");
+            }
+        }
+
+        ~Bzip2CompressContext()
+        {
+            BZ2_bzCompressEnd(&z);
+        }
+
+        void compress(const uint8* data, size_t size) override
+        {
+            while (size)
+            {
+                const size_t bytes = std::min(size, STREAM_CHUNK_SIZE);
+                z.next_in = reinterpret_cast<char*>(const_cast<uint8*>(data));
+                z.avail_in = static_cast<unsigned int>(bytes);
+
+                while (z.avail_in)
+                {
+                    run(BZ_RUN);
+                }
+
+                data += bytes;
+                size -= bytes;
+            }
+        }
+
+        void finish() override
+        {
+            while (run(BZ_FINISH) != BZ_STREAM_END)
+            {
+            }
+        }
+    };
+
+    class Bzip2DecompressContext : public DecompressContext
+    {
+    protected:
+        bz_stream z;
+        bool end;
+
+    public:
+        Bzip2DecompressContext(Stream& input)
+            : DecompressContext(input)
+            , end(false)
+        {
+            std::memset(&z, 0, sizeof(z));
+            if (BZ2_bzDecompressInit(&z, 0, 0) != BZ_OK)
+            {
+                MANGO_EXCEPTION("bzip2: decompression failed.");
+            }
+        }
+
+        ~Bzip2DecompressContext()
+        {
+            BZ2_bzDecompressEnd(&z);
+        }
+
+        size_t decompress(uint8* dest, size_t size) override
+        {
+            size_t total = 0;
+
+            while (total < size && !end)
+            {
+                // the codec can have output pending when the input has been consumed
+                const bool input = refill();
+
+                z.next_in = reinterpret_cast<char*>(window.data() + position);
+                z.avail_in = static_cast<unsigned int>(available - position);
+                z.next_out = reinterpret_cast<char*>(dest + total);
+                z.avail_out = static_cast<unsigned int>(std::min(size - total, STREAM_CHUNK_SIZE));
+
+                const unsigned int avail_out = z.avail_out;
+                const int status = BZ2_bzDecompress(&z);
+
+                position = available - z.avail_in;
+                total += avail_out - z.avail_out;
+
+                if (status == BZ_STREAM_END)
+                {
+                    end = true;
+                    rewind();
+                }
+                else if (status != BZ_OK)
+                {
+                    MANGO_EXCEPTION("bzip2: decompression failed.");
+                }
+                else if (!input && avail_out == z.avail_out)
+                {
+                    MANGO_EXCEPTION("bzip2: unexpected end of input.");
+                }
+            }
+
+            return total;
+        }
+    };
+
+#endif // MANGO_ENABLE_LICENSE_ZLIB
+
+    // ------------------------------------------------------------------------
+    // blocks
+    // ------------------------------------------------------------------------
+
+    // Codecs without a stream format: the window is compressed as an independent
+    // block which is written with the uncompressed and compressed size in front.
+    // A block which doesn't get smaller is stored; the sizes are equal.
+
+    class BlockCompressContext : public CompressContext
+    {
+    protected:
+        Compressor compressor;
+        int level;
+        size_t size;
+        std::vector<uint8> temp;
+
+        void flush()
+        {
+            Memory source(window.data(), size);
+            Memory dest(temp.data() + 8, temp.size() - 8);
+
+            size_t bytes = 0;
+            try
+            {
+                bytes = compressor.compress(dest, source, level);
+            }
+            catch (Exception&)
+            {
+                // stored
+            }
+
+            if (!bytes || bytes >= size)
+            {
+                std::memcpy(dest.address, source.address, size);
+                bytes = size;
+            }
+
+            ustore32le(temp.data() + 0, uint32(size));
+            ustore32le(temp.data() + 4, uint32(bytes));
+            output.write(temp.data(), bytes + 8);
+            size = 0;
+        }
+
+    public:
+        BlockCompressContext(Stream& output, Codec codec, int level)
+            : CompressContext(output)
+            , compressor(getCompressor(codec))
+            , level(level)
+            , size(0)
+            , temp(8 + std::max(compressor.bound(STREAM_WINDOW_SIZE), STREAM_WINDOW_SIZE))
+        {
+        }
+
+        ~BlockCompressContext()
+        {
+        }
+
+        void compress(const uint8* data, size_t bytes) override
+        {
+            while (bytes)
+            {
+                const size_t n = std::min(bytes, window.size() - size);
+                std::memcpy(window.data() + size, data, n);
+                size += n;
+                data += n;
+                bytes -= n;
+
+                if (size == window.size())
+                {
+                    flush();
+                }
+            }
+        }
+
+        void finish() override
+        {
+            if (size)
+            {
+                flush();
+            }
+
+            uint8 end[4] = { 0, 0, 0, 0 };
+            output.write(end, 4);
+        }
+    };
+
+    class BlockDecompressContext : public DecompressContext
+    {
+    protected:
+        Compressor compressor;
+        std::vector<uint8> block;
+        std::vector<uint8> temp;
+        size_t offset; // in the decoded block
+        size_t size;   // of the decoded block
+        bool end;
+
+        void next()
+        {
+            uint8 header[8];
+
+            if (!read(header, 4))
+            {
+                MANGO_EXCEPTION("BlockDecompress: unexpected end of input.");
+            }
+
+            size = uload32le(header);
+            offset = 0;
+
+            if (!size)
+            {
+                end = true;
+                return;
+            }
+
+            if (!read(header + 4, 4))
+            {
+                MANGO_EXCEPTION("BlockDecompress: unexpected end of input.");
+            }
+
+            const size_t bytes = uload32le(header + 4);
+            if (size > block.size() || bytes > temp.size())
+            {
+                MANGO_EXCEPTION("BlockDecompress: incorrect block size.");
+            }
+
+            if (bytes == size)
+            {
+                // stored
+                if (!read(block.data(), size))
+                {
+                    MANGO_EXCEPTION("BlockDecompress: unexpected end of input.");
+                }
+            }
+            else
+            {
+                if (!read(temp.data(), bytes))
+                {
+                    MANGO_EXCEPTION("BlockDecompress: unexpected end of input.");
+                }
+
+                decodeBlock(compressor, Memory(block.data(), size), Memory(temp.data(), bytes));
+            }
+        }
+
+    public:
+        BlockDecompressContext(Stream& input, Codec codec)
+            : DecompressContext(input, 0)
+            , compressor(getCompressor(codec))
+            , block(STREAM_WINDOW_SIZE)
+            , temp(std::max(compressor.bound(STREAM_WINDOW_SIZE), STREAM_WINDOW_SIZE))
+            , offset(0)
+            , size(0)
+            , end(false)
+        {
+        }
+
+        ~BlockDecompressContext()
+        {
+        }
+
+        size_t decompress(uint8* dest, size_t bytes) override
+        {
+            size_t total = 0;
+
+            while (total < bytes && !end)
+            {
+                if (offset == size)
+                {
+                    next();
+                    continue;
+                }
+
+                const size_t n = std::min(bytes - total, size - offset);
+                std::memcpy(dest + total, block.data() + offset, n);
+                offset += n;
+                total += n;
+            }
+
+            return total;
+        }
+    };
+
+    CompressContext* createCompressContext(Stream& output, Codec codec, int level)
+    {
+        switch (codec)
+        {
+            case Codec::MINIZ:
+                return new DeflateCompressContext(output, level);
+#ifdef MANGO_ENABLE_LICENSE_BSD
+            case Codec::ZSTD:
+                return new ZstdCompressContext(output, level);
+#endif
+#ifdef MANGO_ENABLE_LICENSE_ZLIB
+            case Codec::BZIP2:
+                return new Bzip2CompressContext(output, level);
+#endif
+            default:
+                return new BlockCompressContext(output, codec, level);
+        }
+    }
+
+    DecompressContext* createDecompressContext(Stream& input, Codec codec)
+    {
+        switch (codec)
+        {
+            case Codec::MINIZ:
+                return new InflateDecompressContext(input);
+#ifdef MANGO_ENABLE_LICENSE_BSD
+            case Codec::ZSTD:
+                return new ZstdDecompressContext(input);
+#endif
+#ifdef MANGO_ENABLE_LICENSE_ZLIB
+            case Codec::BZIP2:
+                return new Bzip2DecompressContext(input);
+#endif
+            default:
+                return new BlockDecompressContext(input, codec);
+        }
+    }
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+// CompressStream
+// ----------------------------------------------------------------------------
+
+CompressStream::CompressStream(Stream& output, Codec codec, int level)
+    : m_context(nullptr)
+    , m_offset(0)
+{
+    m_context = createCompressContext(output, codec, level);
+}
+
+CompressStream::~CompressStream()
+{
+    if (m_context)
+    {
+        try
+        {
+            finish();
+        }
+        catch (...)
+        {
+            // the output is left without the end of the stream
+        }
+    }
+
+    delete m_context;
+}
+
+void CompressStream::finish()
+{
+    if (m_context)
+    {
+        std::unique_ptr<CompressContext> context(m_context);
+        m_context = nullptr;
+        context->finish();
+    }
+}
+
+uint64 CompressStream::size() const
+{
+    return m_offset;
+}
+
+uint64 CompressStream::offset() const
+{
+    return m_offset;
+}
+
+void CompressStream::seek(uint64 distance, SeekMode mode)
+{
+    MANGO_UNREFERENCED_PARAMETER(distance);
+    MANGO_UNREFERENCED_PARAMETER(mode);
+    MANGO_EXCEPTION("CompressStream: Cannot seek() in write-only stream.");
+}
+
+void CompressStream::read(void* dest, size_t size)
+{
+    MANGO_UNREFERENCED_PARAMETER(dest);
+    MANGO_UNREFERENCED_PARAMETER(size);
+    MANGO_EXCEPTION("CompressStream: Cannot read() in write-only stream.");
+}
+
+void CompressStream::write(const void* data, size_t size)
+{
+    if (!m_context)
+    {
+        MANGO_EXCEPTION("CompressStream: The stream is finished.");
+    }
+
+    m_context->compress(reinterpret_cast<const uint8*>(data), size);
+    m_offset += size;
+}
+
+// ----------------------------------------------------------------------------
+// DecompressStream
+// ----------------------------------------------------------------------------
+
+DecompressStream::DecompressStream(Stream& input, Codec codec)
+    : m_context(nullptr)
+    , m_input(input)
+    , m_start(input.offset())
+    , m_codec(codec)
+    , m_offset(0)
+    , m_end(false)
+{
+    m_context = createDecompressContext(input, codec);
+}
+
+DecompressStream::~DecompressStream()
+{
+    delete m_context;
+}
+
+bool DecompressStream::eof() const
+{
+    return m_end;
+}
+
+uint64 DecompressStream::size() const
+{
+    return m_offset;
+}
+
+uint64 DecompressStream::offset() const
+{
+    return m_offset;
+}
+
+void DecompressStream::seek(uint64 distance, SeekMode mode)
+{
+    uint64 target = 0;
+
+    switch (mode)
+    {
+        case BEGIN:
+            target = distance;
+            break;
+
+        case CURRENT:
+            target = m_offset + distance;
+            break;
+
+        case END:
+        {
+            // the size is known after decompressing to the end
+            uint8 temp[16 * 1024];
+            while (!m_end)
+            {
+                readUpTo(temp, sizeof(temp));
+            }
+            target = m_offset - distance;
+            break;
+        }
+
+        default:
+            MANGO_EXCEPTION("DecompressStream: Invalid seek mode.");
+    }
+
+    if (target < m_offset)
+    {
+        delete m_context;
+        m_context = nullptr;
+
+        m_input.seek(m_start, BEGIN);
+        m_context = createDecompressContext(m_input, m_codec);
+        m_offset = 0;
+        m_end = false;
+    }
+
+    // skip to the target
+    while (m_offset < target && !m_end)
+    {
+        uint8 temp[16 * 1024];
+        readUpTo(temp, size_t(std::min(target - m_offset, uint64(sizeof(temp)))));
+    }
+}
+
+size_t DecompressStream::readUpTo(void* dest, size_t size)
+{
+    if (m_end)
+        return 0;
+
+    const size_t bytes = m_context->decompress(reinterpret_cast<uint8*>(dest), size);
+    m_offset += bytes;
+    m_end = bytes < size;
+    return bytes;
+}
+
+void DecompressStream::read(void* dest, size_t size)
+{
+    if (readUpTo(dest, size) < size)
+    {
+        MANGO_EXCEPTION("DecompressStream: Reading past end of stream.");
+    }
+}
+
+void DecompressStream::write(const void* data, size_t size)
+{
+    MANGO_UNREFERENCED_PARAMETER(data);
+    MANGO_UNREFERENCED_PARAMETER(size);
+    MANGO_EXCEPTION("DecompressStream: Cannot write() in read-only stream.");
+}
+
 } // namespace mango
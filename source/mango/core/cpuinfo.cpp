@@ -3,8 +3,20 @@
     Copyright (C) 2012-2016 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <sstream>
 #include <mango/core/cpuinfo.hpp>
 
+#if defined(MANGO_PLATFORM_LINUX)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
 namespace
 {
 
@@ -161,6 +173,221 @@ namespace
         return 0; // unsupported platform
     }
 
+#endif
+
+    // ----------------------------------------------------------------------------
+    // getCPUTopologyInternal()
+    // ----------------------------------------------------------------------------
+
+    void setDefaultTopology(CPUTopology& topology)
+    {
+        int count = std::max(1, int(std::thread::hardware_concurrency()));
+
+        topology.processors.clear();
+        for (int i = 0; i < count; ++i)
+        {
+            topology.processors.push_back({ i, i, 0, 0, 0 });
+        }
+
+        topology.nodes = 1;
+        topology.caches = 1;
+        topology.nodeIds.assign(1, 0);
+    }
+
+#if defined(MANGO_PLATFORM_LINUX)
+
+    bool readText(const std::string& filename, std::string& text)
+    {
+        std::ifstream file(filename);
+        if (!file)
+            return false;
+        std::getline(file, text);
+        return true;
+    }
+
+    int readInteger(const std::string& filename, int defaultValue)
+    {
+        std::string text;
+        if (!readText(filename, text) || text.empty())
+            return defaultValue;
+        return std::atoi(text.c_str());
+    }
+
+    // parse sysfs cpu list format: "0-3,8,10-11"
+    std::vector<int> parseList(const std::string& text)
+    {
+        std::vector<int> list;
+        std::stringstream stream(text);
+        std::string range;
+
+        while (std::getline(stream, range, ','))
+        {
+            if (range.empty())
+                continue;
+
+            int first = 0;
+            int last = 0;
+            if (std::sscanf(range.c_str(), "%d-%d", &first, &last) != 2)
+            {
+                last = first = std::atoi(range.c_str());
+            }
+
+            for (int i = first; i <= last; ++i)
+            {
+                list.push_back(i);
+            }
+        }
+
+        return list;
+    }
+
+    void getCPUTopologyInternal(CPUTopology& topology)
+    {
+        const std::string cpupath = "/sys/devices/system/cpu/";
+        const std::string nodepath = "/sys/devices/system/node/";
+
+        std::string text;
+        if (!readText(cpupath + "online", text))
+        {
+            setDefaultTopology(topology);
+            return;
+        }
+
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        bool masked = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+
+        std::vector<int> nodeOfCPU;
+        std::vector<std::string> cacheKeys;
+
+        // NUMA nodes are optional; kernels without NUMA support have no node directory
+        std::string nodes;
+        if (readText(nodepath + "online", nodes))
+        {
+            for (int node : parseList(nodes))
+            {
+                std::string cpus;
+                readText(nodepath + "node" + std::to_string(node) + "/cpulist", cpus);
+
+                for (int cpu : parseList(cpus))
+                {
+                    if (cpu >= int(nodeOfCPU.size()))
+                        nodeOfCPU.resize(cpu + 1, 0);
+                    nodeOfCPU[cpu] = node;
+                }
+            }
+        }
+
+        topology.processors.clear();
+
+        for (int cpu : parseList(text))
+        {
+            if (masked && cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &mask))
+                continue;
+
+            const std::string path = cpupath + "cpu" + std::to_string(cpu) + "/";
+
+            CPUTopology::Processor processor;
+            processor.id = cpu;
+            processor.package = readInteger(path + "topology/physical_package_id", 0);
+            processor.core = readInteger(path + "topology/core_id", cpu);
+            processor.node = cpu < int(nodeOfCPU.size()) ? nodeOfCPU[cpu] : 0;
+
+            // last level cache is identified by the list of processors sharing it
+            std::string shared = std::to_string(processor.package);
+            int level = 0;
+
+            for (int index = 0; ; ++index)
+            {
+                const std::string cache = path + "cache/index" + std::to_string(index) + "/";
+                std::string type;
+                if (!readText(cache + "type", type))
+                    break;
+
+                int x = readInteger(cache + "level", 0);
+                if (type != "Instruction" && x >= level)
+                {
+                    level = x;
+                    readText(cache + "shared_cpu_list", shared);
+                }
+            }
+
+            auto i = std::find(cacheKeys.begin(), cacheKeys.end(), shared);
+            processor.cache = int(i - cacheKeys.begin());
+            if (i == cacheKeys.end())
+                cacheKeys.push_back(shared);
+
+            // make the core unique across packages
+            processor.core += processor.package << 16;
+
+            topology.processors.push_back(processor);
+        }
+
+        if (topology.processors.empty())
+        {
+            setDefaultTopology(topology);
+            return;
+        }
+
+        // compact the node numbering to 0 .. nodes - 1
+        std::vector<int> nodeKeys;
+        for (auto& processor : topology.processors)
+        {
+            if (std::find(nodeKeys.begin(), nodeKeys.end(), processor.node) == nodeKeys.end())
+                nodeKeys.push_back(processor.node);
+        }
+
+        std::sort(nodeKeys.begin(), nodeKeys.end());
+
+        for (auto& processor : topology.processors)
+        {
+            processor.node = int(std::find(nodeKeys.begin(), nodeKeys.end(), processor.node) - nodeKeys.begin());
+        }
+
+        std::stable_sort(topology.processors.begin(), topology.processors.end(),
+            [] (const CPUTopology::Processor& a, const CPUTopology::Processor& b)
+        {
+            if (a.node != b.node) return a.node < b.node;
+            if (a.cache != b.cache) return a.cache < b.cache;
+            if (a.core != b.core) return a.core < b.core;
+            return a.id < b.id;
+        });
+
+        topology.nodes = int(nodeKeys.size());
+        topology.nodeIds = nodeKeys;
+        topology.caches = int(cacheKeys.size());
+    }
+
+    int getMemoryNodeInternal(const void* address)
+    {
+#if defined(SYS_get_mempolicy)
+        const unsigned long MPOL_F_NODE = 1;
+        const unsigned long MPOL_F_ADDR = 2;
+
+        int node = -1;
+        if (syscall(SYS_get_mempolicy, &node, nullptr, 0, address, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+            return -1;
+
+        return node;
+#else
+        MANGO_UNREFERENCED_PARAMETER(address);
+        return -1;
+#endif
+    }
+
+#else
+
+    void getCPUTopologyInternal(CPUTopology& topology)
+    {
+        setDefaultTopology(topology);
+    }
+
+    int getMemoryNodeInternal(const void* address)
+    {
+        MANGO_UNREFERENCED_PARAMETER(address);
+        return -1;
+    }
+
 #endif
 
 } // namespace
@@ -174,4 +401,26 @@ namespace mango
         return flags;
     }
 
+    const CPUTopology& getCPUTopology()
+    {
+        static CPUTopology topology = []
+        {
+            CPUTopology topology;
+            getCPUTopologyInternal(topology);
+            return topology;
+        } ();
+        return topology;
+    }
+
+    int getMemoryNode(const void* address)
+    {
+        const CPUTopology& topology = getCPUTopology();
+        if (topology.nodes < 2)
+            return 0;
+
+        int node = getMemoryNodeInternal(address);
+        auto i = std::find(topology.nodeIds.begin(), topology.nodeIds.end(), node);
+        return i != topology.nodeIds.end() ? int(i - topology.nodeIds.begin()) : -1;
+    }
+
 } // namespace mango
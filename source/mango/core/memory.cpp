@@ -6,6 +6,10 @@
 #include <mango/core/bits.hpp>
 #include <mango/core/memory.hpp>
 
+#if defined(MANGO_PLATFORM_LINUX)
+    #include <sys/mman.h>
+#endif
+
 namespace mango {
 
     // -----------------------------------------------------------------------
@@ -123,4 +127,137 @@ namespace mango {
 
 #endif
 
+    // -----------------------------------------------------------------------
+    // large buffer malloc/free
+    // -----------------------------------------------------------------------
+
+    void* large_malloc(size_t size)
+    {
+        const size_t huge_page_size = 2 * 1024 * 1024;
+        if (size < huge_page_size)
+        {
+            return aligned_malloc(size);
+        }
+
+        // round up so that the last huge page isn't shared with other allocations
+        size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+        void* address = aligned_malloc(size, huge_page_size);
+
+#if defined(MANGO_PLATFORM_LINUX) && defined(MADV_HUGEPAGE)
+        if (address)
+        {
+            // only a hint; ignored when transparent huge pages are disabled
+            madvise(address, size, MADV_HUGEPAGE);
+        }
+#endif
+
+        return address;
+    }
+
+    void large_free(void* address)
+    {
+        aligned_free(address);
+    }
+
+    // -----------------------------------------------------------------------
+    // Arena
+    // -----------------------------------------------------------------------
+
+    Arena::Arena(size_t block_size)
+        : m_block_size(block_size)
+        , m_current(0)
+        , m_used(0)
+    {
+    }
+
+    Arena::~Arena()
+    {
+        for (Block& block : m_blocks)
+        {
+            large_free(block.address);
+        }
+    }
+
+    uint8* Arena::allocate(size_t size, size_t alignment)
+    {
+        assert(u32_is_power_of_two(uint32(alignment)) && alignment <= MANGO_DEFAULT_ALIGNMENT);
+
+        if (!m_blocks.empty())
+        {
+            Block& block = m_blocks[m_current];
+            const size_t offset = (m_used + alignment - 1) & ~(alignment - 1);
+            if (offset + size <= block.size)
+            {
+                m_used = offset + size;
+                return block.address + offset;
+            }
+        }
+
+        // continue in the next block when it is large enough, otherwise insert a new one
+        const size_t next = m_blocks.empty() ? 0 : m_current + 1;
+        if (next == m_blocks.size() || m_blocks[next].size < size)
+        {
+            Block block;
+            block.size = std::max(m_block_size, size);
+            block.address = reinterpret_cast<uint8*>(large_malloc(block.size));
+            if (!block.address)
+            {
+                throw std::bad_alloc();
+            }
+
+            m_blocks.insert(m_blocks.begin() + next, block);
+        }
+
+        m_current = next;
+        m_used = size;
+        return m_blocks[next].address;
+    }
+
+    Arena::Marker Arena::mark() const
+    {
+        Marker marker;
+        marker.block = m_current;
+        marker.used = m_used;
+        return marker;
+    }
+
+    void Arena::rewind(const Marker& marker)
+    {
+        m_current = marker.block;
+        m_used = marker.used;
+
+        if (!m_current && !m_used)
+        {
+            reset();
+        }
+    }
+
+    void Arena::reset()
+    {
+        const size_t retain = 64 * 1024 * 1024;
+
+        size_t capacity = 0;
+        for (const Block& block : m_blocks)
+        {
+            capacity += block.size;
+        }
+
+        // drop the blocks which were needed by unusually large images
+        while (capacity > retain)
+        {
+            capacity -= m_blocks.back().size;
+            large_free(m_blocks.back().address);
+            m_blocks.pop_back();
+        }
+
+        m_current = 0;
+        m_used = 0;
+    }
+
+    Arena& getThreadArena()
+    {
+        static thread_local Arena arena;
+        return arena;
+    }
+
 } // namespace mango
@@ -0,0 +1,313 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <mango/core/object_pool.hpp>
+#include <mango/core/memory.hpp>
+#include <mango/core/bits.hpp>
+
+namespace
+{
+
+    using namespace mango;
+
+    // The pools which are alive. The thread caches check this before they give
+    // their slots back on thread exit; the pool might have been destroyed.
+    struct PoolRegistry
+    {
+        std::mutex mutex;
+        std::vector<uint64> pools;
+    };
+
+    PoolRegistry& getRegistry()
+    {
+        // never destroyed; threads can exit after the static destructors are run
+        static PoolRegistry* registry = new PoolRegistry();
+        return *registry;
+    }
+
+    std::atomic<uint64> g_pool_id { 1 };
+
+} // namespace
+
+namespace mango
+{
+
+    // ----------------------------------------------------------------------------
+    // ObjectPoolBase
+    // ----------------------------------------------------------------------------
+
+    struct ObjectPoolBase::Slot
+    {
+        Slot* next;
+        std::atomic<uint32> next_batch; // index + 1 of the next batch in the pool
+        uint32 count; // number of slots in the batch (first slot only)
+    };
+
+    struct ObjectPoolBase::Cache
+    {
+        uint64 id;
+        ObjectPoolBase* pool;
+        Slot* head;
+        uint32 count;
+
+        void flush()
+        {
+            if (id && head)
+            {
+                PoolRegistry& registry = getRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+
+                if (std::find(registry.pools.begin(), registry.pools.end(), id) != registry.pools.end())
+                {
+                    pool->pushBatch(head, count);
+                }
+            }
+
+            id = 0;
+            pool = nullptr;
+            head = nullptr;
+            count = 0;
+        }
+    };
+
+    struct ObjectPoolBase::ThreadCache
+    {
+        enum { SIZE = 4 };
+
+        Cache entries[SIZE] {};
+        int victim { 0 };
+
+        ~ThreadCache()
+        {
+            for (Cache& cache : entries)
+            {
+                cache.flush();
+            }
+        }
+    };
+
+    ObjectPoolBase::ObjectPoolBase(size_t size, size_t alignment, uint32 block_size)
+        : m_id(g_pool_id++)
+        , m_slot_size((std::max(size, sizeof(Slot)) + std::max(alignment, alignof(Slot)) - 1) & ~(std::max(alignment, alignof(Slot)) - 1))
+        , m_block_size((std::max(block_size, uint32(BATCH_SIZE)) + BATCH_SIZE - 1) & ~uint32(BATCH_SIZE - 1))
+        , m_head(0)
+        , m_segment_count(0)
+    {
+        for (auto& segment : m_segments)
+        {
+            segment = nullptr;
+        }
+
+        PoolRegistry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.pools.push_back(m_id);
+    }
+
+    ObjectPoolBase::~ObjectPoolBase()
+    {
+        {
+            PoolRegistry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.pools.erase(std::remove(registry.pools.begin(), registry.pools.end(), m_id), registry.pools.end());
+        }
+
+        // slots cached by other threads are abandoned; their entries won't match a pool id again
+        for (auto& segment : m_segments)
+        {
+            aligned_free(segment.load());
+        }
+    }
+
+    ObjectPoolBase::Slot* ObjectPoolBase::getSlot(uint32 index) const
+    {
+        // segment s holds (block << s) slots starting from index block * (2^s - 1)
+        const int s = u32_log2(index / m_block_size + 1);
+        const uint32 offset = index - m_block_size * ((1u << s) - 1);
+        uint8* segment = m_segments[s].load(std::memory_order_acquire);
+        return reinterpret_cast<Slot*>(segment + offset * m_slot_size);
+    }
+
+    uint32 ObjectPoolBase::getIndex(const Slot* slot) const
+    {
+        const uint8* address = reinterpret_cast<const uint8*>(slot);
+        for (int s = 0; s < MAX_SEGMENTS; ++s)
+        {
+            // the segments are allocated in order
+            const uint8* segment = m_segments[s].load(std::memory_order_acquire);
+            if (!segment)
+                break;
+
+            const size_t size = size_t(m_block_size << s) * m_slot_size;
+            if (address >= segment && address < segment + size)
+            {
+                return m_block_size * ((1u << s) - 1) + uint32((address - segment) / m_slot_size);
+            }
+        }
+
+        return 0; // not reached with pointers from this pool
+    }
+
+    void ObjectPoolBase::grow()
+    {
+        const int s = m_segment_count.load(std::memory_order_acquire);
+        if (s >= MAX_SEGMENTS || (uint64(m_block_size) << (s + 1)) > 0xffffffff)
+            throw std::bad_alloc();
+
+        if (m_segments[s].load(std::memory_order_acquire))
+        {
+            // another thread is growing the pool
+            std::this_thread::yield();
+            return;
+        }
+
+        const uint32 slots = m_block_size << s;
+        uint8* memory = reinterpret_cast<uint8*>(aligned_malloc(slots * m_slot_size, 64));
+        if (!memory)
+            throw std::bad_alloc();
+
+        uint8* expected = nullptr;
+        if (!m_segments[s].compare_exchange_strong(expected, memory, std::memory_order_acq_rel))
+        {
+            // another thread is growing the pool
+            aligned_free(memory);
+            return;
+        }
+
+        for (uint32 i = 0; i < slots; i += BATCH_SIZE)
+        {
+            Slot* head = nullptr;
+            for (int j = BATCH_SIZE - 1; j >= 0; --j)
+            {
+                Slot* slot = reinterpret_cast<Slot*>(memory + (i + j) * m_slot_size);
+                slot->next = head;
+                head = slot;
+            }
+
+            new (&head->next_batch) std::atomic<uint32>(0);
+            pushBatch(head, BATCH_SIZE);
+        }
+
+        m_segment_count.store(s + 1, std::memory_order_release);
+    }
+
+    void ObjectPoolBase::pushBatch(Slot* head, uint32 count)
+    {
+        // the 32 bit tag is incremented on every change so a stale head never compares equal (ABA)
+        const uint64 index = getIndex(head) + 1;
+        new (&head->next_batch) std::atomic<uint32>(0);
+        head->count = count;
+
+        uint64 current = m_head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            head->next_batch.store(uint32(current), std::memory_order_relaxed);
+            const uint64 value = (((current >> 32) + 1) << 32) | index;
+            if (m_head.compare_exchange_weak(current, value, std::memory_order_release, std::memory_order_relaxed))
+                break;
+        }
+    }
+
+    ObjectPoolBase::Slot* ObjectPoolBase::popBatch(uint32& count)
+    {
+        uint64 current = m_head.load(std::memory_order_acquire);
+        for (;;)
+        {
+            const uint32 index = uint32(current);
+            if (!index)
+            {
+                grow();
+                current = m_head.load(std::memory_order_acquire);
+                continue;
+            }
+
+            // the slot memory is never released so reading a stale head is safe; the tag catches it
+            Slot* head = getSlot(index - 1);
+            const uint32 next = head->next_batch.load(std::memory_order_relaxed);
+            const uint64 value = (((current >> 32) + 1) << 32) | next;
+
+            if (m_head.compare_exchange_weak(current, value, std::memory_order_acquire, std::memory_order_acquire))
+            {
+                count = head->count;
+                return head;
+            }
+        }
+    }
+
+    ObjectPoolBase::Cache& ObjectPoolBase::getCache()
+    {
+        static thread_local ThreadCache local;
+
+        for (Cache& cache : local.entries)
+        {
+            if (cache.id == m_id)
+                return cache;
+        }
+
+        // use a free entry or evict one; the evicted slots go back to their pool
+        Cache* cache = nullptr;
+        for (Cache& entry : local.entries)
+        {
+            if (!entry.id)
+            {
+                cache = &entry;
+                break;
+            }
+        }
+
+        if (!cache)
+        {
+            cache = &local.entries[local.victim];
+            local.victim = (local.victim + 1) % ThreadCache::SIZE;
+            cache->flush();
+        }
+
+        cache->id = m_id;
+        cache->pool = this;
+        return *cache;
+    }
+
+    void* ObjectPoolBase::allocate()
+    {
+        Cache& cache = getCache();
+        if (!cache.head)
+        {
+            cache.head = popBatch(cache.count);
+        }
+
+        Slot* slot = cache.head;
+        cache.head = slot->next;
+        --cache.count;
+        return slot;
+    }
+
+    void ObjectPoolBase::free(void* pointer)
+    {
+        Cache& cache = getCache();
+
+        Slot* slot = reinterpret_cast<Slot*>(pointer);
+        slot->next = cache.head;
+        cache.head = slot;
+
+        if (++cache.count >= BATCH_SIZE * 2)
+        {
+            // keep one batch and give the other back to the pool
+            Slot* tail = cache.head;
+            for (int i = 1; i < BATCH_SIZE; ++i)
+            {
+                tail = tail->next;
+            }
+
+            Slot* head = cache.head;
+            cache.head = tail->next;
+            cache.count -= BATCH_SIZE;
+            tail->next = nullptr;
+            pushBatch(head, BATCH_SIZE);
+        }
+    }
+
+} // namespace mango
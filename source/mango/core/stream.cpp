@@ -0,0 +1,142 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <algorithm>
+#include <mango/core/stream.hpp>
+
+namespace mango
+{
+
+    // --------------------------------------------------------------
+    // BufferedStream
+    // --------------------------------------------------------------
+
+    BufferedStream::BufferedStream(Stream& stream, size_t capacity)
+        : m_stream(stream)
+        , m_buffer(nullptr)
+        , m_capacity(std::max(capacity, size_t(64)))
+        , m_pointer(nullptr)
+        , m_read_left(0)
+        , m_write_left(0)
+        , m_dirty(false)
+    {
+        m_buffer = new uint8[m_capacity];
+        m_pointer = m_buffer;
+    }
+
+    BufferedStream::~BufferedStream()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+            // the pending writes are lost; flush() reports the error to the caller
+        }
+
+        delete[] m_buffer;
+    }
+
+    void BufferedStream::flush()
+    {
+        if (m_dirty)
+        {
+            m_stream.write(m_buffer, size_t(m_pointer - m_buffer));
+        }
+        else if (m_read_left)
+        {
+            // give the read-ahead back to the stream
+            m_stream.seek(m_stream.offset() - m_read_left, BEGIN);
+        }
+
+        m_pointer = m_buffer;
+        m_read_left = 0;
+        m_write_left = 0;
+        m_dirty = false;
+    }
+
+    uint64 BufferedStream::size() const
+    {
+        const uint64 pending = m_dirty ? uint64(m_pointer - m_buffer) : 0;
+        return std::max(m_stream.size(), m_stream.offset() + pending);
+    }
+
+    uint64 BufferedStream::offset() const
+    {
+        if (m_dirty)
+            return m_stream.offset() + uint64(m_pointer - m_buffer);
+        return m_stream.offset() - m_read_left;
+    }
+
+    void BufferedStream::seek(uint64 distance, SeekMode mode)
+    {
+        if (mode == CURRENT)
+        {
+            // relative to the logical offset, not the stream's
+            distance += offset();
+            mode = BEGIN;
+        }
+
+        flush();
+        m_stream.seek(distance, mode);
+    }
+
+    void BufferedStream::readBuffered(void* dest, size_t size)
+    {
+        if (m_dirty)
+        {
+            flush();
+        }
+
+        uint8* d = reinterpret_cast<uint8*>(dest);
+
+        // drain the window
+        std::memcpy(d, m_pointer, m_read_left);
+        d += m_read_left;
+        size -= m_read_left;
+        m_pointer = m_buffer;
+        m_read_left = 0;
+
+        if (size >= m_capacity / 2)
+        {
+            // large reads go straight to the destination
+            m_stream.read(d, size);
+            return;
+        }
+
+        // refill, but never read past the end; the stream handles that error
+        const uint64 available = m_stream.size() - std::min(m_stream.size(), m_stream.offset());
+        const size_t count = size_t(std::min(uint64(m_capacity), available));
+
+        if (count < size)
+        {
+            m_stream.read(d, size);
+            return;
+        }
+
+        m_stream.read(m_buffer, count);
+        std::memcpy(d, m_buffer, size);
+        m_pointer = m_buffer + size;
+        m_read_left = count - size;
+    }
+
+    void BufferedStream::writeBuffered(const void* data, size_t size)
+    {
+        // drop the read-ahead or write out the pending data
+        flush();
+
+        if (size >= m_capacity / 2)
+        {
+            m_stream.write(data, size);
+            return;
+        }
+
+        std::memcpy(m_buffer, data, size);
+        m_pointer = m_buffer + size;
+        m_write_left = m_capacity - size;
+        m_dirty = true;
+    }
+
+} // namespace mango
@@ -3,12 +3,15 @@
     Copyright (C) 2012-2016 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <chrono>
+#include <sstream>
+#include <iomanip>
 #include <mango/core/thread.hpp>
+#include <mango/core/cpuinfo.hpp>
+#include <mango/core/memory.hpp>
 #include "../../external/concurrentqueue/concurrentqueue.h"
 
 using std::chrono::high_resolution_clock;
-using std::chrono::duration_cast;
-using std::chrono::milliseconds;
+using std::chrono::microseconds;
 
 // ------------------------------------------------------------
 // thread affinity
@@ -19,211 +22,1372 @@ using std::chrono::milliseconds;
 #if defined(MANGO_PLATFORM_LINUX) || defined(MANGO_PLATFORM_BSD)
 
 #include <pthread.h>
+#include <sched.h>
 
-    template <typename H>
-    static void set_thread_affinity(H handle, int processor)
+    static void set_current_thread_affinity(const std::vector<int>& processors)
     {
         cpu_set_t cpuset;
 
         CPU_ZERO(&cpuset);
-        CPU_SET(processor, &cpuset);
-        pthread_setaffinity_np(handle, sizeof(cpu_set_t), &cpuset);
+        for (int processor : processors)
+        {
+            CPU_SET(processor, &cpuset);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
     }
 
-    static void set_current_thread_affinity(int processor)
+#elif defined(MANGO_PLATFORM_WINDOWS)
+
+    static void set_current_thread_affinity(const std::vector<int>& processors)
     {
-        set_thread_affinity(pthread_self(), processor);
+        DWORD_PTR mask = 0;
+        for (int processor : processors)
+        {
+            mask |= DWORD_PTR(1) << processor;
+        }
+        SetThreadAffinityMask(GetCurrentThread(), mask);
     }
 
-#elif defined(MANGO_PLATFORM_WINDOWS)
+#else
+
+    static void set_current_thread_affinity(const std::vector<int>& processors)
+    {
+        MANGO_UNREFERENCED_PARAMETER(processors);
+    }
+
+#endif
+
+namespace mango
+{
 
-    template <typename H>
-    static void set_thread_affinity(H handle, int processor)
+    // ------------------------------------------------------------
+    // spin-then-park helpers
+    // ------------------------------------------------------------
+
+    static inline void cpu_pause()
     {
-        SetThreadAffinityMask(handle, DWORD_PTR(1) << processor);
+#if defined(MANGO_ENABLE_SSE2)
+        _mm_pause();
+#elif defined(MANGO_CPU_ARM) && defined(__GNUC__)
+        __asm__ __volatile__("yield");
+#else
+        std::this_thread::yield();
+#endif
     }
 
-    static void set_current_thread_affinity(int processor)
+    template <typename Predicate>
+    static bool spin_wait(int budget, Predicate predicate)
     {
-        set_thread_affinity(GetCurrentThread(), processor);
+        if (budget <= 0)
+            return predicate();
+
+        const auto deadline = high_resolution_clock::now() + microseconds(budget);
+
+        for (;;)
+        {
+            // don't hammer the clock; check the predicate a few times in between
+            for (int i = 0; i < 64; ++i)
+            {
+                if (predicate())
+                    return true;
+                cpu_pause();
+            }
+
+            if (high_resolution_clock::now() >= deadline)
+                return false;
+        }
     }
 
-#else
+    // Returns when the predicate is satisfied. The thread spins for the budget
+    // first as the condition usually changes soon; after that it parks on the
+    // event and re-checks the predicate every time the event is signaled.
+    template <typename Predicate>
+    static void park(EventCount& event, int budget, Predicate predicate)
+    {
+        if (spin_wait(budget, predicate))
+            return;
+
+        for (;;)
+        {
+            uint32 key = event.prepare();
+            if (predicate())
+            {
+                event.cancel();
+                return;
+            }
+
+            event.wait(key);
+
+            if (predicate())
+                return;
+        }
+    }
+
+    // ------------------------------------------------------------
+    // EventCount
+    // ------------------------------------------------------------
+
+    uint32 EventCount::prepare()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_acquire);
+    }
+
+    void EventCount::cancel()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void EventCount::wait(uint32 key)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_epoch.load(std::memory_order_relaxed) == key)
+        {
+            m_condition.wait(lock);
+        }
+
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void EventCount::notify(bool all)
+    {
+        // pairs with the fence in prepare(): either the waiter sees the new
+        // state in its re-check or we see the waiter here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_waiters.load(std::memory_order_relaxed))
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (all)
+            m_condition.notify_all();
+        else
+            m_condition.notify_one();
+    }
+
+    // ------------------------------------------------------------
+    // TaskDeque
+    // ------------------------------------------------------------
+
+    // Chase-Lev work-stealing deque. The owning worker pushes and pops
+    // at the bottom (LIFO) and other threads steal from the top (FIFO).
+    // Retired arrays are kept alive until the deque is destroyed because
+    // a concurrent thief might still be reading from them.
+
+    template <typename T>
+    class TaskDeque : private NonCopyable
+    {
+    protected:
+        struct Array
+        {
+            int64 capacity;
+            int64 mask;
+            std::atomic<T*>* data;
+
+            Array(int64 capacity)
+                : capacity(capacity)
+                , mask(capacity - 1)
+                , data(new std::atomic<T*>[capacity])
+            {
+            }
+
+            ~Array()
+            {
+                delete[] data;
+            }
+
+            T* get(int64 index) const
+            {
+                return data[index & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(int64 index, T* value)
+            {
+                data[index & mask].store(value, std::memory_order_relaxed);
+            }
+
+            Array* grow(int64 bottom, int64 top) const
+            {
+                Array* array = new Array(capacity * 2);
+                for (int64 i = top; i < bottom; ++i)
+                {
+                    array->put(i, get(i));
+                }
+                return array;
+            }
+        };
+
+        alignas(64) std::atomic<int64> m_top { 0 };
+        alignas(64) std::atomic<int64> m_bottom { 0 };
+        alignas(64) std::atomic<Array*> m_array;
+        std::vector<Array*> m_garbage;
+
+    public:
+        TaskDeque(int64 capacity = 256)
+        {
+            m_array.store(new Array(capacity), std::memory_order_relaxed);
+        }
+
+        ~TaskDeque()
+        {
+            for (Array* array : m_garbage)
+            {
+                delete array;
+            }
+
+            delete m_array.load(std::memory_order_relaxed);
+        }
+
+        bool empty() const
+        {
+            int64 bottom = m_bottom.load(std::memory_order_relaxed);
+            int64 top = m_top.load(std::memory_order_relaxed);
+            return bottom <= top;
+        }
+
+        // owner only
+        void push(T* value)
+        {
+            int64 bottom = m_bottom.load(std::memory_order_relaxed);
+            int64 top = m_top.load(std::memory_order_acquire);
+            Array* array = m_array.load(std::memory_order_relaxed);
+
+            if (bottom - top > array->capacity - 1)
+            {
+                m_garbage.push_back(array);
+                array = array->grow(bottom, top);
+                m_array.store(array, std::memory_order_release);
+            }
+
+            array->put(bottom, value);
+            m_bottom.store(bottom + 1, std::memory_order_release);
+        }
+
+        // owner only
+        T* pop()
+        {
+            int64 bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+            Array* array = m_array.load(std::memory_order_relaxed);
+            m_bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 top = m_top.load(std::memory_order_relaxed);
+
+            T* value = nullptr;
+
+            if (top <= bottom)
+            {
+                value = array->get(bottom);
+                if (top == bottom)
+                {
+                    // last element; race against thieves
+                    if (!m_top.compare_exchange_strong(top, top + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        value = nullptr;
+                    }
+                    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+
+            return value;
+        }
+
+        // any thread
+        T* steal()
+        {
+            int64 top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 bottom = m_bottom.load(std::memory_order_acquire);
+
+            T* value = nullptr;
+
+            if (top < bottom)
+            {
+                Array* array = m_array.load(std::memory_order_acquire);
+                value = array->get(top);
+                if (!m_top.compare_exchange_strong(top, top + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    // lost the race to another thief or the owner
+                    value = nullptr;
+                }
+            }
+
+            return value;
+        }
+    };
+
+    // ------------------------------------------------------------
+    // TaskQueue
+    // ------------------------------------------------------------
+
+    // Shared FIFO for tasks submitted from outside of the pool and for
+    // ordered tasks (SerialQueue, barriers) which must start in order.
+
+    struct TaskQueue
+    {
+        using Task = ThreadPool::Task;
+        moodycamel::ConcurrentQueue<Task*> tasks;
+    };
+
+    // ------------------------------------------------------------
+    // profiling
+    // ------------------------------------------------------------
 
-    template <typename H>
-    static void set_thread_affinity(H handle, int processor)
+    static inline uint64 profile_time()
     {
-        MANGO_UNREFERENCED_PARAMETER(handle);
-        MANGO_UNREFERENCED_PARAMETER(processor);
+        auto time = std::chrono::steady_clock::now().time_since_epoch();
+        return uint64(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
     }
 
-    static void set_current_thread_affinity(int processor)
+    static inline void profile_add(std::atomic<uint64>& counter, uint64 value)
     {
-        MANGO_UNREFERENCED_PARAMETER(processor);
+        counter.fetch_add(value, std::memory_order_relaxed);
     }
 
+    struct QueueProfile
+    {
+        std::string name;
+        std::atomic<uint64> tasks;
+        std::atomic<uint64> run_time;
+        std::atomic<uint64> latency_time;
+        std::atomic<uint64> latency_max;
+        std::atomic<uint64> latency_histogram[ThreadPool::LATENCY_BUCKETS];
+
+        QueueProfile(const std::string& name)
+            : name(name)
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            tasks = 0;
+            run_time = 0;
+            latency_time = 0;
+            latency_max = 0;
+            for (auto& bucket : latency_histogram)
+            {
+                bucket = 0;
+            }
+        }
+
+        void record(uint64 latency, uint64 time)
+        {
+            profile_add(tasks, 1);
+            profile_add(run_time, time);
+            profile_add(latency_time, latency);
+
+            uint64 previous = latency_max.load(std::memory_order_relaxed);
+            while (previous < latency && !latency_max.compare_exchange_weak(previous, latency, std::memory_order_relaxed))
+            {
+            }
+
+            int bucket = 0;
+            for (uint64 us = latency / 1000; us && bucket < ThreadPool::LATENCY_BUCKETS - 1; us >>= 1)
+            {
+                ++bucket;
+            }
+
+            profile_add(latency_histogram[bucket], 1);
+        }
+    };
+
+    struct TraceEvent
+    {
+        const QueueProfile* queue;
+        uint64 start;
+        uint64 duration;
+    };
+
+    struct WorkerProfile
+    {
+        std::atomic<uint64> tasks { 0 };
+        std::atomic<uint64> steals { 0 };
+        std::atomic<uint64> run_time { 0 };
+        std::atomic<uint64> idle_time { 0 };
+        std::atomic<uint64> sleep_time { 0 };
+
+        mutable std::mutex trace_mutex;
+        std::vector<TraceEvent> trace;
+
+        void reset()
+        {
+            tasks = 0;
+            steals = 0;
+            run_time = 0;
+            idle_time = 0;
+            sleep_time = 0;
+
+            std::lock_guard<std::mutex> lock(trace_mutex);
+            trace.clear();
+        }
+    };
+
+    struct PoolProfile
+    {
+        uint64 epoch { profile_time() };
+        mutable std::mutex mutex;
+        std::vector<std::unique_ptr<QueueProfile>> queues;
+
+        // threads outside of the pool which help while waiting
+        WorkerProfile external;
+
+        // the profiles live as long as the pool; the queues keep raw pointers
+        QueueProfile* getQueue(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (auto& queue : queues)
+            {
+                if (queue->name == name)
+                    return queue.get();
+            }
+
+            queues.emplace_back(new QueueProfile(name));
+            return queues.back().get();
+        }
+    };
+
+    // ------------------------------------------------------------
+    // worker limit
+    // ------------------------------------------------------------
+
+    // Global quota of workers running tasks; shared by all pools.
+    static std::atomic<int> g_worker_limit { 0 };
+    static std::atomic<int> g_worker_active { 0 };
+
+    static EventCount& getWorkerEvent()
+    {
+        // never destroyed; the workers of static pools exit after the static destructors
+        static EventCount* event = new EventCount();
+        return *event;
+    }
+
+    enum WorkerSlot
+    {
+        SLOT_NONE,      // limit reached
+        SLOT_UNLIMITED, // no limit; nothing to release
+        SLOT_COUNTED
+    };
+
+    static WorkerSlot acquire_worker()
+    {
+        const int limit = g_worker_limit.load(std::memory_order_relaxed);
+        if (!limit)
+            return SLOT_UNLIMITED;
+
+        int active = g_worker_active.load(std::memory_order_relaxed);
+        while (active < limit)
+        {
+            if (g_worker_active.compare_exchange_weak(active, active + 1, std::memory_order_acquire))
+                return SLOT_COUNTED;
+        }
+
+        return SLOT_NONE;
+    }
+
+    static void release_worker(WorkerSlot slot)
+    {
+        if (slot == SLOT_COUNTED)
+        {
+            g_worker_active.fetch_sub(1, std::memory_order_release);
+            getWorkerEvent().notify();
+        }
+    }
+
+    // ------------------------------------------------------------
+    // WorkerQueue
+    // ------------------------------------------------------------
+
+    struct WorkerQueue
+    {
+        using Task = ThreadPool::Task;
+
+        ThreadPool* pool { nullptr };
+        int index { 0 };
+        int node { 0 };
+        uint32 seed { 0 };
+        WorkerSlot slot { SLOT_NONE }; // held while running tasks
+        TaskDeque<Task> tasks[3];
+        WorkerProfile profile;
+
+        uint32 random()
+        {
+            // xorshift32; only used for picking a victim
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed;
+        }
+    };
+
+    static thread_local WorkerQueue* g_current_worker = nullptr;
+
+    // ------------------------------------------------------------
+    // BlockAllocator
+    // ------------------------------------------------------------
+
+    // Fixed size block allocator for tasks. Blocks are cached per thread and
+    // exchanged with a shared depot in batches, so the lock is taken once per
+    // BATCH_SIZE allocations at most. Tasks are usually allocated by one thread
+    // and released by another; the batches move the blocks back to the producer.
+    // The slabs are never returned to the system.
+
+    template <size_t BLOCK_SIZE>
+    class BlockAllocator : private NonCopyable
+    {
+    protected:
+        struct Block
+        {
+            Block* next;
+            Block* next_batch;
+            int count;
+        };
+
+        struct LocalCache
+        {
+            BlockAllocator* allocator { nullptr };
+            Block* head { nullptr };
+            int count { 0 };
+
+            ~LocalCache()
+            {
+                // return the cached blocks when the thread exits
+                if (head)
+                {
+                    allocator->releaseBatch(head, count);
+                    head = nullptr;
+                    count = 0;
+                }
+            }
+        };
+
+        enum
+        {
+            BATCH_SIZE = 64,
+            SLAB_BATCHES = 4
+        };
+
+        SpinLock m_lock;
+        Block* m_batches { nullptr };
+
+        Block* acquireBatch(int& count)
+        {
+            SpinLockGuard guard(m_lock);
+
+            if (!m_batches)
+            {
+                // carve a new slab into batches
+                const size_t batch_bytes = BLOCK_SIZE * BATCH_SIZE;
+                uint8* slab = new uint8[batch_bytes * SLAB_BATCHES + 64];
+                uint8* address = reinterpret_cast<uint8*>((reinterpret_cast<uintptr_t>(slab) + 63) & ~uintptr_t(63));
+
+                for (int i = 0; i < SLAB_BATCHES; ++i)
+                {
+                    Block* head = nullptr;
+                    for (int j = BATCH_SIZE - 1; j >= 0; --j)
+                    {
+                        Block* block = reinterpret_cast<Block*>(address + j * BLOCK_SIZE);
+                        block->next = head;
+                        head = block;
+                    }
+
+                    head->count = BATCH_SIZE;
+                    head->next_batch = m_batches;
+                    m_batches = head;
+                    address += batch_bytes;
+                }
+            }
+
+            Block* head = m_batches;
+            m_batches = head->next_batch;
+            count = head->count;
+            return head;
+        }
+
+        void releaseBatch(Block* head, int count)
+        {
+            SpinLockGuard guard(m_lock);
+            head->count = count;
+            head->next_batch = m_batches;
+            m_batches = head;
+        }
+
+        LocalCache& local()
+        {
+            static thread_local LocalCache cache;
+            cache.allocator = this;
+            return cache;
+        }
+
+    public:
+        static BlockAllocator& getInstance()
+        {
+            // never destroyed; the worker threads of static pools release
+            // their caches after the static destructors have been run
+            static BlockAllocator* allocator = new BlockAllocator();
+            return *allocator;
+        }
+
+        void* allocate()
+        {
+            LocalCache& cache = local();
+            if (!cache.head)
+            {
+                cache.head = acquireBatch(cache.count);
+            }
+
+            Block* block = cache.head;
+            cache.head = block->next;
+            --cache.count;
+            return block;
+        }
+
+        void free(void* pointer)
+        {
+            LocalCache& cache = local();
+
+            Block* block = reinterpret_cast<Block*>(pointer);
+            block->next = cache.head;
+            cache.head = block;
+
+            if (++cache.count >= BATCH_SIZE * 2)
+            {
+                // keep one batch and give the other back to the depot
+                Block* tail = cache.head;
+                for (int i = 1; i < BATCH_SIZE; ++i)
+                {
+                    tail = tail->next;
+                }
+
+                Block* head = cache.head;
+                cache.head = tail->next;
+                cache.count -= BATCH_SIZE;
+                tail->next = nullptr;
+                releaseBatch(head, BATCH_SIZE);
+            }
+        }
+    };
+
+    using CallableAllocator = BlockAllocator<512>;
+
+    ThreadPool::Task* ThreadPool::allocateTask()
+    {
+        using TaskAllocator = BlockAllocator<(sizeof(Task) + 63) & ~size_t(63)>;
+        return reinterpret_cast<Task*>(TaskAllocator::getInstance().allocate());
+    }
+
+    void ThreadPool::freeTask(Task* task)
+    {
+        using TaskAllocator = BlockAllocator<(sizeof(Task) + 63) & ~size_t(63)>;
+        TaskAllocator::getInstance().free(task);
+    }
+
+    void* ThreadPool::allocateBlock(size_t size)
+    {
+        if (size > 512)
+        {
+            return operator new (size);
+        }
+
+        return CallableAllocator::getInstance().allocate();
+    }
+
+    void ThreadPool::freeBlock(void* block, size_t size)
+    {
+        if (size > 512)
+        {
+            operator delete (block);
+            return;
+        }
+
+        CallableAllocator::getInstance().free(block);
+    }
+
+    // ------------------------------------------------------------
+    // ThreadPool
+    // ------------------------------------------------------------
+
+    ThreadPool::ThreadPool(size_t size)
+    : ThreadPool(size, std::vector<int>())
+    {
+    }
+
+    ThreadPool::ThreadPool(size_t size, const std::vector<int>& processors)
+    : m_queue_cache(32), m_queues(nullptr), m_workers(nullptr), m_profile(nullptr), m_threads(size)
+    {
+        const CPUTopology& topology = getCPUTopology();
+
+        std::vector<CPUTopology::Processor> available;
+        for (auto& processor : topology.processors)
+        {
+            if (processors.empty() || std::find(processors.begin(), processors.end(), processor.id) != processors.end())
+                available.push_back(processor);
+        }
+
+        if (available.empty())
+        {
+            // none of the requested processors are usable by the process
+            available = topology.processors;
+        }
+
+        m_nodes = topology.nodes;
+        m_node_processors.resize(m_nodes);
+        m_affinity = m_nodes > 1 || available.size() < topology.processors.size();
+
+        for (auto& processor : available)
+        {
+            if (processor.id >= int(m_processor_node.size()))
+                m_processor_node.resize(processor.id + 1, 0);
+            m_processor_node[processor.id] = processor.node;
+            m_node_processors[processor.node].push_back(processor.id);
+        }
+
+        m_queues = new TaskQueue[m_nodes * 3];
+        m_profile = new PoolProfile();
+
+        // the deques are cache line aligned, which operator new doesn't honour before C++17
+        void* workers = aligned_malloc(std::max(size, size_t(1)) * sizeof(WorkerQueue), alignof(WorkerQueue));
+        if (!workers)
+        {
+            delete[] m_queues;
+            delete m_profile;
+            throw std::bad_alloc();
+        }
+
+        m_workers = reinterpret_cast<WorkerQueue*>(workers);
+        for (size_t i = 0; i < size; ++i)
+        {
+            new (&m_workers[i]) WorkerQueue();
+        }
+
+        // spread the workers evenly over the processors; they are sorted by
+        // node and cache so the workers of one node get consecutive indices
+        m_node_workers.assign(m_nodes + 1, int(size));
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            const int node = available[i * available.size() / size].node;
+
+            m_workers[i].pool = this;
+            m_workers[i].index = int(i);
+            m_workers[i].node = node;
+            m_workers[i].seed = uint32(i * 0x9e3779b9 + 1);
+
+            m_node_workers[node] = std::min(m_node_workers[node], int(i));
+        }
+
+        for (int node = m_nodes - 1; node >= 0; --node)
+        {
+            // nodes without workers get an empty range
+            m_node_workers[node] = std::min(m_node_workers[node], m_node_workers[node + 1]);
+        }
+
+        m_static_queue = createQueue("static", static_cast<int>(Priority::NORMAL));
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_threads[i] = std::thread([this, i] {
+                thread(i);
+            });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        m_stop = true;
+        m_idle_event.notify(true);
+        getWorkerEvent().notify(true);
+
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+
+        // discard tasks which were never processed
+        for (int priority = 0; priority < 3; ++priority)
+        {
+            Task* task;
+            for (int node = 0; node < m_nodes; ++node)
+            {
+                while (m_queues[node * 3 + priority].tasks.try_dequeue(task))
+                {
+                    task->run(false);
+                    freeTask(task);
+                }
+            }
+
+            for (size_t i = 0; i < m_threads.size(); ++i)
+            {
+                while ((task = m_workers[i].tasks[priority].pop()))
+                {
+                    task->run(false);
+                    freeTask(task);
+                }
+            }
+        }
+
+        deleteQueue(m_static_queue);
+
+        for (size_t i = 0; i < m_threads.size(); ++i)
+        {
+            m_workers[i].~WorkerQueue();
+        }
+
+        aligned_free(m_workers);
+        delete[] m_queues;
+        delete m_profile;
+    }
+
+    ThreadPool& ThreadPool::getInstance()
+    {
+        static ThreadPool instance(std::max(std::thread::hardware_concurrency() - 1, 1U));
+        return instance;
+    }
+
+    int ThreadPool::getInstanceSize()
+    {
+        ThreadPool& pool = getInstance();
+        return pool.size();
+    }
+
+    void ThreadPool::setWorkerLimit(int limit)
+    {
+        g_worker_limit = std::max(limit, 0);
+        getWorkerEvent().notify(true);
+    }
+
+    int ThreadPool::getWorkerLimit()
+    {
+        return g_worker_limit;
+    }
+
+    int ThreadPool::size() const
+    {
+        return int(m_threads.size());
+    }
+
+    int ThreadPool::getNodeCount() const
+    {
+        return m_nodes;
+    }
+
+    int ThreadPool::currentNode() const
+    {
+        WorkerQueue* worker = g_current_worker;
+        if (worker && worker->pool == this)
+            return worker->node;
+
+        if (m_nodes < 2)
+            return 0;
+
+#if defined(MANGO_PLATFORM_LINUX)
+        int processor = sched_getcpu();
+        if (processor >= 0 && processor < int(m_processor_node.size()))
+            return m_processor_node[processor];
 #endif
 
-namespace mango
-{
+        return 0;
+    }
+
+    void ThreadPool::setSpinBudget(int budget)
+    {
+        m_spin_budget = std::max(budget, 0);
+    }
+
+    int ThreadPool::getSpinBudget() const
+    {
+        return m_spin_budget;
+    }
+
+    void ThreadPool::thread(size_t threadID)
+    {
+        g_current_worker = &m_workers[threadID];
+
+        // NOTE: the OS scheduler is free to move the workers inside their node;
+        //       pinning to a single processor doesn't pay off with tasks this short
+        if (m_affinity)
+        {
+            set_current_thread_affinity(m_node_processors[m_workers[threadID].node]);
+        }
+
+        bool woken = false;
+
+        while (!m_stop.load(std::memory_order_relaxed))
+        {
+            // wait for a slot when the global worker limit is reached
+            WorkerSlot slot = acquire_worker();
+            if (slot == SLOT_NONE)
+            {
+                park(getWorkerEvent(), 0, [this, &slot] {
+                    if (m_stop.load())
+                        return true;
+                    slot = acquire_worker();
+                    return slot != SLOT_NONE;
+                });
+
+                if (slot == SLOT_NONE)
+                    break;
+            }
+
+            // the slot can be handed over and taken again while a task waits for a barrier
+            WorkerQueue& worker = m_workers[threadID];
+            worker.slot = slot;
+            const bool processed = dequeue_process(woken);
+            release_worker(worker.slot);
+            worker.slot = SLOT_NONE;
+            woken = false;
+
+            if (!processed)
+            {
+                auto predicate = [this] {
+                    return m_stop.load() || pending();
+                };
+
+                // no work; spin for a while and then park until something is enqueued.
+                // producers don't wake anyone up while a worker is spinning, so the
+                // worker which finds work passes the wakeup on (see dequeue_process).
+                const bool profiling = m_profiling.load(std::memory_order_relaxed);
+                const uint64 time0 = profiling ? profile_time() : 0;
+
+                ++m_spinning;
+                bool ready = spin_wait(m_spin_budget, predicate);
+                --m_spinning;
+
+                const uint64 time1 = profiling ? profile_time() : 0;
+
+                if (!ready)
+                {
+                    park(m_idle_event, 0, predicate);
+                }
+
+                woken = true;
+
+                if (profiling)
+                {
+                    WorkerProfile& profile = m_workers[threadID].profile;
+                    profile_add(profile.idle_time, time1 - time0);
+                    if (!ready)
+                        profile_add(profile.sleep_time, profile_time() - time1);
+                }
+            }
+        }
+    }
+
+    void ThreadPool::setProfiling(bool enable, bool trace)
+    {
+        if (enable && !m_static_queue->profile.load())
+        {
+            m_static_queue->profile = m_profile->getQueue(m_static_queue->name);
+        }
+
+        m_tracing = enable && trace;
+        m_profiling = enable;
+    }
+
+    void ThreadPool::resetProfiling()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_profile->mutex);
+            for (auto& queue : m_profile->queues)
+            {
+                queue->reset();
+            }
+        }
+
+        for (size_t i = 0; i < m_threads.size(); ++i)
+        {
+            m_workers[i].profile.reset();
+        }
+
+        m_profile->external.reset();
+        m_profile->epoch = profile_time();
+    }
+
+    std::vector<ThreadPool::QueueStatistics> ThreadPool::getQueueStatistics() const
+    {
+        std::vector<QueueStatistics> statistics;
+        std::lock_guard<std::mutex> lock(m_profile->mutex);
+
+        for (auto& queue : m_profile->queues)
+        {
+            QueueStatistics s;
+            s.name = queue->name;
+            s.tasks = queue->tasks;
+            s.run_time = queue->run_time;
+            s.latency_time = queue->latency_time;
+            s.latency_max = queue->latency_max;
+            for (int i = 0; i < LATENCY_BUCKETS; ++i)
+            {
+                s.latency_histogram[i] = queue->latency_histogram[i];
+            }
+            statistics.push_back(s);
+        }
+
+        return statistics;
+    }
+
+    std::vector<ThreadPool::WorkerStatistics> ThreadPool::getWorkerStatistics() const
+    {
+        std::vector<WorkerStatistics> statistics;
+
+        for (size_t i = 0; i < m_threads.size(); ++i)
+        {
+            const WorkerProfile& profile = m_workers[i].profile;
+            statistics.push_back({ profile.tasks, profile.steals, profile.run_time,
+                                   profile.idle_time, profile.sleep_time });
+        }
+
+        return statistics;
+    }
+
+    std::string ThreadPool::getProfileReport() const
+    {
+        auto ms = [] (uint64 ns)
+        {
+            return double(ns) / 1000000.0;
+        };
+
+        std::stringstream report;
+        report << std::fixed << std::setprecision(3);
+
+        report << "queue                      tasks    run (ms)  latency avg (ms)  p50 (ms)  p99 (ms)  max (ms)\n";
+
+        for (auto& queue : getQueueStatistics())
+        {
+            if (!queue.tasks)
+                continue;
+
+            // upper bound of the histogram bucket which holds the percentile
+            auto percentile = [&] (double p)
+            {
+                uint64 limit = uint64(p * queue.tasks);
+                uint64 count = 0;
+                for (int i = 0; i < LATENCY_BUCKETS; ++i)
+                {
+                    count += queue.latency_histogram[i];
+                    if (count > limit)
+                        return ms(std::min((uint64(1) << i) * 1000, queue.latency_max));
+                }
+                return ms(queue.latency_max);
+            };
+
+            report << std::left << std::setw(24) << queue.name << std::right
+                   << std::setw(9) << queue.tasks
+                   << std::setw(12) << ms(queue.run_time)
+                   << std::setw(18) << ms(queue.latency_time / queue.tasks)
+                   << std::setw(10) << percentile(0.50)
+                   << std::setw(10) << percentile(0.99)
+                   << std::setw(10) << ms(queue.latency_max) << "\n";
+        }
+
+        report << "\nworker    tasks   steals    run (ms)   idle (ms)  sleep (ms)\n";
+
+        int index = 0;
+        for (auto& worker : getWorkerStatistics())
+        {
+            report << std::setw(6) << index++
+                   << std::setw(9) << worker.tasks
+                   << std::setw(9) << worker.steals
+                   << std::setw(12) << ms(worker.run_time)
+                   << std::setw(12) << ms(worker.idle_time)
+                   << std::setw(12) << ms(worker.sleep_time) << "\n";
+        }
+
+        return report.str();
+    }
+
+    std::string ThreadPool::getTrace() const
+    {
+        std::stringstream trace;
+        trace << std::fixed << std::setprecision(3);
+        trace << "{\"traceEvents\":[\n";
+
+        auto escape = [] (const std::string& text)
+        {
+            std::string s;
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                    s += '\\';
+                s += c;
+            }
+            return s;
+        };
+
+        auto write = [&] (const WorkerProfile& profile, int tid, const std::string& name)
+        {
+            trace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+                  << ",\"args\":{\"name\":\"" << name << "\"}}";
+
+            std::lock_guard<std::mutex> lock(profile.trace_mutex);
+            for (const TraceEvent& event : profile.trace)
+            {
+                const double start = double(event.start - std::min(event.start, m_profile->epoch)) / 1000.0;
+                trace << ",\n{\"name\":\"" << escape(event.queue->name) << "\",\"cat\":\"task\",\"ph\":\"X\""
+                      << ",\"ts\":" << start << ",\"dur\":" << double(event.duration) / 1000.0
+                      << ",\"pid\":0,\"tid\":" << tid << "}";
+            }
+        };
+
+        write(m_profile->external, 0, "external");
+
+        for (size_t i = 0; i < m_threads.size(); ++i)
+        {
+            trace << ",\n";
+            write(m_workers[i].profile, int(i + 1), "worker " + std::to_string(i));
+        }
 
-    // ------------------------------------------------------------
-    // TaskQueue
-    // ------------------------------------------------------------
+        trace << "\n]}\n";
+        return trace.str();
+    }
 
-    struct TaskQueue
+    void ThreadPool::submit(Queue* queue, Task* task)
     {
-        using Task = ThreadPool::Task;
-        moodycamel::ConcurrentQueue<Task> tasks;
-    };
+        queue->retain();
 
-    // ------------------------------------------------------------
-    // ThreadPool
-    // ------------------------------------------------------------
+        task->queue = queue;
+        task->stamp = queue->task_input_count++;
+        task->barrier = queue->stamp_barrier;
+        task->time = 0;
 
-    ThreadPool::ThreadPool(size_t size)
-    : m_queue_cache(32), m_queues(nullptr), m_threads(size)
-    {
-        m_queues = new TaskQueue[3];
-        m_static_queue = createQueue("static", static_cast<int>(Priority::NORMAL));
+        if (queue->profile.load(std::memory_order_relaxed) && m_profiling.load(std::memory_order_relaxed))
+        {
+            task->time = profile_time();
+        }
 
-        // NOTE: let OS scheduler shuffle tasks as it sees fit
-        //       this gives better performance overall UNTIL we have some practical
-        //       use for the affinity (eg. dependent tasks using same cache)
-        const bool affinity = false;//std::thread::hardware_concurrency() > 1;
-		if (affinity)
-            set_current_thread_affinity(0);
+        const int node = queue->node >= 0 ? queue->node : currentNode();
 
-        for (size_t i = 0; i < size; ++i)
+        WorkerQueue* worker = g_current_worker;
+        if (worker && worker->pool == this && worker->node == node && !task->barrier)
         {
-            m_threads[i] = std::thread([this, i] {
-                thread(i);
-            });
+            // unordered task from one of our own workers: keep it local
+            worker->tasks[queue->priority].push(task);
+        }
+        else
+        {
+            // the shared queue keeps ordered tasks in FIFO order so that
+            // the barrier cannot be waiting for a task which hasn't started
+            m_queues[node * 3 + queue->priority].tasks.enqueue(task);
+        }
 
-			if (affinity)
-                set_thread_affinity(m_threads[i].native_handle(), int(i + 1));
+        // wake up one parked worker unless someone is already spinning for work
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_spinning.load(std::memory_order_relaxed))
+        {
+            m_idle_event.notify();
         }
+
+        // whoever is waiting for this queue might want to help
+        queue->event.notify(true);
     }
 
-    ThreadPool::~ThreadPool()
+    ThreadPool::Task* ThreadPool::steal(WorkerQueue* worker, int priority, int node)
     {
-        m_stop = true;
-        m_condition.notify_all();
+        const int first = m_node_workers[node];
+        const int count = m_node_workers[node + 1] - first;
+        if (!count)
+            return nullptr;
 
-        for (auto& thread : m_threads)
+        // start from a random victim to spread the contention
+        int victim = worker ? int(worker->random() % count) : 0;
+
+        for (int i = 0; i < count; ++i)
         {
-            thread.join();
+            WorkerQueue& queue = m_workers[first + victim];
+            if (&queue != worker)
+            {
+                Task* task = queue.tasks[priority].steal();
+                if (task)
+                {
+                    if (worker && m_profiling.load(std::memory_order_relaxed))
+                        profile_add(worker->profile.steals, 1);
+                    return task;
+                }
+            }
+
+            if (++victim == count)
+                victim = 0;
         }
 
-        deleteQueue(m_static_queue);
-        delete[] m_queues;
+        return nullptr;
     }
 
-    ThreadPool& ThreadPool::getInstance()
+    bool ThreadPool::pending() const
     {
-        static ThreadPool instance(std::max(std::thread::hardware_concurrency() - 1, 1U));
-        return instance;
-    }
+        for (int priority = 0; priority < 3; ++priority)
+        {
+            for (int node = 0; node < m_nodes; ++node)
+            {
+                if (m_queues[node * 3 + priority].tasks.size_approx() > 0)
+                    return true;
+            }
 
-    int ThreadPool::getInstanceSize()
-    {
-        ThreadPool& pool = getInstance();
-        return pool.size();
-    }
+            for (size_t i = 0; i < m_threads.size(); ++i)
+            {
+                if (!m_workers[i].tasks[priority].empty())
+                    return true;
+            }
+        }
 
-    int ThreadPool::size() const
-    {
-        return int(m_threads.size());
+        return false;
     }
 
-    void ThreadPool::thread(size_t threadID)
+    ThreadPool::Task* ThreadPool::dequeue(WorkerQueue* worker)
     {
-        auto time0 = high_resolution_clock::now();
+        const int home = worker ? worker->node : currentNode();
 
-        while (!m_stop.load(std::memory_order_relaxed))
+        // scan task queues in priority order
+        for (int priority = 0; priority < 3; ++priority)
         {
-            if (dequeue_process())
+            Task* task = nullptr;
+
+            if (worker)
             {
-                // remember the last time we processed a task
-                time0 = high_resolution_clock::now();
+                task = worker->tasks[priority].pop();
+                if (task)
+                    return task;
             }
-            else
+
+            // own node first, then the remote nodes
+            for (int i = 0; i < m_nodes; ++i)
             {
-                // don't be too eager to sleep
-                auto time1 = high_resolution_clock::now();
-                auto elapsed = duration_cast<milliseconds>(time1 - time0).count();
-                if (elapsed >= milliseconds(2).count())
-                {
-                    // sleep but check what's happening after a while unless signaled
-                    ++m_sleep_count;
-                    std::unique_lock<std::mutex> lock(m_queue_mutex);
-                    m_condition.wait_for(lock, milliseconds(32));
-                    --m_sleep_count;
-                }
-                else
-                {
-                    // no work; yield and try again soon
-                    std::this_thread::yield();
-                }
+                const int node = (home + i) % m_nodes;
+
+                if (m_queues[node * 3 + priority].tasks.try_dequeue(task))
+                    return task;
+
+                task = steal(worker, priority, node);
+                if (task)
+                    return task;
             }
         }
+
+        return nullptr;
     }
 
-    void ThreadPool::enqueue(Queue* queue, std::function<void()>&& func)
+    bool ThreadPool::dequeue_process(bool woken)
     {
-        queue->retain();
+        WorkerQueue* worker = g_current_worker;
+        if (worker && worker->pool != this)
+        {
+            // the calling thread belongs to a different pool
+            worker = nullptr;
+        }
 
-        Task task;
-        task.queue = queue;
-        task.stamp = queue->task_input_count++;
-        task.barrier = queue->stamp_barrier;
-        task.func = std::move(func);
+        Task* task = dequeue(worker);
+        if (!task)
+            return false;
 
-        m_queues[queue->priority].tasks.enqueue(std::move(task));
+        if (woken && pending())
+        {
+            // a worker which just came back from idle wakes up the next one while
+            // there is more work; a burst enqueued while someone was spinning
+            // would otherwise run on the spinning worker alone
+            m_idle_event.notify();
+        }
 
-        if (m_sleep_count > 0)
-            m_condition.notify_one();
-    }
+        Queue* queue = task->queue;
 
-    bool ThreadPool::dequeue_process()
-    {
-        // scan task queues in priority order
-        for (size_t priority = 0; priority < 3; ++priority)
+        // check if the task is cancelled
+        const bool invoke = task->stamp > queue->stamp_cancel;
+        if (invoke)
         {
-            Task task;
-            if (m_queues[priority].tasks.try_dequeue(task))
+            // wait until task is not blocked by a barrier
+            const int barrier = task->barrier;
+            if (barrier > queue->task_complete_count)
             {
-                Queue* queue = task.queue;
-                
-                // check if the task is cancelled
-                if (task.stamp > queue->stamp_cancel)
+                auto predicate = [queue, barrier] {
+                    return queue->task_complete_count >= barrier;
+                };
+
+                WorkerQueue* current = g_current_worker;
+                if (current && current->slot == SLOT_COUNTED && !spin_wait(m_spin_budget, predicate))
+                {
+                    // with a worker limit the tasks before the barrier might be in the deque
+                    // of a worker which is waiting for a slot; give ours up while parked
+                    release_worker(current->slot);
+                    current->slot = SLOT_NONE;
+
+                    park(queue->event, 0, predicate);
+
+                    WorkerSlot slot = acquire_worker();
+                    if (slot == SLOT_NONE)
+                    {
+                        park(getWorkerEvent(), 0, [&slot] {
+                            slot = acquire_worker();
+                            return slot != SLOT_NONE;
+                        });
+                    }
+
+                    current->slot = slot;
+                }
+                else
                 {
-                    // wait until task is not blocked by a barrier
-                    while (task.barrier > queue->task_complete_count)
-                        ;
-                    
-                    // process task
-                    task.func();
+                    park(queue->event, m_spin_budget, predicate);
                 }
+            }
+
+        }
+
+        // process task
+        if (task->time)
+        {
+            const uint64 time0 = profile_time();
+            task->run(invoke);
+            const uint64 time1 = profile_time();
+
+            QueueProfile* profile = queue->profile.load(std::memory_order_relaxed);
+            profile->record(time0 - task->time, time1 - time0);
 
-                ++queue->task_complete_count;
-                queue->release();
-                
-                return true;
+            WorkerProfile& current = worker ? worker->profile : m_profile->external;
+            profile_add(current.tasks, 1);
+            profile_add(current.run_time, time1 - time0);
+
+            if (m_tracing.load(std::memory_order_relaxed))
+            {
+                std::lock_guard<std::mutex> lock(current.trace_mutex);
+                current.trace.push_back({ profile, time0, time1 - time0 });
             }
         }
+        else
+        {
+            task->run(invoke);
+        }
 
-        return false;
+        freeTask(task);
+
+        ++queue->task_complete_count;
+        queue->event.notify(true);
+        queue->release();
+
+        return true;
     }
 
     void ThreadPool::wait(Queue* queue)
     {
+        auto complete = [queue] {
+            return queue->task_complete_count >= queue->task_input_count;
+        };
+
         // NOTE: we might be waiting here a while if other threads keep enqueuing tasks
-        while (queue->task_complete_count < queue->task_input_count)
+        while (!complete())
         {
             if (!dequeue_process())
             {
-                std::this_thread::yield();
+                // nothing to help with; park until the queue makes progress
+                park(queue->event, m_spin_budget, [this, &complete] {
+                    return complete() || pending();
+                });
             }
         }
     }
@@ -239,6 +1403,8 @@ namespace mango
 
         queue->pool = this;
         queue->priority = priority;
+        queue->node = -1;
+        queue->profile = m_profiling ? m_profile->getQueue(name) : nullptr;
         queue->reference_count = 1;
         queue->task_input_count = 0;
         queue->task_complete_count = 0;
@@ -270,6 +1436,12 @@ namespace mango
         m_queue = m_pool.createQueue(name, static_cast<int>(priority));
     }
 
+    ConcurrentQueue::ConcurrentQueue(ThreadPool& pool, const std::string& name, Priority priority)
+    : m_pool(pool)
+    {
+        m_queue = m_pool.createQueue(name, static_cast<int>(priority));
+    }
+
     ConcurrentQueue::~ConcurrentQueue()
     {
         m_queue->release();
@@ -280,6 +1452,16 @@ namespace mango
         m_queue->stamp_barrier = m_queue->task_input_count;
     }
 
+    void ConcurrentQueue::setLocality(const void* address)
+    {
+        setLocality(getMemoryNode(address));
+    }
+
+    void ConcurrentQueue::setLocality(int node)
+    {
+        m_queue->node = node >= 0 && node < m_pool.getNodeCount() ? node : -1;
+    }
+
     void ConcurrentQueue::cancel()
     {
         m_pool.cancel(m_queue);
@@ -306,11 +1488,27 @@ namespace mango
         m_queue = m_pool.createQueue(name, static_cast<int>(priority));
     }
 
+    SerialQueue::SerialQueue(ThreadPool& pool, const std::string& name, Priority priority)
+    : m_pool(pool)
+    {
+        m_queue = m_pool.createQueue(name, static_cast<int>(priority));
+    }
+
     SerialQueue::~SerialQueue()
     {
         m_queue->release();
     }
 
+    void SerialQueue::setLocality(const void* address)
+    {
+        setLocality(getMemoryNode(address));
+    }
+
+    void SerialQueue::setLocality(int node)
+    {
+        m_queue->node = node >= 0 && node < m_pool.getNodeCount() ? node : -1;
+    }
+
     void SerialQueue::cancel()
     {
         m_pool.cancel(m_queue);
@@ -321,4 +1519,279 @@ namespace mango
         m_pool.wait(m_queue);
     }
 
+    // ------------------------------------------------------------
+    // TaskGraph
+    // ------------------------------------------------------------
+
+    TaskGraph::TaskGraph()
+    : m_queue("graph")
+    {
+    }
+
+    TaskGraph::TaskGraph(const std::string& name, Priority priority)
+    : m_queue(name, priority)
+    {
+    }
+
+    TaskGraph::TaskGraph(ThreadPool& pool, const std::string& name, Priority priority)
+    : m_queue(pool, name, priority)
+    {
+    }
+
+    TaskGraph::~TaskGraph()
+    {
+        m_queue.wait();
+    }
+
+    TaskGraph::Node* TaskGraph::acquire()
+    {
+        SpinLockGuard guard(m_lock);
+
+        Node* node = m_free;
+        if (node)
+        {
+            m_free = node->next;
+        }
+        else
+        {
+            node = new Node();
+            m_nodes.emplace_back(node);
+        }
+
+        return node;
+    }
+
+    void TaskGraph::recycle(Node* node)
+    {
+        SpinLockGuard guard(m_lock);
+        node->next = m_free;
+        m_free = node;
+    }
+
+    TaskGraph::Handle TaskGraph::submit(Node* node, const Handle* predecessors, size_t count)
+    {
+        node->pending = 1;
+
+        // the serial only changes when the task completes, which can't happen before it is scheduled
+        const Handle handle = { node, node->serial };
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            Node* predecessor = predecessors[i].node;
+            if (!predecessor)
+                continue;
+
+            SpinLockGuard guard(predecessor->lock);
+            if (predecessor->serial == predecessors[i].serial)
+            {
+                ++node->pending;
+                predecessor->successors.push_back(node);
+            }
+        }
+
+        // drop the reference which kept the node from starting while it was being linked
+        schedule(node);
+
+        return handle;
+    }
+
+    void TaskGraph::schedule(Node* node)
+    {
+        if (!--node->pending)
+        {
+            m_queue.enqueue([this, node] {
+                execute(node);
+            });
+        }
+    }
+
+    void TaskGraph::execute(Node* node)
+    {
+        // invokes and destroys the callable
+        node->task.run(true);
+
+        std::vector<Node*> successors;
+
+        {
+            // the handles to this task refer to a completed task from now on
+            SpinLockGuard guard(node->lock);
+            ++node->serial;
+            std::swap(successors, node->successors);
+        }
+
+        // the successors are enqueued before this task is complete so
+        // waiting for the queue covers the whole graph
+        for (Node* successor : successors)
+        {
+            schedule(successor);
+        }
+
+        // keep the capacity of the successor list for the next task
+        successors.clear();
+        {
+            SpinLockGuard guard(node->lock);
+            std::swap(successors, node->successors);
+        }
+
+        recycle(node);
+    }
+
+    void TaskGraph::wait()
+    {
+        m_queue.wait();
+    }
+
+    // ------------------------------------------------------------
+    // Future
+    // ------------------------------------------------------------
+
+namespace detail
+{
+
+    static EventCount& getFutureEvent()
+    {
+        // never destroyed; worker threads may complete futures at exit
+        static EventCount* event = new EventCount();
+        return *event;
+    }
+
+    void* FutureStateBase::operator new (size_t size)
+    {
+        return ThreadPool::allocateBlock(size);
+    }
+
+    void FutureStateBase::operator delete (void* pointer, size_t size)
+    {
+        ThreadPool::freeBlock(pointer, size);
+    }
+
+    void FutureStateBase::dispatch(ThreadPool::Task* task, bool callback)
+    {
+        if (callback)
+        {
+            task->run(true);
+            ThreadPool::freeTask(task);
+        }
+        else
+        {
+            ThreadPool& pool = getPool();
+            pool.submit(pool.m_static_queue, task);
+        }
+    }
+
+    void FutureStateBase::attach(ThreadPool::Task* task, bool callback)
+    {
+        {
+            SpinLockGuard guard(m_lock);
+            if (!m_ready.load(std::memory_order_relaxed))
+            {
+                ThreadPool::Task*& head = callback ? m_callbacks : m_continuations;
+                task->next = head;
+                head = task;
+                return;
+            }
+        }
+
+        // the value is already there
+        dispatch(task, callback);
+    }
+
+    void FutureStateBase::setReady()
+    {
+        ThreadPool::Task* continuations;
+        ThreadPool::Task* callbacks;
+
+        {
+            SpinLockGuard guard(m_lock);
+            m_ready.store(true, std::memory_order_release);
+            continuations = m_continuations;
+            callbacks = m_callbacks;
+            m_continuations = nullptr;
+            m_callbacks = nullptr;
+        }
+
+        getFutureEvent().notify(true);
+
+        while (callbacks)
+        {
+            ThreadPool::Task* next = callbacks->next;
+            dispatch(callbacks, true);
+            callbacks = next;
+        }
+
+        while (continuations)
+        {
+            ThreadPool::Task* next = continuations->next;
+            dispatch(continuations, false);
+            continuations = next;
+        }
+    }
+
+    void FutureStateBase::wait()
+    {
+        ThreadPool& pool = getPool();
+
+        while (!ready())
+        {
+            // help with the work instead of blocking the thread
+            if (!pool.dequeue_process())
+            {
+                park(getFutureEvent(), pool.m_spin_budget, [this, &pool] {
+                    return ready() || pool.pending();
+                });
+            }
+        }
+    }
+
+} // namespace detail
+
+    Future<void> when_all(const std::vector<Future<void>>& futures)
+    {
+        // the join is the state of the returned future (see the template)
+        struct Join : detail::FutureState<void>
+        {
+            std::atomic<int> count;
+            std::vector<Future<void>> futures;
+
+            void complete()
+            {
+                if (--count)
+                    return;
+
+                // the inputs are not needed after this
+                std::vector<Future<void>> inputs;
+                std::swap(inputs, futures);
+
+                for (auto& future : inputs)
+                {
+                    if (future.m_state->failed())
+                    {
+                        setException(future.m_state->exception());
+                        break;
+                    }
+                }
+
+                if (!ready())
+                    setValue();
+
+                release();
+            }
+        };
+
+        Join* join = new Join();
+        join->count = int(futures.size()) + 1;
+        join->futures = futures;
+        join->retain(); // released by complete()
+
+        Future<void> result(join);
+
+        for (auto& future : futures)
+        {
+            future.m_state->attach([join] { join->complete(); }, true);
+        }
+
+        join->complete();
+        return result;
+    }
+
 } // namespace mango
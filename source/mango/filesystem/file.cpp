@@ -56,6 +56,11 @@ namespace mango
         return (*m_memory)->address;
     }
 
+    void File::advise(VirtualMemory::Advice advice, size_t offset, size_t size)
+    {
+        m_memory->advise(advice, offset, size);
+    }
+
     uint64 File::size() const
     {
         return (*m_memory)->size;
@@ -105,4 +110,59 @@ namespace mango
         MANGO_EXCEPTION(ID"Cannot write() in read-only file.");
     }
 
+    // -----------------------------------------------------------------
+    // FileReader
+    // -----------------------------------------------------------------
+
+    FileReader::FileReader(const Path& path, const std::string& filename)
+    {
+        m_mapper = path;
+        m_pathname = path.pathname();
+        m_filename = parse(m_pathname + filename, "");
+        m_stream = std::unique_ptr<Stream>(m_mapper->open(m_filename));
+    }
+
+    FileReader::FileReader(const std::string& filename)
+    {
+        m_mapper = getFileMapper();
+        m_filename = parse(filename, "");
+        m_stream = std::unique_ptr<Stream>(m_mapper->open(m_filename));
+    }
+
+    FileReader::~FileReader()
+    {
+    }
+
+    const std::string& FileReader::filename() const
+    {
+        return m_filename;
+    }
+
+    uint64 FileReader::size() const
+    {
+        return m_stream->size();
+    }
+
+    uint64 FileReader::offset() const
+    {
+        return m_stream->offset();
+    }
+
+    void FileReader::seek(uint64 distance, SeekMode mode)
+    {
+        m_stream->seek(distance, mode);
+    }
+
+    void FileReader::read(void* dest, size_t size)
+    {
+        m_stream->read(dest, size);
+    }
+
+    void FileReader::write(const void* data, size_t size)
+    {
+        MANGO_UNREFERENCED_PARAMETER(data);
+        MANGO_UNREFERENCED_PARAMETER(size);
+        MANGO_EXCEPTION(ID"Cannot write() in read-only file.");
+    }
+
 } // namespace mango
@@ -3,8 +3,13 @@
     Copyright (C) 2012-2016 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <vector>
+#include <cstring>
 #include <algorithm>
+#include <mutex>
 #include <mango/core/string.hpp>
+#include <mango/core/pointer.hpp>
+#include <mango/core/bits.hpp>
+#include <mango/core/exception.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
 
@@ -19,7 +24,9 @@ namespace mango
 #ifdef MANGO_ENABLE_LICENSE_GPL
     AbstractMapper* createMapperRAR(Memory parent, const std::string& password);
 #endif
-    //AbstractMapper* createMapperMGX(Memory parent, const std::string& password);
+#ifdef MANGO_ENABLE_LICENSE_BSD
+    AbstractMapper* createMapperMGX(Memory parent, const std::string& password);
+#endif
 
     typedef AbstractMapper* (*CreateMapperFunc)(Memory, const std::string&);
 
@@ -59,9 +66,95 @@ namespace mango
         extensions.push_back(MapperExtension("cbr", createMapperRAR));
 #endif
 
+#ifdef MANGO_ENABLE_LICENSE_BSD
+        extensions.push_back(MapperExtension("mgx", createMapperMGX));
+#endif
+
         return extensions;
     } ();
 
+    // -----------------------------------------------------------------
+    // AbstractMapper
+    // -----------------------------------------------------------------
+
+    namespace
+    {
+
+        class VirtualMemoryStream : public Stream
+        {
+        protected:
+            std::unique_ptr<VirtualMemory> m_memory;
+            uint64 m_offset;
+
+        public:
+            VirtualMemoryStream(VirtualMemory* memory)
+                : m_memory(memory)
+                , m_offset(0)
+            {
+            }
+
+            ~VirtualMemoryStream()
+            {
+            }
+
+            uint64 size() const
+            {
+                return (*m_memory)->size;
+            }
+
+            uint64 offset() const
+            {
+                return m_offset;
+            }
+
+            void seek(uint64 distance, SeekMode mode)
+            {
+                switch (mode)
+                {
+                    case BEGIN:
+                        m_offset = distance;
+                        break;
+
+                    case CURRENT:
+                        m_offset += distance;
+                        break;
+
+                    case END:
+                        m_offset = (*m_memory)->size - distance;
+                        break;
+
+                    default:
+                        MANGO_EXCEPTION("VirtualMemoryStream: Invalid seek mode.");
+                }
+            }
+
+            void read(void* dest, size_t size)
+            {
+                const uint64 total = (*m_memory)->size;
+                const uint64 left = m_offset < total ? total - m_offset : 0;
+                if (left < size)
+                {
+                    MANGO_EXCEPTION("VirtualMemoryStream: Reading past end of stream.");
+                }
+                std::memcpy(dest, (*m_memory)->address + m_offset, size);
+                m_offset += size;
+            }
+
+            void write(const void* data, size_t size)
+            {
+                MANGO_UNREFERENCED_PARAMETER(data);
+                MANGO_UNREFERENCED_PARAMETER(size);
+                MANGO_EXCEPTION("VirtualMemoryStream: Cannot write() in read-only stream.");
+            }
+        };
+
+    } // namespace
+
+    Stream* AbstractMapper::open(const std::string& filename)
+    {
+        return new VirtualMemoryStream(mmap(filename));
+    }
+
 	// -----------------------------------------------------------------
 	// misc
 	// -----------------------------------------------------------------
@@ -79,6 +172,25 @@ namespace mango
 		return false;
 	}
 
+	static std::mutex g_index_cache_mutex;
+	static std::string g_index_cache;
+
+	void Mapper::setIndexCache(const std::string& folder)
+	{
+		std::lock_guard<std::mutex> lock(g_index_cache_mutex);
+		g_index_cache = folder;
+		if (!folder.empty() && folder.back() != '/')
+		{
+			g_index_cache += "/";
+		}
+	}
+
+	std::string Mapper::getIndexCache()
+	{
+		std::lock_guard<std::mutex> lock(g_index_cache_mutex);
+		return g_index_cache;
+	}
+
 	// -----------------------------------------------------------------
 	// FileInfo
 	// -----------------------------------------------------------------
@@ -187,6 +299,376 @@ namespace mango
         return m_mapper;
     }
 
+    // -----------------------------------------------------------------
+    // FileTree
+    // -----------------------------------------------------------------
+
+    static inline uint32 hashName(const char* name, uint32 length)
+    {
+        // FNV-1a
+        uint32 hash = 2166136261u;
+        for (uint32 i = 0; i < length; ++i)
+        {
+            hash = (hash ^ uint8(name[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    FileTree::FileTree()
+    {
+        Node root;
+        root.offset = 0;
+        root.length = 0;
+        root.hash = 0;
+        root.parent = NONE;
+        root.child = NONE;
+        root.sibling = NONE;
+        root.flags = FileInfo::DIRECTORY;
+        root.data = NONE;
+        root.size = 0;
+        m_nodes.push_back(root);
+        m_table.resize(1024, NONE);
+    }
+
+    FileTree::~FileTree()
+    {
+    }
+
+    uint32 FileTree::slot(const char* name, uint32 length, uint32 hash) const
+    {
+        // linear probing; the table is never more than half full
+        const uint32 mask = uint32(m_table.size() - 1);
+        uint32 i = hash & mask;
+
+        for (;;)
+        {
+            const uint32 index = m_table[i];
+            if (index == NONE)
+                break;
+
+            const Node& node = m_nodes[index];
+            if (node.hash == hash && node.length == length && !std::memcmp(m_names.data() + node.offset, name, length))
+                break;
+
+            i = (i + 1) & mask;
+        }
+
+        return i;
+    }
+
+    uint32 FileTree::lookup(const char* name, uint32 length) const
+    {
+        if (!length)
+            return 0;
+
+        return m_table[slot(name, length, hashName(name, length))];
+    }
+
+    uint32 FileTree::create(const char* name, uint32 length)
+    {
+        if (!length)
+            return 0;
+
+        const uint32 hash = hashName(name, length);
+        uint32 index = m_table[slot(name, length, hash)];
+        if (index != NONE)
+            return index;
+
+        // the parent folders are created first
+        uint32 separator = length;
+        while (separator > 0 && name[separator - 1] != '/')
+        {
+            --separator;
+        }
+
+        const uint32 parent = separator > 1 ? create(name, separator - 1) : 0;
+
+        Node node;
+        node.offset = uint32(m_names.length());
+        node.length = length;
+        node.hash = hash;
+        node.parent = parent;
+        node.child = NONE;
+        node.sibling = m_nodes[parent].child;
+        node.flags = FileInfo::DIRECTORY;
+        node.data = NONE;
+        node.size = 0;
+
+        index = uint32(m_nodes.size());
+        m_names.append(name, length);
+        m_nodes.push_back(node);
+        m_nodes[parent].child = index;
+
+        if (m_nodes.size() * 2 > m_table.size())
+        {
+            // rehash into a table twice the size
+            std::vector<uint32> table(m_table.size() * 2, NONE);
+            std::swap(m_table, table);
+
+            for (uint32 i = 1; i < uint32(m_nodes.size()); ++i)
+            {
+                const Node& current = m_nodes[i];
+                m_table[slot(m_names.data() + current.offset, current.length, current.hash)] = i;
+            }
+        }
+        else
+        {
+            // creating the parents may have taken the slot we probed first
+            m_table[slot(name, length, hash)] = index;
+        }
+
+        return index;
+    }
+
+    void FileTree::insert(const std::string& name, uint64 size, uint32 flags, uint32 data)
+    {
+        const uint32 index = create(name.c_str(), uint32(name.length()));
+        if (index)
+        {
+            Node& node = m_nodes[index];
+            node.flags = flags;
+            node.data = data;
+            node.size = size;
+        }
+    }
+
+    const FileTree::Node* FileTree::find(const std::string& name) const
+    {
+        const uint32 index = lookup(name.c_str(), uint32(name.length()));
+        return index != NONE ? &m_nodes[index] : nullptr;
+    }
+
+    void FileTree::save(Stream& stream) const
+    {
+        LittleEndianStream s(stream);
+
+        s.write32(uint32(m_nodes.size()));
+        s.write32(uint32(m_table.size()));
+        s.write32(uint32(m_names.length()));
+        s.write32(uint32(sizeof(Node)));
+
+        stream.write(m_nodes.data(), m_nodes.size() * sizeof(Node));
+        stream.write(m_table.data(), m_table.size() * sizeof(uint32));
+        stream.write(m_names.data(), m_names.length());
+    }
+
+    size_t FileTree::load(Memory memory)
+    {
+        if (memory.size < 16)
+            return 0;
+
+        LittleEndianPointer p = memory.address;
+        const uint32 nodes = p.read32();
+        const uint32 table = p.read32();
+        const uint32 names = p.read32();
+        const uint32 node_size = p.read32();
+
+        const uint64 size = 16 + uint64(nodes) * sizeof(Node) + uint64(table) * sizeof(uint32) + names;
+
+        if (!nodes || node_size != sizeof(Node) || size > memory.size)
+            return 0;
+
+        if (table < 1024 || !u32_is_power_of_two(table) || uint64(nodes) * 2 > table)
+            return 0;
+
+        const uint8* data = memory.address + 16;
+        m_nodes.resize(nodes);
+        std::memcpy(m_nodes.data(), data, nodes * sizeof(Node));
+        data += nodes * sizeof(Node);
+
+        m_table.resize(table);
+        std::memcpy(m_table.data(), data, table * sizeof(uint32));
+        data += table * sizeof(uint32);
+
+        m_names.assign(reinterpret_cast<const char*>(data), names);
+
+        return size_t(size);
+    }
+
+    void FileTree::index(FileIndex& index, const std::string& pathname) const
+    {
+        size_t length = pathname.length();
+        if (length && pathname[length - 1] == '/')
+        {
+            --length;
+        }
+
+        const uint32 folder = lookup(pathname.c_str(), uint32(length));
+        if (folder == NONE || !(m_nodes[folder].flags & FileInfo::DIRECTORY))
+            return;
+
+        std::vector<std::string> names;
+        std::vector<const Node*> children;
+
+        for (uint32 i = m_nodes[folder].child; i != NONE; i = m_nodes[i].sibling)
+        {
+            const Node& node = m_nodes[i];
+            const uint32 start = folder ? m_nodes[folder].length + 1 : 0;
+            names.emplace_back(m_names, node.offset + start, node.length - start);
+            children.push_back(&node);
+        }
+
+        // the children are linked in reverse order; list them sorted by name
+        std::vector<size_t> order(children.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+
+        std::sort(order.begin(), order.end(), [&names] (size_t a, size_t b)
+        {
+            return names[a] < names[b];
+        });
+
+        for (size_t i : order)
+        {
+            const Node& node = *children[i];
+            if (node.flags & FileInfo::DIRECTORY)
+            {
+                emplace(index, names[i] + "/", 0, FileInfo::DIRECTORY);
+            }
+            else
+            {
+                emplace(index, names[i], node.size, node.flags);
+            }
+        }
+    }
+
+    // -----------------------------------------------------------------
+    // EntryCache
+    // -----------------------------------------------------------------
+
+    namespace
+    {
+
+        // handle to a cached entry; keeps the decompressed memory alive after eviction
+        class SharedVirtualMemory : public VirtualMemory
+        {
+        protected:
+            std::shared_ptr<VirtualMemory> m_shared;
+
+        public:
+            SharedVirtualMemory(const std::shared_ptr<VirtualMemory>& shared)
+                : m_shared(shared)
+            {
+                memory = *m_shared;
+            }
+
+            ~SharedVirtualMemory()
+            {
+            }
+        };
+
+    } // namespace
+
+    EntryCache::EntryCache(size_t budget)
+        : m_budget(budget)
+    {
+        std::memset(&m_statistics, 0, sizeof(m_statistics));
+    }
+
+    EntryCache::~EntryCache()
+    {
+    }
+
+    void EntryCache::evict(size_t budget)
+    {
+        while (m_statistics.bytes > budget && !m_entries.empty())
+        {
+            Entry& entry = m_entries.back();
+            const Memory& memory = *entry.memory;
+
+            m_statistics.bytes -= memory.size;
+            --m_statistics.entries;
+            ++m_statistics.evictions;
+
+            m_lookup.erase(std::make_pair(entry.archive, entry.offset));
+            m_entries.pop_back();
+        }
+    }
+
+    VirtualMemory* EntryCache::mmap(uint64 archive, uint64 offset, const std::function<VirtualMemory* ()>& load)
+    {
+        const auto key = std::make_pair(archive, offset);
+
+        bool enabled;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            enabled = m_budget > 0;
+            if (enabled)
+            {
+                auto i = m_lookup.find(key);
+                if (i != m_lookup.end())
+                {
+                    ++m_statistics.hits;
+                    m_entries.splice(m_entries.begin(), m_entries, i->second);
+                    return new SharedVirtualMemory(i->second->memory);
+                }
+
+                ++m_statistics.misses;
+            }
+        }
+
+        if (!enabled)
+            return load();
+
+        // decompress without holding the lock; a concurrent miss on the same entry loads it again
+        std::shared_ptr<VirtualMemory> shared(load());
+        const Memory& memory = *shared;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (memory.size <= m_budget && m_lookup.find(key) == m_lookup.end())
+        {
+            Entry entry;
+            entry.archive = archive;
+            entry.offset = offset;
+            entry.memory = shared;
+
+            m_entries.push_front(entry);
+            m_lookup[key] = m_entries.begin();
+            m_statistics.bytes += memory.size;
+            ++m_statistics.entries;
+
+            evict(m_budget);
+        }
+
+        return new SharedVirtualMemory(shared);
+    }
+
+    void EntryCache::setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = bytes;
+        evict(m_budget);
+    }
+
+    size_t EntryCache::getBudget() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_budget;
+    }
+
+    EntryCache::Statistics EntryCache::getStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_statistics;
+    }
+
+    void EntryCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        evict(0);
+    }
+
+    EntryCache& getEntryCache()
+    {
+        static EntryCache cache;
+        return cache;
+    }
+
 	void emplace(FileIndex &index, const std::string &name, uint64 size, uint32 flags)
 	{
 		index.emplace_back(name, size, flags);
@@ -2,89 +2,764 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2016 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
-#include <map>
+#include <cstring>
+#include <algorithm>
 #include <mango/core/pointer.hpp>
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/compress.hpp>
+#include <mango/core/thread.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
+#include <mango/filesystem/archive.hpp>
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
 
 #include "../../external/lz4/lz4.h"
+#include "../../external/zstd/zstd.h"
+#include "../../external/zstd/common/xxhash.h"
 
 #define ID ".mgx mapper: "
 
-#if 0
+/*
+    The archive layout, all values are little endian:
+
+        ArchiveHeader      at the start of the archive
+        file data          the blocks; uncompressed files start at a page boundary
+        Directory          DirectoryHeader, FileRecord[files], BlockRecord[blocks], names
+        ArchiveTrailer     at the end of the archive
 
-// TODO
+    The trailer locates the directory and carries its hash. Every block has
+    the XXH32 of its stored bytes, which is verified before decoding.
+*/
 
 namespace
 {
 
     using namespace mango;
 
-	struct Block
-	{
-		uint64 offset;
-		uint64 size;
-	};
-
-	struct Archive
-	{
-		uint32 signature;
-		uint32 version;
-		Block directory;
-	};
-
-	struct Directory
-	{
-		uint32 signature;
-	};
-
-	struct FileHeader
-	{
-		Block compressed;
-		uint64 uncompressed;
-		uint32 checksum;
-		uint32 compression;
-		uint32 filenameSize;
-	};
+    enum : uint32
+    {
+        ARCHIVE_SIGNATURE = 0x3158474d,   // "MGX1"
+        DIRECTORY_SIGNATURE = 0x4458474d, // "MGXD"
+        ARCHIVE_VERSION = 1,
+        PAGE_SIZE = 4096,
+        MIN_BLOCK_SIZE = 4 * 1024,
+        MAX_BLOCK_SIZE = 64 * 1024 * 1024,
+    };
+
+    enum : uint32
+    {
+        FILE_CONTIGUOUS = 0x01, // all blocks are stored uncompressed back to back
+    };
+
+    struct ArchiveHeader
+    {
+        enum { SIZE = 16 };
+
+        uint32 signature;
+        uint32 version;
+        uint64 reserved;
+    };
+
+    struct ArchiveTrailer
+    {
+        enum { SIZE = 32 };
+
+        uint64 offset; // directory
+        uint64 size;
+        uint64 hash;   // XXH64 of the directory
+        uint32 version;
+        uint32 signature;
+
+        ArchiveTrailer(Memory memory)
+        {
+            LittleEndianPointer p = memory.address + memory.size - SIZE;
+            offset = p.read64();
+            size = p.read64();
+            hash = p.read64();
+            version = p.read32();
+            signature = p.read32();
+        }
+    };
+
+    struct DirectoryHeader
+    {
+        enum { SIZE = 20 };
+
+        uint32 signature;
+        uint32 file_count;
+        uint32 block_count;
+        uint32 names_size;
+        uint32 block_size; // uncompressed size of the blocks, except the last block of each file
+    };
+
+    struct FileRecord
+    {
+        enum { SIZE = 40 };
+
+        uint64 size;
+        uint64 offset; // first block
+        uint32 block;  // index of the first block
+        uint32 blocks;
+        uint32 flags;
+        uint32 name_offset;
+        uint32 name_length;
+        uint32 reserved;
+    };
+
+    struct BlockRecord
+    {
+        enum { SIZE = 24 };
+
+        uint64 offset;
+        uint32 compressed;
+        uint32 uncompressed;
+        uint32 method; // ArchiveWriter::Compression
+        uint32 checksum;
+    };
+
+    class VirtualMemoryPointer : public VirtualMemory
+    {
+    public:
+        VirtualMemoryPointer(uint8* address, size_t size)
+        {
+            memory = Memory(address, size);
+        }
+
+        ~VirtualMemoryPointer()
+        {
+        }
+    };
+
+    class VirtualMemoryBuffer : public VirtualMemory
+    {
+    public:
+        VirtualMemoryBuffer(uint8* address, size_t size)
+        {
+            memory = Memory(address, size);
+        }
+
+        ~VirtualMemoryBuffer()
+        {
+            delete [] memory.address;
+        }
+    };
+
+    // The archive is untrusted input so the blocks are verified and decoded
+    // with the bounds checking decoders.
+
+    void decodeBlock(uint8* dest, const uint8* source, const BlockRecord& block)
+    {
+        if (XXH32(source, block.compressed, 0) != block.checksum)
+        {
+            MANGO_EXCEPTION(ID"Block checksum mismatch.");
+        }
+
+        switch (block.method)
+        {
+            case ArchiveWriter::STORE:
+            {
+                if (block.compressed != block.uncompressed)
+                {
+                    MANGO_EXCEPTION(ID"Incorrect block size.");
+                }
+                std::memcpy(dest, source, block.uncompressed);
+                break;
+            }
+
+            case ArchiveWriter::LZ4:
+            {
+                const int status = LZ4_decompress_safe(reinterpret_cast<const char*>(source),
+                                                       reinterpret_cast<char*>(dest),
+                                                       int(block.compressed), int(block.uncompressed));
+                if (status != int(block.uncompressed))
+                {
+                    MANGO_EXCEPTION(ID"lz4 block decompression failed.");
+                }
+                break;
+            }
+
+            case ArchiveWriter::ZSTD:
+            {
+                const size_t status = ZSTD_decompress(dest, block.uncompressed, source, block.compressed);
+                if (ZSTD_isError(status) || status != block.uncompressed)
+                {
+                    MANGO_EXCEPTION(ID"zstd block decompression failed.");
+                }
+                break;
+            }
+
+            default:
+                MANGO_EXCEPTION(ID"Unsupported compression method.");
+        }
+    }
 
 } // namespace
 
 namespace mango
 {
 
+    // -----------------------------------------------------------------
+    // MgxStream
+    // -----------------------------------------------------------------
+
+    // Decodes one block at a time; seeking selects the block.
+
+    class MgxStream : public Stream
+    {
+    protected:
+        const uint8* m_start;
+        FileRecord m_file;
+        const BlockRecord* m_blocks;
+        uint32 m_block_size;
+        std::unique_ptr<uint8[]> m_buffer;
+        uint32 m_current; // decoded block
+        uint64 m_offset;
+
+    public:
+        MgxStream(const uint8* start, const FileRecord& file, const BlockRecord* blocks, uint32 blockSize)
+            : m_start(start)
+            , m_file(file)
+            , m_blocks(blocks + file.block)
+            , m_block_size(blockSize)
+            , m_buffer(new uint8[blockSize])
+            , m_current(FileTree::NONE)
+            , m_offset(0)
+        {
+        }
+
+        ~MgxStream()
+        {
+        }
+
+        uint64 size() const
+        {
+            return m_file.size;
+        }
+
+        uint64 offset() const
+        {
+            return m_offset;
+        }
+
+        void seek(uint64 distance, SeekMode mode)
+        {
+            switch (mode)
+            {
+                case BEGIN:
+                    m_offset = distance;
+                    break;
+
+                case CURRENT:
+                    m_offset += distance;
+                    break;
+
+                case END:
+                    m_offset = m_file.size - distance;
+                    break;
+
+                default:
+                    MANGO_EXCEPTION(ID"Invalid seek mode.");
+            }
+        }
+
+        void read(void* dest, size_t size)
+        {
+            if (m_offset > m_file.size || m_file.size - m_offset < size)
+            {
+                MANGO_EXCEPTION(ID"Reading past end of stream.");
+            }
+
+            uint8* output = reinterpret_cast<uint8*>(dest);
+
+            while (size)
+            {
+                const uint32 index = uint32(m_offset / m_block_size);
+                const BlockRecord& block = m_blocks[index];
+
+                if (index != m_current)
+                {
+                    decodeBlock(m_buffer.get(), m_start + block.offset, block);
+                    m_current = index;
+                }
+
+                const size_t position = size_t(m_offset - uint64(index) * m_block_size);
+                const size_t bytes = std::min(size, size_t(block.uncompressed - position));
+                std::memcpy(output, m_buffer.get() + position, bytes);
+
+                output += bytes;
+                size -= bytes;
+                m_offset += bytes;
+            }
+        }
+
+        void write(const void* data, size_t size)
+        {
+            MANGO_UNREFERENCED_PARAMETER(data);
+            MANGO_UNREFERENCED_PARAMETER(size);
+            MANGO_EXCEPTION(ID"Cannot write() in read-only stream.");
+        }
+    };
+
     // -----------------------------------------------------------------
     // MapperMGX
     // -----------------------------------------------------------------
 
-    class MapperMGX : public Mapper
+    class MapperMGX : public AbstractMapper
     {
     public:
+        Memory m_parent_memory;
+        std::vector<FileRecord> m_files;
+        std::vector<BlockRecord> m_blocks;
+        uint32 m_block_size;
+        FileTree m_tree;
+        uint64 m_archive; // hash of the directory
+
+        MapperMGX(Memory parent, const std::string& password)
+            : m_parent_memory(parent)
+            , m_block_size(0)
+            , m_archive(0)
+        {
+            MANGO_UNREFERENCED_PARAMETER(password);
+
+            if (parent.address)
+            {
+                parse(parent);
+            }
+        }
+
+        ~MapperMGX()
+        {
+        }
+
+        void parse(Memory parent)
+        {
+            if (parent.size < ArchiveHeader::SIZE + ArchiveTrailer::SIZE)
+            {
+                MANGO_EXCEPTION(ID"Incorrect archive size.");
+            }
+
+            LittleEndianPointer h = parent.address;
+            const uint32 signature = h.read32();
+            const uint32 version = h.read32();
+            if (signature != ARCHIVE_SIGNATURE || version != ARCHIVE_VERSION)
+            {
+                MANGO_EXCEPTION(ID"Incorrect archive signature.");
+            }
+
+            ArchiveTrailer trailer(parent);
+            if (trailer.signature != ARCHIVE_SIGNATURE || trailer.version != ARCHIVE_VERSION)
+            {
+                MANGO_EXCEPTION(ID"Incorrect archive trailer.");
+            }
+
+            const uint64 end = parent.size - ArchiveTrailer::SIZE;
+            if (trailer.offset > end || trailer.size > end - trailer.offset || trailer.size < DirectoryHeader::SIZE)
+            {
+                MANGO_EXCEPTION(ID"Incorrect directory location.");
+            }
+
+            uint8* directory = parent.address + trailer.offset;
+            const size_t size = size_t(trailer.size);
+
+            if (XXH64(directory, size, 0) != trailer.hash)
+            {
+                MANGO_EXCEPTION(ID"Directory checksum mismatch.");
+            }
+
+            // the directory covers the block checksums, so it identifies the contents for the entry cache
+            m_archive = trailer.hash;
+
+            LittleEndianPointer p = directory;
+
+            DirectoryHeader header;
+            header.signature = p.read32();
+            header.file_count = p.read32();
+            header.block_count = p.read32();
+            header.names_size = p.read32();
+            header.block_size = p.read32();
+
+            const uint64 required = DirectoryHeader::SIZE +
+                uint64(header.file_count) * FileRecord::SIZE +
+                uint64(header.block_count) * BlockRecord::SIZE + header.names_size;
+
+            // the streams allocate a block sized buffer; accept only what the writer produces
+            if (header.signature != DIRECTORY_SIGNATURE || required > size ||
+                header.block_size < MIN_BLOCK_SIZE || header.block_size > MAX_BLOCK_SIZE)
+            {
+                MANGO_EXCEPTION(ID"Incorrect directory.");
+            }
+
+            m_block_size = header.block_size;
+
+            m_files.resize(header.file_count);
+            for (FileRecord& file : m_files)
+            {
+                file.size = p.read64();
+                file.offset = p.read64();
+                file.block = p.read32();
+                file.blocks = p.read32();
+                file.flags = p.read32();
+                file.name_offset = p.read32();
+                file.name_length = p.read32();
+                file.reserved = p.read32();
+            }
+
+            m_blocks.resize(header.block_count);
+            for (BlockRecord& block : m_blocks)
+            {
+                block.offset = p.read64();
+                block.compressed = p.read32();
+                block.uncompressed = p.read32();
+                block.method = p.read32();
+                block.checksum = p.read32();
+
+                if (block.offset > end || block.compressed > end - block.offset || block.uncompressed > m_block_size)
+                {
+                    MANGO_EXCEPTION(ID"Incorrect block.");
+                }
+            }
+
+            const char* names = reinterpret_cast<const char*>(static_cast<uint8*>(p));
+
+            for (uint32 i = 0; i < header.file_count; ++i)
+            {
+                const FileRecord& file = m_files[i];
+
+                const uint64 blocks = (file.size + m_block_size - 1) / m_block_size;
+                if (uint64(file.name_offset) + file.name_length > header.names_size || !file.name_length ||
+                    file.blocks != blocks || uint64(file.block) + file.blocks > header.block_count)
+                {
+                    MANGO_EXCEPTION(ID"Incorrect file record.");
+                }
+
+                if (file.flags & FILE_CONTIGUOUS)
+                {
+                    if (file.offset > end || file.size > end - file.offset)
+                    {
+                        MANGO_EXCEPTION(ID"Incorrect file record.");
+                    }
+                }
+
+                // the blocks are full except the last one; the streams and the decoder rely on this
+                for (uint32 j = 0; j < file.blocks; ++j)
+                {
+                    const uint64 remain = file.size - uint64(j) * m_block_size;
+                    if (m_blocks[file.block + j].uncompressed != std::min(remain, uint64(m_block_size)))
+                    {
+                        MANGO_EXCEPTION(ID"Incorrect block size.");
+                    }
+                }
+
+                const std::string filename(names + file.name_offset, file.name_length);
+                const uint32 flags = (file.flags & FILE_CONTIGUOUS) ? 0 : FileInfo::COMPRESSED;
+                m_tree.insert(filename, file.size, flags, i);
+            }
+        }
+
+        const FileRecord& getFile(const std::string& filename) const
+        {
+            const FileTree::Node* node = m_tree.find(filename);
+            if (!node || node->data == FileTree::NONE)
+            {
+                MANGO_EXCEPTION(ID"File not found.");
+            }
+
+            return m_files[node->data];
+        }
+
+        VirtualMemory* decode(const FileRecord& file) const
+        {
+            // NOTE: decoding limited on 32 bit platforms
+            const size_t size = size_t(file.size);
+            std::unique_ptr<uint8[]> buffer(new uint8[size]);
+
+            uint8* output = buffer.get();
+            const BlockRecord* blocks = m_blocks.data() + file.block;
+
+            // the blocks are independent; decode them on the thread pool
+            ConcurrentQueue queue("mgx");
+            parallel_for(queue, 0, int(file.blocks), 1, [=] (int begin, int end)
+            {
+                for (int i = begin; i < end; ++i)
+                {
+                    decodeBlock(output + uint64(i) * m_block_size, m_parent_memory.address + blocks[i].offset, blocks[i]);
+                }
+            });
+
+            return new VirtualMemoryBuffer(buffer.release(), size);
+        }
 
         bool isfile(const std::string& filename) const
         {
+            const FileTree::Node* node = m_tree.find(filename);
+
+            if (node)
+            {
+                // file does exist; check if it is a folder
+                return (node->flags & FileInfo::DIRECTORY) == 0;
+            }
+
+            return false;
         }
 
         void index(FileIndex& index, const std::string& pathname)
         {
+            m_tree.index(index, pathname);
         }
 
         VirtualMemory* mmap(const std::string& filename)
         {
+            const FileRecord& file = getFile(filename);
+
+            if (file.flags & FILE_CONTIGUOUS)
+            {
+                // zero copy; the pages are read when touched
+                uint8* address = m_parent_memory.address + file.offset;
+                return new VirtualMemoryPointer(address, size_t(file.size));
+            }
+
+            return getEntryCache().mmap(m_archive, file.offset, [&] ()
+            {
+                return decode(file);
+            });
+        }
+
+        Stream* open(const std::string& filename)
+        {
+            const FileRecord& file = getFile(filename);
+
+            if (file.flags & FILE_CONTIGUOUS)
+            {
+                return AbstractMapper::open(filename);
+            }
+
+            return new MgxStream(m_parent_memory.address, file, m_blocks.data(), m_block_size);
         }
     };
 
+    // -----------------------------------------------------------------
+    // ArchiveWriter
+    // -----------------------------------------------------------------
+
+    ArchiveWriter::ArchiveWriter(const std::string& filename, uint32 blockSize)
+        : m_file(filename, Stream::WRITE)
+        , m_offset(0)
+        , m_block_size(clamp(blockSize, uint32(MIN_BLOCK_SIZE), uint32(MAX_BLOCK_SIZE)))
+        , m_file_count(0)
+        , m_block_count(0)
+        , m_closed(false)
+    {
+        LittleEndianStream s(m_file);
+        s.write32(ARCHIVE_SIGNATURE);
+        s.write32(ARCHIVE_VERSION);
+        s.write64(0);
+        m_offset = ArchiveHeader::SIZE;
+    }
+
+    ArchiveWriter::~ArchiveWriter()
+    {
+        if (!m_closed)
+        {
+            try
+            {
+                close();
+            }
+            catch (...)
+            {
+                // the archive is left without a directory
+            }
+        }
+    }
+
+    void ArchiveWriter::align(uint32 alignment)
+    {
+        const uint32 padding = uint32((alignment - m_offset % alignment) % alignment);
+        if (padding)
+        {
+            const uint8 zeros[PAGE_SIZE] = { 0 };
+            m_file.write(zeros, padding);
+            m_offset += padding;
+        }
+    }
+
+    void ArchiveWriter::addBlock(uint32 method, Memory memory, uint32 size)
+    {
+        LittleEndianStream s(m_blocks);
+        s.write64(m_offset);
+        s.write32(uint32(memory.size));
+        s.write32(size);
+        s.write32(method);
+        s.write32(XXH32(memory.address, memory.size, 0));
+
+        m_file.write(memory.address, memory.size);
+        m_offset += memory.size;
+        ++m_block_count;
+    }
+
+    void ArchiveWriter::write(const std::string& name, Memory memory, Compression compression, int level)
+    {
+        if (m_closed)
+        {
+            MANGO_EXCEPTION(ID"The archive is closed.");
+        }
+
+        const size_t start = name.find_first_not_of('/');
+        const size_t end = name.find_last_not_of('/');
+        if (start == std::string::npos)
+        {
+            MANGO_EXCEPTION(ID"Incorrect filename.");
+        }
+
+        const std::string filename = name.substr(start, end - start + 1);
+        if (!m_lookup.insert(filename).second)
+        {
+            MANGO_EXCEPTION(ID"Duplicate filename.");
+        }
+
+        const size_t blocks = (memory.size + m_block_size - 1) / m_block_size;
+
+        // compressed blocks of the file, the incompressible blocks are stored as they are
+        Buffer compressed;
+        std::vector<uint32> methods;
+        std::vector<size_t> sizes;
+
+        if (compression != STORE)
+        {
+            size_t bound = 0;
+            switch (compression)
+            {
+                case LZ4:
+                    bound = lz4::bound(m_block_size);
+                    break;
+                case ZSTD:
+                    bound = zstd::bound(m_block_size);
+                    break;
+                default:
+                    MANGO_EXCEPTION(ID"Unsupported compression method.");
+            }
+
+            std::vector<uint8> temp(bound);
+
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                const size_t offset = i * m_block_size;
+                Memory source(memory.address + offset, std::min(size_t(m_block_size), memory.size - offset));
+                Memory dest(temp.data(), bound);
+
+                const size_t bytes = compression == LZ4 ? lz4::compress(dest, source, level)
+                                                        : zstd::compress(dest, source, level);
+                if (bytes < source.size)
+                {
+                    compressed.write(temp.data(), bytes);
+                    methods.push_back(compression);
+                    sizes.push_back(bytes);
+                }
+                else
+                {
+                    compressed.write(source.address, source.size);
+                    methods.push_back(STORE);
+                    sizes.push_back(source.size);
+                }
+            }
+
+            // a file which barely compresses is more useful mapped without a copy
+            if (compressed.size() >= memory.size - memory.size / 16)
+            {
+                compression = STORE;
+            }
+        }
+
+        LittleEndianStream s(m_files);
+
+        if (compression == STORE)
+        {
+            align(PAGE_SIZE);
+
+            s.write64(memory.size);
+            s.write64(m_offset);
+            s.write32(m_block_count);
+            s.write32(uint32(blocks));
+            s.write32(FILE_CONTIGUOUS);
+
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                const size_t offset = i * m_block_size;
+                const size_t size = std::min(size_t(m_block_size), memory.size - offset);
+                addBlock(STORE, Memory(memory.address + offset, size), uint32(size));
+            }
+        }
+        else
+        {
+            s.write64(memory.size);
+            s.write64(m_offset);
+            s.write32(m_block_count);
+            s.write32(uint32(blocks));
+            s.write32(0);
+
+            const uint8* data = compressed;
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                const size_t size = std::min(size_t(m_block_size), memory.size - i * m_block_size);
+                addBlock(methods[i], Memory(const_cast<uint8*>(data), sizes[i]), uint32(size));
+                data += sizes[i];
+            }
+        }
+
+        s.write32(uint32(m_names.length()));
+        s.write32(uint32(filename.length()));
+        s.write32(0);
+
+        m_names += filename;
+        ++m_file_count;
+    }
+
+    void ArchiveWriter::close()
+    {
+        if (m_closed)
+            return;
+
+        m_closed = true;
+
+        Buffer directory;
+        LittleEndianStream s(directory);
+
+        s.write32(DIRECTORY_SIGNATURE);
+        s.write32(m_file_count);
+        s.write32(m_block_count);
+        s.write32(uint32(m_names.length()));
+        s.write32(m_block_size);
+
+        Memory files = m_files;
+        Memory blocks = m_blocks;
+        directory.write(files.address, files.size);
+        directory.write(blocks.address, blocks.size);
+        directory.write(m_names.data(), m_names.length());
+
+        Memory memory = directory;
+        m_file.write(memory.address, memory.size);
+
+        LittleEndianStream t(m_file);
+        t.write64(m_offset);
+        t.write64(memory.size);
+        t.write64(XXH64(memory.address, memory.size, 0));
+        t.write32(ARCHIVE_VERSION);
+        t.write32(ARCHIVE_SIGNATURE);
+
+        m_offset += memory.size + ArchiveTrailer::SIZE;
+    }
+
     // -----------------------------------------------------------------
     // functions
     // -----------------------------------------------------------------
 
-    Mapper* createMapperMGX(Memory parent, const std::string& password)
+    AbstractMapper* createMapperMGX(Memory parent, const std::string& password)
     {
-        Mapper* mapper = new MapperMGX(parent, password);
+        AbstractMapper* mapper = new MapperMGX(parent, password);
         return mapper;
     }
 
 } // namespace mango
 
-#endif // 0
+#endif // MANGO_ENABLE_LICENSE_BSD
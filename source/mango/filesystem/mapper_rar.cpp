@@ -5,7 +5,7 @@
 /*
     RAR decompression code: Alexander L. Roshal / unRAR library.
 */
-#include <map>
+#include <vector>
 #include <algorithm>
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
@@ -16,6 +16,7 @@
 #ifdef MANGO_ENABLE_LICENSE_GPL
 
 #include "../../external/unrar/rar.hpp"
+#include "../../external/zstd/common/xxhash.h"
 
 #define ID ".rar mapper: "
 
@@ -411,10 +412,13 @@ namespace mango
     {
     public:
         std::string m_password;
-        std::map<std::string, FileHeader> m_files;
+        std::vector<FileHeader> m_headers;
+        FileTree m_tree;
+        uint8* m_start;
+        uint64 m_archive; // hash of the file headers
 
         MapperRAR(Memory parent, const std::string& password)
-        : m_password(password)
+        : m_password(password), m_start(parent.address), m_archive(parent.size)
         {
             uint8* start = parent.address;
             uint8* end = parent.address + parent.size;
@@ -466,7 +470,19 @@ namespace mango
                             file.data = p;
 
                             // store file
-                            m_files[header.filename] = file;
+                            uint32 flags = file.folder ? FileInfo::DIRECTORY : 0;
+                            if (!file.folder && file.compressed())
+                            {
+                                flags |= FileInfo::COMPRESSED;
+                            }
+
+                            m_tree.insert(header.filename, file.unpacked_size, flags, uint32(m_headers.size()));
+                            m_headers.push_back(file);
+
+                            // the headers identify the archive for the entry cache
+                            const uint64 key[] = { uint64(p - start), file.packed_size, file.unpacked_size, file.crc };
+                            m_archive = XXH64(key, sizeof(key), m_archive);
+                            m_archive = XXH64(header.filename.data(), header.filename.length(), m_archive);
                         }
                         else
                         {
@@ -490,11 +506,11 @@ namespace mango
 
         bool isfile(const std::string& filename) const
         {
-            auto i = m_files.find(filename);
+            const FileTree::Node* node = m_tree.find(filename);
 
-            if (i != m_files.end())
+            if (node)
             {
-                return !i->second.folder;
+                return (node->flags & FileInfo::DIRECTORY) == 0;
             }
 
             return false;
@@ -502,51 +518,27 @@ namespace mango
 
         void index(FileIndex& index, const std::string& pathname)
         {
-            for (auto i : m_files)
-            {
-                FileHeader& header = i.second;
-                std::string filename = i.first;
-
-                if (header.folder)
-                {
-                    filename += "/";
-                }
-
-                if (isPrefix(filename, pathname))
-                {
-                    filename = filename.substr(pathname.length());
-                    size_t n = filename.find_first_of("/");
-
-                    if (n == std::string::npos)
-                    {
-                        uint32 flags = 0;
-                        if (header.compressed())
-                        {
-                            flags |= FileInfo::COMPRESSED;
-                        }
-                        emplace(index, filename, header.unpacked_size, flags);
-                    }
-                    else
-                    {
-                        if (n == filename.length() - 1)
-                        {
-                            emplace(index, filename, 0, FileInfo::DIRECTORY);
-                        }
-                    }
-                }
-            }
+            m_tree.index(index, pathname);
         }
 
         VirtualMemory* mmap(const std::string& filename)
         {
-            auto i = m_files.find(filename);
-            if (i == m_files.end())
+            const FileTree::Node* node = m_tree.find(filename);
+            if (!node || node->data == FileTree::NONE)
             {
                 MANGO_EXCEPTION(ID"File not found.");
             }
 
-            FileHeader& header = i->second;
-            return header.mmap();
+            FileHeader& header = m_headers[node->data];
+            if (!header.compressed())
+            {
+                return header.mmap();
+            }
+
+            return getEntryCache().mmap(m_archive, uint64(header.data - m_start), [&] ()
+            {
+                return header.mmap();
+            });
         }
     };
 
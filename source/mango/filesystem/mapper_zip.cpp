@@ -2,15 +2,22 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
-#include <map>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
 #include <mango/core/pointer.hpp>
-#include <mango/core/string.hpp>
+#include <mango/core/buffer.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
+#include <mango/filesystem/file.hpp>
 
 #define MINIZ_HEADER_FILE_ONLY
 #include "../../external/miniz/miniz.cpp"
+#include "../../external/zstd/common/xxhash.h"
 
 #define ID ".zip mapper: "
 
@@ -100,7 +107,7 @@ namespace
 		uint32	external;          // external file attributes
 		uint64	localOffset;       // relative offset of the local file header, ZIP64: 0xffffffff
 
-        std::string filename;      // filename is stored after the header
+        const char* filename;      // filename is stored after the header; not terminated
         bool        folder;        // if the last character of filename is "/", it is a folder
 
         DirFileHeader()
@@ -134,7 +141,7 @@ namespace
                 const char* s = reinterpret_cast<const char*>(us);
                 p += filenameLen;
 
-                if (s[filenameLen - 1] == '/')
+                if (filenameLen && s[filenameLen - 1] == '/')
                 {
                     --filenameLen; // remove trailing '/'
                     folder = true;
@@ -144,7 +151,7 @@ namespace
                     folder = false;
                 }
 
-                filename = std::string(s, filenameLen);
+                filename = s;
 
                 // read extra fields
                 uint8* ext = p;
@@ -227,7 +234,8 @@ namespace
                         signature = 0;
                     }
 
-                    if (dirStartOffset == 0xffffffff)
+                    // any of the fields can overflow; archives with over 65535 entries are common
+                    if (dirStartOffset == 0xffffffff || dirSize == 0xffffffff || numEntriesTotal == 0xffff)
                     {
                         p = end - 20;
                         uint32 magic = p.read32();
@@ -319,7 +327,7 @@ namespace
 		}
 	}
 
-	bool zip_decrypt(uint8* out, const uint8* in, uint64 size, const uint8* dcheader, int version, uint32 crc, const std::string& password)
+	bool zip_decrypt_header(uint32* keys, const uint8* dcheader, int version, uint32 crc, const std::string& password)
 	{
 		if (password.empty())
 		{
@@ -328,7 +336,6 @@ namespace
 		}
 
 		// decryption keys
-		uint32 keys[3];
 		zip_init_keys(keys, password.c_str());
 
 		// decrypt the 12 byte encryption header
@@ -360,58 +367,10 @@ namespace
 		    //       dcheader so the check would fail above.
 		}
 
-		// read compressed data & decrypt
-		zip_decrypt_buffer(out, in, size, keys);
-
+		// the keys are now ready to decrypt the data
 		return true;
 	}
 
-	uint64 zip_decompress(uint8* compressed, uint8* uncompressed, uint64 compressedLen, uint64 uncompressedLen)
-	{
-		z_stream zstream;
-		std::memset(&zstream, 0, sizeof(zstream));
-
-		zstream.next_in  = compressed;
-		zstream.avail_in = uInt(compressedLen); // TODO: upgrade to support 64 bit files
-
-        if (inflateInit2(&zstream, -MAX_WBITS) != Z_OK)
-		{
-            MANGO_EXCEPTION(ID"InflateInit failed.");
-		}
-
-    	// decompression
-		zstream.next_out  = uncompressed;
-	    zstream.avail_out = uInt(uncompressedLen); // TODO: upgrade to support 64 bit files
-
-    	int zcode = inflate(&zstream, Z_FINISH);
-		if (zcode != Z_STREAM_END)
-        {
-            const char* msg = ID"Internal error.";
-            switch (zcode)
-            {
-                case Z_MEM_ERROR:
-                    msg = ID"Memory error.";
-                    break;
-
-                case Z_BUF_ERROR:
-                    msg = ID"Buffer error.";
-                    break;
-
-                case Z_DATA_ERROR:
-                    msg = ID"Data error.";
-                    break;
-            }
-            MANGO_EXCEPTION(msg);
-        }
-
-		if (inflateEnd(&zstream) != Z_OK)
-	    {
-            MANGO_EXCEPTION(ID"Inflate failed.");
-		}
-
-		return zstream.total_out;
-	}
-
 } // namespace
 
 namespace mango
@@ -445,71 +404,197 @@ namespace mango
     };
 
     // -----------------------------------------------------------------
-    // MapperZIP
+    // FileEntry
     // -----------------------------------------------------------------
 
-    class MapperZIP : public AbstractMapper
+    // the parts of the directory header which are needed to read the file
+
+    struct FileEntry
     {
-    public:
-        Memory m_parent_memory;
-        std::string m_password;
-        std::map<std::string, DirFileHeader> m_files;
+        uint64 compressedSize;
+        uint64 uncompressedSize;
+        uint64 localOffset;
+        uint32 crc;
+        uint16 versionUsed;
+        uint16 flags;
+        uint16 compression;
+
+        FileEntry()
+        {
+            std::memset(this, 0, sizeof(FileEntry));
+        }
 
-        MapperZIP(Memory parent, const std::string& password)
-        : m_parent_memory(parent), m_password(password)
+        FileEntry(const DirFileHeader& header)
         {
-            if (parent.address)
-            {
-                DirEndRecord record(parent);
-                if (record.status())
-                {
-                    const int numFiles = int(record.numEntriesTotal);
+            std::memset(this, 0, sizeof(FileEntry)); // the padding is written to the index cache
+            compressedSize = header.compressedSize;
+            uncompressedSize = header.uncompressedSize;
+            localOffset = header.localOffset;
+            crc = header.crc;
+            versionUsed = header.versionUsed;
+            flags = header.flags;
+            compression = header.compression;
+        }
+    };
 
-                    // read file header for each file
-                    LittleEndianPointer p = parent.address + record.dirStartOffset;
+    // -----------------------------------------------------------------
+    // IndexCacheHeader
+    // -----------------------------------------------------------------
 
-                    for (int i = 0; i < numFiles; ++i)
-                    {
-                        DirFileHeader header(p);
-                        if (header.status())
-                        {
-                            m_files[header.filename] = header;
+    // The index cache file is the header, the file entries and the tree.
+    // It is only read by the build which wrote it; the layouts are native.
 
-                            // generate missing folder entries for zip files generated with -D option
-                            std::string path = getPath(header.filename);
-                            if (!path.empty())
-                            {
-                                path = path.substr(0, path.length() - 1); // remove trailing '/'
+    struct IndexCacheHeader
+    {
+        uint32 magic;
+        uint32 version;
+        uint64 archive_size;
+        uint64 dir_offset;
+        uint64 dir_size;
+        uint64 dir_hash;  // seeded with the archive size
+        uint32 entry_size;
+        uint32 entry_count;
+        uint64 data_hash; // everything after the header
+    };
 
-                                DirFileHeader temp;
-                                temp.filename = path;
-                                temp.folder = true;
+    // -----------------------------------------------------------------
+    // ZipDecryptPipeline
+    // -----------------------------------------------------------------
 
-                                m_files[path] = temp;
-                            }
-                        }
-                    }
+    // Decrypts on a second thread a few windows ahead of inflate; ZipCrypto is
+    // byte serial and takes about as long as inflating the same data.
+
+    class ZipDecryptPipeline : private NonCopyable
+    {
+    protected:
+        enum { COUNT = 4, WINDOW = 256 * 1024 };
+
+        const uint8* m_input;
+        uint64 m_input_left;
+        uint32 m_keys[3];
+
+        std::vector<uint8> m_buffers[COUNT];
+        size_t m_sizes[COUNT];
+        uint64 m_produced; // windows decrypted
+        uint64 m_consumed; // windows released by next()
+        bool m_holding;
+        bool m_stop;
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::thread m_thread;
+
+        void produce()
+        {
+            while (m_input_left)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_condition.wait(lock, [this] { return m_stop || m_produced - m_consumed < COUNT; });
+                    if (m_stop)
+                        return;
                 }
+
+                const size_t index = size_t(m_produced % COUNT);
+                const size_t bytes = size_t(std::min(m_input_left, uint64(WINDOW)));
+                zip_decrypt_buffer(m_buffers[index].data(), m_input, bytes, m_keys);
+                m_input += bytes;
+                m_input_left -= bytes;
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_sizes[index] = bytes;
+                ++m_produced;
+                m_condition.notify_all();
             }
         }
 
-        ~MapperZIP()
+    public:
+        ZipDecryptPipeline(const uint8* input, uint64 size, const uint32* keys)
+            : m_input(input)
+            , m_input_left(size)
+            , m_produced(0)
+            , m_consumed(0)
+            , m_holding(false)
+            , m_stop(false)
+        {
+            std::memcpy(m_keys, keys, sizeof(m_keys));
+
+            for (auto& buffer : m_buffers)
+            {
+                buffer.resize(WINDOW);
+            }
+
+            m_thread = std::thread([this] { produce(); });
+        }
+
+        ~ZipDecryptPipeline()
         {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+                m_condition.notify_all();
+            }
+
+            m_thread.join();
         }
 
-        VirtualMemory* mmap(const DirFileHeader& header, uint8* start, const std::string& password)
+        // next decrypted window; valid until the following call
+        Memory next()
         {
-            bool encrypted = (header.flags & 1) != 0;
-            bool compressed = false;
+            std::unique_lock<std::mutex> lock(m_mutex);
 
+            if (m_holding)
+            {
+                ++m_consumed;
+                m_holding = false;
+                m_condition.notify_all();
+            }
+
+            m_condition.wait(lock, [this] { return m_produced > m_consumed; });
+            m_holding = true;
+
+            const size_t index = size_t(m_consumed % COUNT);
+            return Memory(m_buffers[index].data(), m_sizes[index]);
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // ZipDecoder
+    // -----------------------------------------------------------------
+
+    /* Decodes an entry in pieces of any size. Encrypted input is decrypted a
+       window at a time just ahead of inflate, so the payload is never copied
+       as a whole, and the transfers are split for zlib's 32 bit counters.
+    */
+
+    class ZipDecoder : private NonCopyable
+    {
+    protected:
+        enum { WINDOW = 64 * 1024 };
+
+        const uint8* m_input; // entry data after the encryption header
+        uint64 m_input_left;
+        uint64 m_output_left;
+        bool m_compressed;
+        bool m_encrypted;
+        uint32 m_keys[3];
+        z_stream m_stream;
+        std::vector<uint8> m_window; // decrypted input
+        std::unique_ptr<ZipDecryptPipeline> m_pipeline;
+
+    public:
+        ZipDecoder(const FileEntry& header, const uint8* start, const std::string& password)
+            : m_output_left(header.uncompressedSize)
+            , m_encrypted((header.flags & 1) != 0)
+        {
             switch (header.compression)
             {
                 case 0:
-                    compressed = false;
+                    m_compressed = false;
                     break;
 
                 case 8:
-                    compressed = true;
+                    m_compressed = true;
                     break;
 
                 default:
@@ -517,7 +602,7 @@ namespace mango
                     MANGO_EXCEPTION(ID"Unsupported compression algorithm.");
             }
 
-            LittleEndianPointer p = start + header.localOffset;
+            LittleEndianPointer p = const_cast<uint8*>(start) + header.localOffset;
 
             LocalFileHeader localHeader(p);
             if (!localHeader.status())
@@ -526,134 +611,506 @@ namespace mango
             }
 
             uint64 offset = header.localOffset + 30 + localHeader.filenameLen + localHeader.extraFieldLen;
+            m_input = start + offset;
+            m_input_left = header.compressedSize;
 
-            uint8* address = start + offset;
-            uint64 size = 0;
-
-            uint8* buffer = nullptr; // remember allocated memory
-
-            if (encrypted)
+            if (m_encrypted)
             {
-                // decryption header
-                uint8* dcheader = address;
-                address += DCKEYSIZE;
-
-                // NOTE: decryption limited on 32 bit platforms
-                const std::size_t compressed_size = static_cast<std::size_t>(header.compressedSize);
-                buffer = new uint8[compressed_size];
-
-                bool status = zip_decrypt(buffer, address, header.compressedSize, dcheader,
-                                          header.versionUsed & 0xff, header.crc, password);
-                if (!status)
+                if (m_input_left < DCKEYSIZE || !zip_decrypt_header(m_keys, m_input, header.versionUsed & 0xff, header.crc, password))
                 {
-                    delete[] buffer;
                     MANGO_EXCEPTION(ID"Decryption failed (probably incorrect password).");
                 }
 
-                address = buffer;
+                // the compressed size includes the decryption header
+                m_input += DCKEYSIZE;
+                m_input_left -= DCKEYSIZE;
+                m_window.resize(WINDOW);
             }
 
-            if (compressed)
+            if (!m_compressed && m_input_left < m_output_left)
             {
-                // NOTE: decompression limited on 32 bit platforms
-                const std::size_t uncompressed_size = static_cast<std::size_t>(header.uncompressedSize);
-                uint8* uncompressed_buffer = new uint8[uncompressed_size];
-
-                uint64 outsize = zip_decompress(address, uncompressed_buffer, header.compressedSize, header.uncompressedSize);
+                MANGO_EXCEPTION(ID"Incorrect stored size.");
+            }
 
-                delete[] buffer;
-                buffer = uncompressed_buffer;
+            std::memset(&m_stream, 0, sizeof(m_stream));
 
-                if (outsize != header.uncompressedSize)
-                {
-                    // incorrect output size
-                    delete[] buffer;
-                    MANGO_EXCEPTION(ID"Incorrect decompressed size.");
-                }
+            if (m_compressed && inflateInit2(&m_stream, -MAX_WBITS) != Z_OK)
+            {
+                MANGO_EXCEPTION(ID"InflateInit failed.");
+            }
 
-                // use decode_buffer as memory map
-                address = buffer;
-                size = header.uncompressedSize;
+            // large entries overlap the decryption with inflate when there is a core to spare
+            if (m_encrypted && m_compressed && m_input_left >= 1024 * 1024 && std::thread::hardware_concurrency() > 1)
+            {
+                m_pipeline.reset(new ZipDecryptPipeline(m_input, m_input_left, m_keys));
             }
-            else
+        }
+
+        ~ZipDecoder()
+        {
+            if (m_compressed)
             {
-                size = header.uncompressedSize;
+                inflateEnd(&m_stream);
             }
+        }
 
-            VirtualMemory* memory;
+        // next input byte; for stored entries this is where the data is
+        const uint8* input() const
+        {
+            return m_input;
+        }
+
+        // returns less than size only at the end of the entry
+        size_t read(uint8* dest, size_t size)
+        {
+            size = size_t(std::min(uint64(size), m_output_left));
 
-            if (buffer)
+            if (!m_compressed)
             {
-                memory = new VirtualMemoryBuffer(buffer, static_cast<size_t>(size));
+                if (m_encrypted)
+                    zip_decrypt_buffer(dest, m_input, size, m_keys);
+                else
+                    std::memcpy(dest, m_input, size);
+
+                m_input += size;
+                m_input_left -= size;
+                m_output_left -= size;
+                return size;
             }
-            else
+
+            size_t total = 0;
+
+            while (total < size)
             {
-                memory = new VirtualMemoryPointer(address, static_cast<size_t>(size));
+                if (!m_stream.avail_in && m_input_left)
+                {
+                    uint64 bytes = std::min(m_input_left, uint64(0x40000000));
+                    if (m_pipeline)
+                    {
+                        Memory window = m_pipeline->next();
+                        bytes = window.size;
+                        m_stream.next_in = window.address;
+                    }
+                    else if (m_encrypted)
+                    {
+                        bytes = std::min(bytes, uint64(WINDOW));
+                        zip_decrypt_buffer(m_window.data(), m_input, bytes, m_keys);
+                        m_stream.next_in = m_window.data();
+                    }
+                    else
+                    {
+                        m_stream.next_in = const_cast<uint8*>(m_input);
+                    }
+
+                    m_stream.avail_in = uInt(bytes);
+                    m_input += bytes;
+                    m_input_left -= bytes;
+                }
+
+                const size_t request = std::min(size - total, size_t(0x40000000));
+                m_stream.next_out = dest + total;
+                m_stream.avail_out = uInt(request);
+
+                int zcode = inflate(&m_stream, Z_NO_FLUSH);
+                total += request - m_stream.avail_out;
+
+                if (zcode == Z_STREAM_END)
+                    break;
+
+                if (zcode != Z_OK)
+                {
+                    const char* msg = ID"Internal error.";
+                    switch (zcode)
+                    {
+                        case Z_MEM_ERROR:
+                            msg = ID"Memory error.";
+                            break;
+
+                        case Z_BUF_ERROR:
+                            msg = ID"Buffer error.";
+                            break;
+
+                        case Z_DATA_ERROR:
+                            msg = ID"Data error.";
+                            break;
+                    }
+                    MANGO_EXCEPTION(msg);
+                }
             }
 
-            return memory;
+            m_output_left -= total;
+            return total;
         }
+    };
 
-        bool isfile(const std::string& filename) const
+    // -----------------------------------------------------------------
+    // ZipStream
+    // -----------------------------------------------------------------
+
+    // Sequential reads decode on demand; seeking backwards restarts the decoder.
+
+    class ZipStream : public Stream
+    {
+    protected:
+        FileEntry m_header;
+        const uint8* m_start;
+        std::string m_password;
+        std::unique_ptr<ZipDecoder> m_decoder;
+        uint64 m_offset;   // requested position
+        uint64 m_decoded;  // position of the decoder
+
+    public:
+        ZipStream(const FileEntry& header, const uint8* start, const std::string& password)
+            : m_header(header)
+            , m_start(start)
+            , m_password(password)
+            , m_decoder(new ZipDecoder(header, start, password))
+            , m_offset(0)
+            , m_decoded(0)
+        {
+        }
+
+        ~ZipStream()
         {
-            auto i = m_files.find(filename);
+        }
+
+        uint64 size() const
+        {
+            return m_header.uncompressedSize;
+        }
+
+        uint64 offset() const
+        {
+            return m_offset;
+        }
 
-            if (i != m_files.end())
+        void seek(uint64 distance, SeekMode mode)
+        {
+            switch (mode)
             {
-                // file does exist; check if it is a folder
-                return !i->second.folder;
-            }
+                case BEGIN:
+                    m_offset = distance;
+                    break;
 
-            return false;
+                case CURRENT:
+                    m_offset += distance;
+                    break;
+
+                case END:
+                    m_offset = m_header.uncompressedSize - distance;
+                    break;
+
+                default:
+                    MANGO_EXCEPTION(ID"Invalid seek mode.");
+            }
         }
 
-        void index(FileIndex& index, const std::string& pathname)
+        void read(void* dest, size_t size)
         {
-            for (auto i : m_files)
+            const uint64 total = m_header.uncompressedSize;
+            if (m_offset > total || total - m_offset < size)
             {
-                DirFileHeader& header = i.second;
-                std::string filename = header.filename;
+                MANGO_EXCEPTION(ID"Reading past end of stream.");
+            }
 
-                if (header.folder)
+            if (m_offset < m_decoded)
+            {
+                m_decoder.reset(new ZipDecoder(m_header, m_start, m_password));
+                m_decoded = 0;
+            }
+
+            // skip to the requested position
+            while (m_decoded < m_offset)
+            {
+                uint8 temp[16 * 1024];
+                const size_t bytes = size_t(std::min(m_offset - m_decoded, uint64(sizeof(temp))));
+                const size_t decoded = m_decoder->read(temp, bytes);
+                m_decoded += decoded;
+                if (decoded < bytes)
                 {
-                    filename += "/";
+                    // the entry ended before its uncompressed size
+                    MANGO_EXCEPTION(ID"Incorrect decompressed size.");
                 }
+            }
 
-                if (isPrefix(filename, pathname))
-                {
-                    filename = filename.substr(pathname.length());
-                    size_t n = filename.find_first_of("/");
+            const size_t decoded = m_decoder->read(reinterpret_cast<uint8*>(dest), size);
+            m_decoded += decoded;
+            m_offset = m_decoded;
 
-                    if (n != std::string::npos)
+            if (decoded < size)
+            {
+                MANGO_EXCEPTION(ID"Incorrect decompressed size.");
+            }
+        }
+
+        void write(const void* data, size_t size)
+        {
+            MANGO_UNREFERENCED_PARAMETER(data);
+            MANGO_UNREFERENCED_PARAMETER(size);
+            MANGO_EXCEPTION(ID"Cannot write() in read-only stream.");
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // MapperZIP
+    // -----------------------------------------------------------------
+
+    class MapperZIP : public AbstractMapper
+    {
+    public:
+        Memory m_parent_memory;
+        std::string m_password;
+        std::vector<FileEntry> m_files;
+        FileTree m_tree;
+        uint64 m_archive; // hash of the central directory, zero when not known
+
+        MapperZIP(Memory parent, const std::string& password)
+        : m_parent_memory(parent), m_password(password), m_archive(0)
+        {
+            if (parent.address)
+            {
+                DirEndRecord record(parent);
+                if (record.status())
+                {
+                    // the central directory identifies the archive for the caches; archives nested
+                    // in other archives don't have a modification time and a rewritten archive moves the directory
+                    if (record.dirStartOffset <= parent.size && record.dirSize <= parent.size - record.dirStartOffset)
                     {
-                        if (n == (filename.length() - 1))
-                        {
-                            emplace(index, filename, 0, FileInfo::DIRECTORY);
-                        }
+                        m_archive = XXH64(parent.address + record.dirStartOffset, size_t(record.dirSize), parent.size);
                     }
-                    else
+
+                    IndexCacheHeader cache;
+                    std::string filename = getIndexCacheFilename(cache, parent, record);
+
+                    if (filename.empty() || !loadIndexCache(filename, cache))
                     {
-                        uint32 flags = 0;
-                        if (header.compression > 0)
+                        parse(parent, record);
+
+                        if (!filename.empty())
                         {
-                            flags |= FileInfo::COMPRESSED;
+                            saveIndexCache(filename, cache);
                         }
+                    }
+                }
+            }
+        }
+
+        ~MapperZIP()
+        {
+        }
 
-                        emplace(index, filename, header.uncompressedSize, flags);
+        void parse(Memory parent, const DirEndRecord& record)
+        {
+            const int numFiles = int(record.numEntriesTotal);
+            m_files.reserve(numFiles);
+
+            // read file header for each file
+            LittleEndianPointer p = parent.address + record.dirStartOffset;
+
+            for (int i = 0; i < numFiles; ++i)
+            {
+                DirFileHeader header(p);
+                if (header.status())
+                {
+                    // the tree generates the missing folder entries for zip files created with -D option
+                    uint32 flags = header.folder ? FileInfo::DIRECTORY : 0;
+                    if (!header.folder && header.compression > 0)
+                    {
+                        flags |= FileInfo::COMPRESSED;
                     }
+
+                    const std::string filename(header.filename, header.filenameLen);
+                    m_tree.insert(filename, header.uncompressedSize, flags, uint32(m_files.size()));
+                    m_files.push_back(FileEntry(header));
                 }
             }
         }
 
+        std::string getIndexCacheFilename(IndexCacheHeader& cache, Memory parent, const DirEndRecord& record) const
+        {
+            std::string folder = Mapper::getIndexCache();
+            if (folder.empty() || !m_archive)
+                return std::string();
+
+            std::memset(&cache, 0, sizeof(cache));
+            cache.magic = 0x5844495a; // ZIDX
+            cache.version = 1;
+            cache.archive_size = parent.size;
+            cache.dir_offset = record.dirStartOffset;
+            cache.dir_size = record.dirSize;
+            cache.dir_hash = m_archive;
+            cache.entry_size = sizeof(FileEntry);
+
+            char name[64];
+            std::snprintf(name, sizeof(name), "%016llx-%llx.zipindex",
+                (unsigned long long)cache.dir_hash, (unsigned long long)cache.archive_size);
+            return folder + name;
+        }
+
+        bool loadIndexCache(const std::string& filename, IndexCacheHeader& cache)
+        {
+            try
+            {
+                File file(filename);
+                Memory memory = file;
+
+                IndexCacheHeader header;
+                if (memory.size < sizeof(header))
+                    return false;
+
+                std::memcpy(&header, memory.address, sizeof(header));
+                const uint64 entries_size = uint64(header.entry_count) * sizeof(FileEntry);
+
+                cache.entry_count = header.entry_count;
+                cache.data_hash = header.data_hash;
+                if (std::memcmp(&header, &cache, sizeof(header)) || entries_size > memory.size - sizeof(header))
+                    return false;
+
+                const uint8* p = memory.address + sizeof(header);
+                if (XXH64(p, memory.size - sizeof(header), 0) != header.data_hash)
+                    return false;
+
+                m_files.resize(header.entry_count);
+                std::memcpy(m_files.data(), p, size_t(entries_size));
+                p += entries_size;
+
+                Memory tree(const_cast<uint8*>(p), size_t(memory.address + memory.size - p));
+                if (!m_tree.load(tree))
+                {
+                    m_files.clear();
+                    return false;
+                }
+            }
+            catch (...)
+            {
+                // no cache for this archive
+                return false;
+            }
+
+            return true;
+        }
+
+        void saveIndexCache(const std::string& filename, IndexCacheHeader& cache) const
+        {
+            cache.entry_count = uint32(m_files.size());
+
+            Buffer buffer;
+            buffer.write(m_files.data(), m_files.size() * sizeof(FileEntry));
+            m_tree.save(buffer);
+
+            Memory data = buffer;
+            cache.data_hash = XXH64(data.address, data.size, 0);
+
+            // written under a temporary name so that a concurrent open never sees a partial file
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), ".%llx", (unsigned long long)
+                std::chrono::steady_clock::now().time_since_epoch().count());
+            const std::string temp = filename + suffix;
+
+            try
+            {
+                {
+                    FileStream file(temp, Stream::WRITE);
+                    file.write(&cache, sizeof(cache));
+                    file.write(data.address, data.size);
+                }
+
+                if (std::rename(temp.c_str(), filename.c_str()))
+                {
+                    std::remove(temp.c_str());
+                }
+            }
+            catch (...)
+            {
+                // the cache folder is not writable
+                std::remove(temp.c_str());
+            }
+        }
+
+        VirtualMemory* mmap(const FileEntry& header, uint8* start, const std::string& password)
+        {
+            ZipDecoder decoder(header, start, password);
+
+            const bool transformed = (header.flags & 1) != 0 || header.compression != 0;
+            if (!transformed)
+            {
+                uint8* address = const_cast<uint8*>(decoder.input());
+                return new VirtualMemoryPointer(address, static_cast<size_t>(header.uncompressedSize));
+            }
+
+            // NOTE: decoding limited on 32 bit platforms
+            const size_t size = static_cast<size_t>(header.uncompressedSize);
+            std::unique_ptr<uint8[]> buffer(new uint8[size]);
+
+            if (decoder.read(buffer.get(), size) != size)
+            {
+                // incorrect output size
+                MANGO_EXCEPTION(ID"Incorrect decompressed size.");
+            }
+
+            return new VirtualMemoryBuffer(buffer.release(), size);
+        }
+
+        bool isfile(const std::string& filename) const
+        {
+            const FileTree::Node* node = m_tree.find(filename);
+
+            if (node)
+            {
+                // file does exist; check if it is a folder
+                return (node->flags & FileInfo::DIRECTORY) == 0;
+            }
+
+            return false;
+        }
+
+        void index(FileIndex& index, const std::string& pathname)
+        {
+            m_tree.index(index, pathname);
+        }
+
         VirtualMemory* mmap(const std::string& filename)
         {
-            auto i = m_files.find(filename);
-            if (i == m_files.end())
+            const FileTree::Node* node = m_tree.find(filename);
+            if (!node || node->data == FileTree::NONE)
+            {
+                MANGO_EXCEPTION(ID"File not found.");
+            }
+
+            const FileEntry& entry = m_files[node->data];
+
+            // encrypted entries are never cached: the cache is shared by every mapper of
+            // the archive, and a wrong password isn't always detected by the header check
+            const bool encrypted = (entry.flags & 1) != 0;
+            if (encrypted || !entry.compression || !m_archive)
+            {
+                return mmap(entry, m_parent_memory.address, m_password);
+            }
+
+            // compressed entries are kept decoded in the entry cache
+            return getEntryCache().mmap(m_archive, entry.localOffset, [&] ()
+            {
+                return mmap(entry, m_parent_memory.address, m_password);
+            });
+        }
+
+        Stream* open(const std::string& filename)
+        {
+            const FileTree::Node* node = m_tree.find(filename);
+            if (!node || node->data == FileTree::NONE)
             {
                 MANGO_EXCEPTION(ID"File not found.");
             }
 
-            return mmap(i->second, m_parent_memory.address, m_password);
+            const FileEntry& entry = m_files[node->data];
+
+            const bool transformed = (entry.flags & 1) != 0 || entry.compression != 0;
+            if (!transformed)
+            {
+                return AbstractMapper::open(filename);
+            }
+
+            return new ZipStream(entry, m_parent_memory.address, m_password);
         }
     };
 
@@ -0,0 +1,235 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <new>
+#include <mango/core/memory.hpp>
+#include <mango/core/thread.hpp>
+#include <mango/filesystem/reader.hpp>
+
+namespace
+{
+
+    using namespace mango;
+
+    // -----------------------------------------------------------------
+    // SliceMemory
+    // -----------------------------------------------------------------
+
+    class SliceMemory : public VirtualMemory
+    {
+    protected:
+        std::unique_ptr<VirtualMemory> m_parent;
+
+    public:
+        SliceMemory(std::unique_ptr<VirtualMemory> parent, uint64 offset, uint64 size)
+            : m_parent(std::move(parent))
+        {
+            const Memory& parent_memory = *m_parent;
+            memory.address = parent_memory.address + offset;
+            memory.size = size_t(size);
+        }
+
+        ~SliceMemory()
+        {
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // ThreadReader
+    // -----------------------------------------------------------------
+
+    // Maps the files on I/O threads and touches the pages of the requested
+    // range, so the page faults are taken there instead of by the consumer.
+
+    class ThreadReader : public AbstractReader
+    {
+    protected:
+        AbstractMapper* m_mapper;
+        ThreadPool m_pool;
+        ConcurrentQueue m_queue;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::deque<ReadResult> m_complete;
+        size_t m_pending; // submitted but not returned by next()
+
+        void read(ReadResult& result, uint64 size)
+        {
+            std::unique_ptr<VirtualMemory> memory(m_mapper->mmap(result.filename));
+            const Memory& source = *memory;
+
+            if (result.offset > source.size)
+                return;
+
+            const uint64 available = source.size - result.offset;
+            size = size ? std::min(size, available) : available;
+
+            volatile uint8 sink = 0;
+            for (uint64 i = 0; i < size; i += 4096)
+            {
+                sink += source.address[result.offset + i];
+            }
+
+            if (!result.offset && size == source.size)
+                result.memory = std::move(memory);
+            else
+                result.memory.reset(new SliceMemory(std::move(memory), result.offset, size));
+        }
+
+    public:
+        ThreadReader(AbstractMapper* mapper, int depth)
+            : m_mapper(mapper)
+            , m_pool(std::min(std::max(depth, 1), 16))
+            , m_queue(m_pool, "io")
+            , m_pending(0)
+        {
+        }
+
+        ~ThreadReader()
+        {
+            m_queue.wait();
+        }
+
+        // the pool is cache line aligned, which operator new doesn't honour before C++17
+        static void* operator new (size_t size)
+        {
+            void* pointer = aligned_malloc(size, alignof(ThreadReader));
+            if (!pointer)
+                throw std::bad_alloc();
+            return pointer;
+        }
+
+        static void operator delete (void* pointer)
+        {
+            aligned_free(pointer);
+        }
+
+        void submit(const std::string& filename, uint64 offset, uint64 size, void* user) override
+        {
+            ++m_pending;
+
+            m_queue.enqueue([this, filename, offset, size, user]
+            {
+                ReadResult result;
+                result.filename = filename;
+                result.offset = offset;
+                result.user = user;
+
+                try
+                {
+                    read(result, size);
+                }
+                catch (...)
+                {
+                    // reported as a result without memory
+                    result.memory.reset();
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_complete.push_back(std::move(result));
+                m_condition.notify_one();
+            });
+        }
+
+        bool next(ReadResult& result, bool wait) override
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (!m_pending || (!wait && m_complete.empty()))
+                return false;
+
+            m_condition.wait(lock, [this] { return !m_complete.empty(); });
+
+            result = std::move(m_complete.front());
+            m_complete.pop_front();
+            --m_pending;
+            return true;
+        }
+
+        size_t pending() const override
+        {
+            return m_pending;
+        }
+    };
+
+} // namespace
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------
+    // ReadResult
+    // -----------------------------------------------------------------
+
+    ReadResult::ReadResult()
+        : offset(0)
+        , user(nullptr)
+    {
+    }
+
+    // -----------------------------------------------------------------
+    // AbstractMapper
+    // -----------------------------------------------------------------
+
+    AbstractReader* AbstractMapper::createReader(int depth)
+    {
+        return new ThreadReader(this, depth);
+    }
+
+    // -----------------------------------------------------------------
+    // AsyncReader
+    // -----------------------------------------------------------------
+
+    AsyncReader::AsyncReader(int depth)
+    {
+        m_mapper = getFileMapper();
+        m_reader.reset(m_mapper->createReader(depth));
+    }
+
+    AsyncReader::AsyncReader(const Path& path, int depth)
+    {
+        // the path owns the mapper; it must outlive the reader
+        m_mapper = path;
+        m_pathname = path.pathname();
+        m_reader.reset(m_mapper->createReader(depth));
+    }
+
+    AsyncReader::~AsyncReader()
+    {
+    }
+
+    void AsyncReader::submit(const std::string& filename, uint64 offset, uint64 size, void* user)
+    {
+        m_reader->submit(m_pathname + filename, offset, size, user);
+    }
+
+    bool AsyncReader::wait(ReadResult& result)
+    {
+        bool status = m_reader->next(result, true);
+        if (status)
+        {
+            result.filename.erase(0, m_pathname.length());
+        }
+        return status;
+    }
+
+    bool AsyncReader::poll(ReadResult& result)
+    {
+        bool status = m_reader->next(result, false);
+        if (status)
+        {
+            result.filename.erase(0, m_pathname.length());
+        }
+        return status;
+    }
+
+    size_t AsyncReader::pending() const
+    {
+        return m_reader->pending();
+    }
+
+} // namespace mango
@@ -1,15 +1,211 @@
 /*
     MANGO Multimedia Development Platform
-    Copyright (C) 2012-2016 Twilight Finland 3D Oy Ltd. All rights reserved.
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #define _FILE_OFFSET_BITS 64 /* LFS: 64 bit off_t */
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <climits>
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/memory.hpp>
 #include <mango/filesystem/file.hpp>
 
+#include "io_ring.hpp"
+
+#ifndef IOV_MAX
+#define IOV_MAX 16 /* minimum required by POSIX */
+#endif
+
 #define ID "FileStream: "
 
+namespace
+{
+
+    using namespace mango;
+
+    // -----------------------------------------------------------------
+    // IOBlock
+    // -----------------------------------------------------------------
+
+    // Direct I/O needs the memory, file offset and transfer size aligned to
+    // the logical block size of the device; 4 KB covers the common devices.
+    const size_t DIRECT_ALIGNMENT = 4096;
+    const size_t DIRECT_BLOCK_SIZE = 1024 * 1024;
+    const int DIRECT_MAX_DEPTH = 64; // each block in flight has a buffer of its own
+
+    struct IOBlock
+    {
+        enum State
+        {
+            IDLE,
+            READING,
+            WRITING
+        };
+
+        uint8* data;
+        uint64 index;    // block number in the file, or NONE
+        size_t request;  // bytes in the pending transfer
+        size_t bytes;    // bytes which were read from the file
+        State state;
+        bool dirty;
+        uint64 used;     // for picking the least recently used block
+
+        static const uint64 NONE = ~uint64(0);
+    };
+
+    // -----------------------------------------------------------------
+    // IOEngine
+    // -----------------------------------------------------------------
+
+    // Transfers a block at a time; submit() may complete the request
+    // immediately or leave it in flight until reap() returns the block.
+
+    struct IOEngine
+    {
+        int m_fd;
+
+        IOEngine(int fd)
+            : m_fd(fd)
+        {
+        }
+
+        virtual ~IOEngine()
+        {
+        }
+
+        // returns number of bytes transferred; short only at the end of file
+        size_t transfer(IOBlock* block, size_t start)
+        {
+            const uint64 position = block->index * DIRECT_BLOCK_SIZE;
+            size_t done = start;
+
+            while (done < block->request)
+            {
+                ssize_t n;
+                if (block->state == IOBlock::WRITING)
+                    n = ::pwrite(m_fd, block->data + done, block->request - done, off_t(position + done));
+                else
+                    n = ::pread(m_fd, block->data + done, block->request - done, off_t(position + done));
+
+                if (n < 0 && errno == EINTR)
+                    continue;
+
+                if (n < 0)
+                {
+                    MANGO_EXCEPTION(ID"I/O failed.");
+                }
+
+                if (n == 0)
+                {
+                    if (block->state == IOBlock::WRITING)
+                    {
+                        MANGO_EXCEPTION(ID"Write failed.");
+                    }
+                    break;
+                }
+
+                done += size_t(n);
+            }
+
+            return done;
+        }
+
+        virtual void submit(IOBlock* block) = 0;
+        virtual IOBlock* reap() = 0;
+    };
+
+    struct SyncEngine : IOEngine
+    {
+        IOBlock* m_complete;
+
+        SyncEngine(int fd)
+            : IOEngine(fd)
+            , m_complete(nullptr)
+        {
+        }
+
+        void submit(IOBlock* block) override
+        {
+            // the handle reaps after every submit when it has no queue
+            block->bytes = transfer(block, 0);
+            m_complete = block;
+        }
+
+        IOBlock* reap() override
+        {
+            IOBlock* block = m_complete;
+            m_complete = nullptr;
+            return block;
+        }
+    };
+
+#ifdef MANGO_ENABLE_IO_URING
+
+    struct UringEngine : IOEngine
+    {
+        IORing m_ring;
+        std::vector<IOBlock*> m_complete; // finished without the ring
+
+        UringEngine(int fd, int depth)
+            : IOEngine(fd)
+            , m_ring(depth)
+        {
+        }
+
+        bool valid() const
+        {
+            return m_ring.valid();
+        }
+
+        void submit(IOBlock* block) override
+        {
+            const bool write = block->state == IOBlock::WRITING;
+            if (!m_ring.submit(m_fd, write, block->data, block->request, block->index * DIRECT_BLOCK_SIZE, block))
+            {
+                block->bytes = transfer(block, 0);
+                m_complete.push_back(block);
+            }
+        }
+
+        IOBlock* reap() override
+        {
+            if (!m_complete.empty())
+            {
+                IOBlock* block = m_complete.back();
+                m_complete.pop_back();
+                return block;
+            }
+
+            // interrupted waits are retried by the ring; failing here means the
+            // handle reaps more blocks than it has submitted
+            void* user = nullptr;
+            int result = 0;
+            if (!m_ring.reap(user, result, true))
+            {
+                MANGO_EXCEPTION(ID"No transfer in flight.");
+            }
+
+            // errors and partial transfers are finished with the synchronous path
+            IOBlock* block = reinterpret_cast<IOBlock*>(user);
+            block->bytes = transfer(block, result > 0 ? size_t(result) : 0);
+            return block;
+        }
+    };
+
+#endif // MANGO_ENABLE_IO_URING
+
+} // namespace
+
 namespace mango
 {
 
@@ -18,16 +214,56 @@ namespace mango
     // -----------------------------------------------------------------
 
 	struct FileHandle
+	{
+        std::string m_filename;
+
+        FileHandle(const std::string& filename)
+            : m_filename(filename)
+        {
+        }
+
+        virtual ~FileHandle()
+        {
+        }
+
+        const std::string& filename() const
+        {
+            return m_filename;
+        }
+
+        virtual uint64 size() const = 0;
+        virtual uint64 offset() const = 0;
+        virtual void seek(uint64 distance, int method) = 0;
+        virtual void read(void* dest, size_t size) = 0;
+        virtual void write(const void* data, size_t size) = 0;
+
+        virtual void write(const std::vector<Memory>& buffers)
+        {
+            for (const Memory& buffer : buffers)
+            {
+                write(buffer.address, buffer.size);
+            }
+        }
+	};
+
+    // -----------------------------------------------------------------
+	// StdioHandle
+    // -----------------------------------------------------------------
+
+	struct StdioHandle : FileHandle
 	{
 		FILE* m_file;
 		uint64 m_size;
-        std::string m_filename;
 
-        FileHandle(const std::string& filename, const char* mode)
-        : m_filename(filename)
+        StdioHandle(const std::string& filename, const char* mode)
+            : FileHandle(filename)
 		{
 			// open file
             m_file = std::fopen(filename.c_str(), mode);
+            if (!m_file)
+            {
+                MANGO_EXCEPTION(ID"fopen() failed.");
+            }
 
 			// cache file size
 	        fseeko(m_file, 0, SEEK_END);
@@ -35,49 +271,494 @@ namespace mango
 	        fseeko(m_file, 0, SEEK_SET);
 		}
 
-		~FileHandle()
+		~StdioHandle()
 		{
             std::fclose(m_file);
 		}
 
-        const std::string& filename() const
-        {
-            return m_filename;
-        }
-
-        uint64 size() const
+        uint64 size() const override
 		{
 			return m_size;
 		}
 
-		uint64 offset() const
+		uint64 offset() const override
 		{
 	        return ftello(m_file);
 		}
 
-		void seek(uint64 distance, int method)
+		void seek(uint64 distance, int method) override
 		{
 	        fseeko(m_file, distance, method);
 		}
 
-	    void read(void* dest, size_t size)
+	    void read(void* dest, size_t size) override
 	    {
     	    size_t status = std::fread(dest, 1, size, m_file);
 	        MANGO_UNREFERENCED_PARAMETER(status);
 	    }
 
-	    void write(const void* data, size_t size)
+	    void write(const void* data, size_t size) override
 	    {
 	        size_t status = std::fwrite(data, 1, size, m_file);
 	        MANGO_UNREFERENCED_PARAMETER(status);
 	    }
+
+        void write(const std::vector<Memory>& buffers) override
+        {
+            // hand the buffers to the kernel directly instead of copying them into the FILE
+            // buffer; after the flush the descriptor is at the stream position
+            std::fflush(m_file);
+            const int fd = fileno(m_file);
+            off_t position = ftello(m_file);
+
+            std::vector<struct iovec> iov;
+            for (const Memory& buffer : buffers)
+            {
+                if (buffer.size)
+                {
+                    struct iovec v;
+                    v.iov_base = buffer.address;
+                    v.iov_len = buffer.size;
+                    iov.push_back(v);
+                }
+            }
+
+            size_t index = 0;
+            while (index < iov.size())
+            {
+                const int count = int(std::min(iov.size() - index, size_t(IOV_MAX)));
+                ssize_t n = ::writev(fd, &iov[index], count);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+
+                position += n;
+
+                // skip the written buffers; a partial write continues from the middle of one
+                while (n > 0 && index < iov.size())
+                {
+                    if (size_t(n) >= iov[index].iov_len)
+                    {
+                        n -= iov[index].iov_len;
+                        ++index;
+                    }
+                    else
+                    {
+                        iov[index].iov_base = reinterpret_cast<uint8*>(iov[index].iov_base) + n;
+                        iov[index].iov_len -= n;
+                        n = 0;
+                    }
+                }
+            }
+
+            // the FILE position follows the descriptor
+            fseeko(m_file, position, SEEK_SET);
+        }
 	};
 
+    // -----------------------------------------------------------------
+	// DirectHandle
+    // -----------------------------------------------------------------
+
+    /* Unbuffered file access in DIRECT_BLOCK_SIZE blocks. Reading keeps up to
+       depth blocks ahead of the current one in flight; writing submits every
+       completed block and continues filling the next one. Partial blocks are
+       read in before they are modified, and the file is truncated to the logical
+       size on close since the transfers are always whole aligned blocks.
+    */
+
+    struct DirectHandle : FileHandle
+    {
+        int m_fd;
+        bool m_writable;
+        bool m_direct;
+        uint64 m_size;
+        uint64 m_offset;
+        uint64 m_clock;
+        int m_depth;
+        int m_inflight;
+        std::vector<IOBlock> m_blocks;
+        IOEngine* m_engine;
+
+        DirectHandle(const std::string& filename, bool writable, int depth)
+            : FileHandle(filename)
+            , m_fd(-1)
+            , m_writable(writable)
+            , m_direct(false)
+            , m_size(0)
+            , m_offset(0)
+            , m_clock(0)
+            , m_depth(std::min(std::max(depth, 0), DIRECT_MAX_DEPTH))
+            , m_inflight(0)
+            , m_engine(nullptr)
+        {
+            // read access is needed for the partial blocks when writing
+            const int flags = writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;
+
+#ifdef O_DIRECT
+            m_fd = ::open(filename.c_str(), flags | O_DIRECT, 0644);
+            m_direct = m_fd >= 0;
+#endif
+            if (m_fd < 0)
+            {
+                // file systems like tmpfs refuse O_DIRECT
+                m_fd = ::open(filename.c_str(), flags, 0644);
+            }
+
+            if (m_fd < 0)
+            {
+                MANGO_EXCEPTION(ID"open() failed.");
+            }
+
+            try
+            {
+                initialize();
+            }
+            catch (...)
+            {
+                // the destructor does not run for a constructor which throws
+                release();
+                throw;
+            }
+        }
+
+        void initialize()
+        {
+#if defined(F_NOCACHE)
+            m_direct = ::fcntl(m_fd, F_NOCACHE, 1) != -1;
+#endif
+
+            struct stat s;
+            if (::fstat(m_fd, &s) == 0)
+            {
+                m_size = uint64(s.st_size);
+            }
+
+#ifdef MANGO_ENABLE_IO_URING
+            if (m_depth > 0)
+            {
+                std::unique_ptr<UringEngine> engine(new UringEngine(m_fd, m_depth));
+                if (engine->valid())
+                {
+                    m_depth = std::min(m_depth, int(engine->m_ring.capacity()));
+                    m_engine = engine.release();
+                }
+            }
+#endif
+
+            if (!m_engine)
+            {
+                // without a queue the transfers are synchronous
+                m_engine = new SyncEngine(m_fd);
+                m_depth = 0;
+            }
+
+            // value initialized, so the buffers are null until they are allocated
+            m_blocks.resize(m_depth + 2);
+            for (IOBlock& block : m_blocks)
+            {
+                block.data = reinterpret_cast<uint8*>(aligned_malloc(DIRECT_BLOCK_SIZE, DIRECT_ALIGNMENT));
+                if (!block.data)
+                {
+                    MANGO_EXCEPTION(ID"Out of memory.");
+                }
+
+                block.index = IOBlock::NONE;
+                block.state = IOBlock::IDLE;
+            }
+        }
+
+        // the engine, the descriptor and the block buffers
+        void release()
+        {
+            delete m_engine;
+            m_engine = nullptr;
+
+            ::close(m_fd);
+            m_fd = -1;
+
+            for (IOBlock& block : m_blocks)
+            {
+                aligned_free(block.data);
+                block.data = nullptr;
+            }
+        }
+
+        ~DirectHandle()
+        {
+            try
+            {
+                if (m_writable)
+                {
+                    for (IOBlock& block : m_blocks)
+                    {
+                        if (block.dirty)
+                            flush(block);
+                    }
+
+                    drain();
+                    int status = ::ftruncate(m_fd, off_t(m_size));
+                    MANGO_UNREFERENCED_PARAMETER(status);
+                }
+                else
+                {
+                    drain();
+                }
+            }
+            catch (...)
+            {
+                // the destructor has no one to report to
+            }
+
+            release();
+        }
+
+        uint64 size() const override
+        {
+            return m_size;
+        }
+
+        uint64 offset() const override
+        {
+            return m_offset;
+        }
+
+        void seek(uint64 distance, int method) override
+        {
+            switch (method)
+            {
+                case SEEK_SET:
+                    m_offset = distance;
+                    break;
+                case SEEK_CUR:
+                    m_offset += distance;
+                    break;
+                case SEEK_END:
+                    m_offset = m_size + distance;
+                    break;
+            }
+        }
+
+        void read(void* dest, size_t size) override
+        {
+            // short read at the end of file, like fread()
+            size = size_t(std::min(uint64(size), m_size - std::min(m_size, m_offset)));
+
+            uint8* d = reinterpret_cast<uint8*>(dest);
+            while (size > 0)
+            {
+                const uint64 index = m_offset / DIRECT_BLOCK_SIZE;
+                const size_t start = size_t(m_offset % DIRECT_BLOCK_SIZE);
+
+                IOBlock& block = acquire(index, true);
+                readahead(index);
+
+                const size_t available = block.bytes > start ? block.bytes - start : 0;
+                const size_t bytes = std::min(size, available);
+                if (!bytes)
+                {
+                    // the file was truncated under us
+                    break;
+                }
+
+                std::memcpy(d, block.data + start, bytes);
+                d += bytes;
+                size -= bytes;
+                m_offset += bytes;
+            }
+        }
+
+        void write(const void* data, size_t size) override
+        {
+            if (!m_writable)
+            {
+                MANGO_EXCEPTION(ID"Stream is not writable.");
+            }
+
+            const uint8* s = reinterpret_cast<const uint8*>(data);
+            while (size > 0)
+            {
+                const uint64 index = m_offset / DIRECT_BLOCK_SIZE;
+                const size_t start = size_t(m_offset % DIRECT_BLOCK_SIZE);
+                const size_t bytes = std::min(size, DIRECT_BLOCK_SIZE - start);
+
+                // the old contents are needed unless the whole block is overwritten
+                const bool partial = bytes < DIRECT_BLOCK_SIZE;
+                IOBlock& block = acquire(index, partial);
+
+                std::memcpy(block.data + start, s, bytes);
+                block.bytes = std::max(block.bytes, start + bytes);
+                block.dirty = true;
+
+                s += bytes;
+                size -= bytes;
+                m_offset += bytes;
+                m_size = std::max(m_size, m_offset);
+
+                if (start + bytes == DIRECT_BLOCK_SIZE)
+                {
+                    // block is complete; write it out while the next one is filled
+                    flush(block);
+                }
+            }
+        }
+
+        // -----------------------------------------------------------------
+
+        void complete(IOBlock* block)
+        {
+            if (block->state == IOBlock::WRITING && !m_direct)
+            {
+                // the data went through the page cache; drop it
+#if defined(POSIX_FADV_DONTNEED)
+                ::posix_fadvise(m_fd, off_t(block->index * DIRECT_BLOCK_SIZE), off_t(block->request), POSIX_FADV_DONTNEED);
+#endif
+            }
+
+            block->state = IOBlock::IDLE;
+            --m_inflight;
+        }
+
+        void submit(IOBlock& block, IOBlock::State state, size_t request)
+        {
+            block.state = state;
+            block.request = request;
+            ++m_inflight;
+            m_engine->submit(&block);
+
+            if (!m_depth)
+            {
+                complete(m_engine->reap());
+            }
+        }
+
+        void wait(IOBlock& block)
+        {
+            while (block.state != IOBlock::IDLE)
+            {
+                complete(m_engine->reap());
+            }
+        }
+
+        void drain()
+        {
+            while (m_inflight > 0)
+            {
+                complete(m_engine->reap());
+            }
+        }
+
+        void flush(IOBlock& block)
+        {
+            // the tail of the last block is padded to alignment and truncated on close
+            const uint64 position = block.index * DIRECT_BLOCK_SIZE;
+            const size_t valid = size_t(std::min(uint64(DIRECT_BLOCK_SIZE), m_size - position));
+            const size_t request = (valid + DIRECT_ALIGNMENT - 1) & ~(DIRECT_ALIGNMENT - 1);
+
+            std::memset(block.data + valid, 0, request - valid);
+            block.dirty = false;
+            submit(block, IOBlock::WRITING, request);
+        }
+
+        IOBlock* find(uint64 index)
+        {
+            for (IOBlock& block : m_blocks)
+            {
+                if (block.index == index)
+                    return &block;
+            }
+            return nullptr;
+        }
+
+        IOBlock* victim()
+        {
+            // least recently used block; prefer the ones which are not in flight
+            IOBlock* result = nullptr;
+            for (IOBlock& block : m_blocks)
+            {
+                if (!result || (block.state == IOBlock::IDLE && result->state != IOBlock::IDLE) ||
+                    (block.state == result->state && block.used < result->used))
+                {
+                    result = &block;
+                }
+            }
+
+            wait(*result);
+            if (result->dirty)
+            {
+                flush(*result);
+                wait(*result);
+            }
+
+            result->index = IOBlock::NONE;
+            result->bytes = 0;
+            return result;
+        }
+
+        IOBlock& acquire(uint64 index, bool load)
+        {
+            IOBlock* block = find(index);
+            if (block)
+            {
+                // reading ahead, or the previous write to the block is still in flight
+                wait(*block);
+            }
+            else
+            {
+                block = victim();
+                block->index = index;
+
+                const uint64 position = index * DIRECT_BLOCK_SIZE;
+                if (load && position < m_size)
+                {
+                    submit(*block, IOBlock::READING, DIRECT_BLOCK_SIZE);
+                    wait(*block);
+                }
+            }
+
+            block->used = ++m_clock;
+            return *block;
+        }
+
+        void readahead(uint64 index)
+        {
+            for (int i = 1; i <= m_depth; ++i)
+            {
+                const uint64 next = index + i;
+                if (next * DIRECT_BLOCK_SIZE >= m_size)
+                    break;
+
+                if (find(next))
+                    continue;
+
+                // don't wait for a block to be free; the read-ahead is only a hint
+                IOBlock* block = nullptr;
+                for (IOBlock& candidate : m_blocks)
+                {
+                    if (candidate.state == IOBlock::IDLE && !candidate.dirty && candidate.index != index &&
+                        (!block || candidate.used < block->used))
+                    {
+                        block = &candidate;
+                    }
+                }
+
+                if (!block || (block->index != IOBlock::NONE && block->index > index))
+                    break;
+
+                block->index = next;
+                block->bytes = 0;
+                block->used = m_clock;
+                submit(*block, IOBlock::READING, DIRECT_BLOCK_SIZE);
+            }
+        }
+    };
+
     // -----------------------------------------------------------------
     // FileStream
     // -----------------------------------------------------------------
 
-    FileStream::FileStream(const std::string& filename, OpenMode openmode)
+    FileStream::FileStream(const std::string& filename, OpenMode openmode, IOMode io, int queueDepth)
     : m_handle(NULL)
     {
 		const char* mode;
@@ -97,7 +778,14 @@ namespace mango
                 break;
         }
 
-		m_handle = new FileHandle(filename, mode);
+        if (io == DIRECT)
+        {
+            m_handle = new DirectHandle(filename, openmode == WRITE, queueDepth);
+        }
+        else
+        {
+            m_handle = new StdioHandle(filename, mode);
+        }
     }
 
     FileStream::~FileStream()
@@ -155,4 +843,9 @@ namespace mango
 		m_handle->write(data, size);
     }
 
+    void FileStream::write(const std::vector<Memory>& buffers)
+    {
+		m_handle->write(buffers);
+    }
+
 } // namespace mango
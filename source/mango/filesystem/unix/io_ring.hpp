@@ -0,0 +1,242 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <mango/core/configure.hpp>
+#include <mango/core/object.hpp>
+#include <mango/core/exception.hpp>
+
+#if defined(MANGO_PLATFORM_LINUX) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define MANGO_ENABLE_IO_URING
+    #endif
+#endif
+
+#ifdef MANGO_ENABLE_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------
+    // IORing
+    // -----------------------------------------------------------------
+
+    /* io_uring through the raw system calls; the kernel header is all we need.
+       Every transfer is submitted immediately. The number of transfers in
+       flight is limited to the requested depth; the kernel rounds the rings
+       up, and the completion ring is twice the size of the submission ring.
+    */
+
+    class IORing : private NonCopyable
+    {
+    protected:
+        struct Slot
+        {
+            struct iovec iov; // must stay valid until the transfer completes
+            void* user;
+        };
+
+        int m_ring;
+        size_t m_sq_size;
+        size_t m_cq_size;
+        size_t m_sqes_size;
+        uint8* m_sq_ring;
+        uint8* m_cq_ring;
+        io_uring_sqe* m_sqes;
+        io_uring_params m_params;
+        std::vector<Slot> m_slots;
+        std::vector<uint32> m_free;
+
+        uint32* sq(uint32 offset) const
+        {
+            return reinterpret_cast<uint32*>(m_sq_ring + offset);
+        }
+
+        uint32* cq(uint32 offset) const
+        {
+            return reinterpret_cast<uint32*>(m_cq_ring + offset);
+        }
+
+        int enter(unsigned submit, unsigned wait)
+        {
+            for (;;)
+            {
+                const unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+                int status = int(::syscall(__NR_io_uring_enter, m_ring, submit, wait, flags, nullptr, 0));
+                if (status < 0 && errno == EINTR)
+                    continue;
+                return status;
+            }
+        }
+
+        void release()
+        {
+            if (m_sq_ring)
+                ::munmap(m_sq_ring, m_sq_size);
+            if (m_cq_ring)
+                ::munmap(m_cq_ring, m_cq_size);
+            if (m_sqes)
+                ::munmap(m_sqes, m_sqes_size);
+            if (m_ring >= 0)
+                ::close(m_ring);
+
+            m_sq_ring = nullptr;
+            m_cq_ring = nullptr;
+            m_sqes = nullptr;
+            m_ring = -1;
+        }
+
+    public:
+        IORing(int depth)
+            : m_ring(-1)
+            , m_sq_size(0)
+            , m_cq_size(0)
+            , m_sqes_size(0)
+            , m_sq_ring(nullptr)
+            , m_cq_ring(nullptr)
+            , m_sqes(nullptr)
+        {
+            // setup fails with ENOSYS on old kernels and EPERM when a sandbox blocks it
+            std::memset(&m_params, 0, sizeof(m_params));
+            m_ring = int(::syscall(__NR_io_uring_setup, unsigned(depth), &m_params));
+            if (m_ring < 0)
+                return;
+
+            m_sq_size = m_params.sq_off.array + m_params.sq_entries * sizeof(uint32);
+            m_cq_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+            m_sqes_size = m_params.sq_entries * sizeof(io_uring_sqe);
+
+            void* sq = ::mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+            void* cq = ::mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+            void* sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+
+            m_sq_ring = sq != MAP_FAILED ? reinterpret_cast<uint8*>(sq) : nullptr;
+            m_cq_ring = cq != MAP_FAILED ? reinterpret_cast<uint8*>(cq) : nullptr;
+            m_sqes = sqes != MAP_FAILED ? reinterpret_cast<io_uring_sqe*>(sqes) : nullptr;
+
+            if (!m_sq_ring || !m_cq_ring || !m_sqes)
+            {
+                release();
+                return;
+            }
+
+            const uint32 slots = std::min(uint32(depth), m_params.cq_entries);
+            m_slots.resize(slots);
+            for (uint32 i = 0; i < slots; ++i)
+            {
+                m_free.push_back(slots - 1 - i);
+            }
+        }
+
+        ~IORing()
+        {
+            release();
+        }
+
+        bool valid() const
+        {
+            return m_ring >= 0;
+        }
+
+        bool full() const
+        {
+            return m_free.empty();
+        }
+
+        // number of transfers which can be in flight
+        size_t capacity() const
+        {
+            return m_slots.size();
+        }
+
+        size_t inflight() const
+        {
+            return m_slots.size() - m_free.size();
+        }
+
+        // queue a transfer; false when the ring is full or the kernel refused it
+        bool submit(int fd, bool write, void* buffer, size_t size, uint64 offset, void* user)
+        {
+            if (m_free.empty())
+                return false;
+
+            const uint32 slot = m_free.back();
+            m_slots[slot].iov.iov_base = buffer;
+            m_slots[slot].iov.iov_len = size;
+            m_slots[slot].user = user;
+
+            const uint32 mask = *sq(m_params.sq_off.ring_mask);
+            const uint32 tail = *sq(m_params.sq_off.tail);
+            const uint32 index = tail & mask;
+
+            io_uring_sqe& sqe = m_sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe.fd = fd;
+            sqe.off = offset;
+            sqe.addr = reinterpret_cast<uint64>(&m_slots[slot].iov);
+            sqe.len = 1;
+            sqe.user_data = slot;
+
+            sq(m_params.sq_off.array)[index] = index;
+            __atomic_store_n(sq(m_params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+
+            if (enter(1, 0) != 1)
+            {
+                // take the entry back; the kernel did not consume it
+                __atomic_store_n(sq(m_params.sq_off.tail), tail, __ATOMIC_RELEASE);
+                return false;
+            }
+
+            m_free.pop_back();
+            return true;
+        }
+
+        // next completion; result is the byte count or a negative errno.
+        // Returns false when nothing is in flight, or nothing has completed and wait is false.
+        bool reap(void*& user, int& result, bool wait)
+        {
+            if (m_free.size() == m_slots.size())
+                return false;
+
+            const uint32 head = *cq(m_params.cq_off.head);
+            while (head == __atomic_load_n(cq(m_params.cq_off.tail), __ATOMIC_ACQUIRE))
+            {
+                if (!wait)
+                    return false;
+
+                if (enter(0, 1) < 0 && errno != EAGAIN && errno != EBUSY)
+                {
+                    MANGO_EXCEPTION("IORing: io_uring_enter() failed.");
+                }
+            }
+
+            const uint32 mask = *cq(m_params.cq_off.ring_mask);
+            const io_uring_cqe* cqes = reinterpret_cast<const io_uring_cqe*>(m_cq_ring + m_params.cq_off.cqes);
+            const io_uring_cqe& cqe = cqes[head & mask];
+
+            const uint32 slot = uint32(cqe.user_data);
+            result = cqe.res;
+            user = m_slots[slot].user;
+            __atomic_store_n(cq(m_params.cq_off.head), head + 1, __ATOMIC_RELEASE);
+
+            m_free.push_back(slot);
+            return true;
+        }
+    };
+
+} // namespace mango
+
+#endif // MANGO_ENABLE_IO_URING
@@ -6,6 +6,9 @@
 #include <mango/core/string.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
+#include <mango/filesystem/reader.hpp>
+
+#include "io_ring.hpp"
 
 #define ID ""
 
@@ -15,6 +18,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <deque>
+#include <algorithm>
 
 namespace
 {
@@ -121,8 +126,282 @@ namespace
                 close(m_file);
             }
         }
+
+        void advise(Advice advice, size_t offset, size_t size)
+        {
+            if (!m_address || offset >= memory.size)
+                return;
+
+            size = size ? std::min(size, memory.size - offset) : memory.size - offset;
+
+            // madvise() works on whole pages
+            const uintptr_t mask = uintptr_t(get_pagesize() - 1);
+            const uintptr_t begin = reinterpret_cast<uintptr_t>(memory.address + offset) & ~mask;
+            const uintptr_t end = reinterpret_cast<uintptr_t>(memory.address + offset + size);
+            void* address = reinterpret_cast<void*>(begin);
+            const size_t length = size_t(end - begin);
+
+            switch (advice)
+            {
+                case NORMAL:
+                    ::madvise(address, length, MADV_NORMAL);
+                    break;
+
+                case SEQUENTIAL:
+                    ::madvise(address, length, MADV_SEQUENTIAL);
+                    break;
+
+                case RANDOM:
+                    ::madvise(address, length, MADV_RANDOM);
+                    break;
+
+                case WILLNEED:
+                    ::madvise(address, length, MADV_WILLNEED);
+                    break;
+
+                case POPULATE:
+#if defined(MADV_POPULATE_READ)
+                    // Linux 5.14; faults the whole range in one call
+                    if (::madvise(address, length, MADV_POPULATE_READ) == 0)
+                        break;
+#endif
+                    ::madvise(address, length, MADV_WILLNEED);
+                    {
+                        volatile uint8 sink = 0;
+                        for (uintptr_t p = begin; p < end; p += mask + 1)
+                        {
+                            sink += *reinterpret_cast<const uint8*>(p);
+                        }
+                    }
+                    break;
+            }
+        }
+    };
+
+#ifdef MANGO_ENABLE_IO_URING
+
+    // -----------------------------------------------------------------
+    // UringReader
+    // -----------------------------------------------------------------
+
+    class ReadMemory : public VirtualMemory
+    {
+    public:
+        ReadMemory(uint8* address, size_t size)
+        {
+            memory.address = address;
+            memory.size = size;
+        }
+
+        ~ReadMemory()
+        {
+            aligned_free(memory.address);
+        }
+    };
+
+    // Reads the files into memory with io_uring. The files are opened when
+    // their read is started so the queue can be longer than the descriptor limit.
+
+    class UringReader : public AbstractReader
+    {
+    protected:
+        struct Request
+        {
+            ReadResult result;
+            uint64 size;
+            int file;
+            uint8* buffer;
+            size_t done;
+        };
+
+        IORing m_ring;
+        std::deque<Request*> m_queue; // waiting for a slot in the ring
+        std::deque<ReadResult> m_complete;
+        size_t m_pending; // submitted but not returned by next()
+
+        void finish(Request* request, bool success)
+        {
+            if (request->file != -1)
+            {
+                close(request->file);
+            }
+
+            if (success)
+            {
+                request->result.memory.reset(new ReadMemory(request->buffer, request->done));
+            }
+            else
+            {
+                aligned_free(request->buffer);
+            }
+
+            m_complete.push_back(std::move(request->result));
+            delete request;
+        }
+
+        void transfer(Request* request)
+        {
+            // at most 1 GB per transfer; the kernel shortens larger ones anyway
+            const size_t size = std::min(size_t(request->size) - request->done, size_t(1) << 30);
+            const uint64 offset = request->result.offset + request->done;
+
+            if (m_ring.submit(request->file, false, request->buffer + request->done, size, offset, request))
+                return;
+
+            // the ring refused the transfer; read synchronously
+            while (request->done < request->size)
+            {
+                const off_t position = off_t(request->result.offset + request->done);
+                ssize_t n = ::pread(request->file, request->buffer + request->done, size_t(request->size) - request->done, position);
+                if (n < 0 && errno == EINTR)
+                    continue;
+
+                if (n <= 0)
+                    break;
+
+                request->done += size_t(n);
+            }
+
+            finish(request, request->done == request->size);
+        }
+
+        void start(Request* request)
+        {
+            request->file = open(request->result.filename.c_str(), O_RDONLY);
+
+            struct stat sb;
+            if (request->file == -1 || fstat(request->file, &sb) == -1 || request->result.offset > uint64(sb.st_size))
+            {
+                finish(request, false);
+                return;
+            }
+
+            const uint64 available = uint64(sb.st_size) - request->result.offset;
+            request->size = request->size ? std::min(request->size, available) : available;
+            request->buffer = reinterpret_cast<uint8*>(aligned_malloc(std::max(size_t(request->size), size_t(1)), 4096));
+            if (!request->buffer)
+            {
+                finish(request, false);
+                return;
+            }
+
+            if (!request->size)
+            {
+                finish(request, true);
+                return;
+            }
+
+            transfer(request);
+        }
+
+        void schedule()
+        {
+            while (!m_ring.full() && !m_queue.empty())
+            {
+                Request* request = m_queue.front();
+                m_queue.pop_front();
+                start(request);
+            }
+        }
+
+        void complete(Request* request, int status)
+        {
+            if (status == -EAGAIN || status == -EINTR)
+            {
+                transfer(request);
+            }
+            else if (status < 0)
+            {
+                finish(request, false);
+            }
+            else if (status == 0)
+            {
+                // the file was truncated after the read was started
+                finish(request, false);
+            }
+            else
+            {
+                request->done += size_t(status);
+                if (request->done < request->size)
+                    transfer(request);
+                else
+                    finish(request, true);
+            }
+        }
+
+    public:
+        UringReader(int depth)
+            : m_ring(std::max(depth, 1))
+            , m_pending(0)
+        {
+        }
+
+        ~UringReader()
+        {
+            void* user;
+            int status;
+            while (m_ring.reap(user, status, true))
+            {
+                Request* request = reinterpret_cast<Request*>(user);
+                close(request->file);
+                aligned_free(request->buffer);
+                delete request;
+            }
+
+            for (Request* request : m_queue)
+            {
+                delete request;
+            }
+        }
+
+        bool valid() const
+        {
+            return m_ring.valid();
+        }
+
+        void submit(const std::string& filename, uint64 offset, uint64 size, void* user) override
+        {
+            Request* request = new Request();
+            request->result.filename = filename;
+            request->result.offset = offset;
+            request->result.user = user;
+            request->size = size;
+            request->file = -1;
+            request->buffer = nullptr;
+            request->done = 0;
+
+            m_queue.push_back(request);
+            ++m_pending;
+            schedule();
+        }
+
+        bool next(ReadResult& result, bool wait) override
+        {
+            while (m_complete.empty())
+            {
+                void* user;
+                int status;
+                if (!m_ring.reap(user, status, wait))
+                    return false;
+
+                complete(reinterpret_cast<Request*>(user), status);
+                schedule();
+            }
+
+            result = std::move(m_complete.front());
+            m_complete.pop_front();
+            --m_pending;
+            return true;
+        }
+
+        size_t pending() const override
+        {
+            return m_pending;
+        }
     };
 
+#endif // MANGO_ENABLE_IO_URING
+
     // -----------------------------------------------------------------
     // FileMapper
     // -----------------------------------------------------------------
@@ -236,6 +515,21 @@ namespace
             VirtualMemory* memory = new FileMemory(filename, 0, 0);
             return memory;
         }
+
+        AbstractReader* createReader(int depth)
+        {
+#ifdef MANGO_ENABLE_IO_URING
+            UringReader* reader = new UringReader(depth);
+            if (reader->valid())
+            {
+                return reader;
+            }
+
+            // io_uring is not available; use the I/O threads
+            delete reader;
+#endif
+            return AbstractMapper::createReader(depth);
+        }
     };
 
 } // namespace
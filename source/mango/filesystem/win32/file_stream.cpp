@@ -86,9 +86,18 @@ namespace mango
     // FileStream
     // -----------------------------------------------------------------
 
-    FileStream::FileStream(const std::string& filename, OpenMode mode)
+    FileStream::FileStream(const std::string& filename, OpenMode mode, IOMode io, int queueDepth)
     : m_handle(NULL)
     {
+        // FILE_FLAG_NO_BUFFERING needs sector aligned transfers which the Stream
+        // interface doesn't guarantee; DIRECT is a sequential access hint here.
+        MANGO_UNREFERENCED_PARAMETER(queueDepth);
+        DWORD attributes = FILE_ATTRIBUTE_NORMAL;
+        if (io == DIRECT)
+        {
+            attributes |= FILE_FLAG_SEQUENTIAL_SCAN;
+        }
+
         DWORD access;
         DWORD disposition;
 
@@ -109,8 +118,7 @@ namespace mango
                 break;
         }
 
-        // TODO: mode parameter
-        HANDLE handle = CreateFileW(u16_fromBytes(filename).c_str(), access, 0, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+        HANDLE handle = CreateFileW(u16_fromBytes(filename).c_str(), access, 0, NULL, disposition, attributes, NULL);
         if (handle == INVALID_HANDLE_VALUE)
         {
             MANGO_EXCEPTION(ID"CreateFileW() failed.");
@@ -174,4 +182,13 @@ namespace mango
 		m_handle->write(data, size);
     }
 
+    void FileStream::write(const std::vector<Memory>& buffers)
+    {
+        // WriteFileGather() needs page sized buffers and unbuffered files
+        for (const Memory& buffer : buffers)
+        {
+            m_handle->write(buffer.address, buffer.size);
+        }
+    }
+
 } // namespace mango
@@ -117,6 +117,24 @@ namespace
                 CloseHandle(m_file);
             }
         }
+
+        void advise(Advice advice, size_t offset, size_t size)
+        {
+            // views have no access pattern hints; only the prefetch is supported
+#if defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+            if (m_address && offset < memory.size && (advice == WILLNEED || advice == POPULATE))
+            {
+                WIN32_MEMORY_RANGE_ENTRY range;
+                range.VirtualAddress = memory.address + offset;
+                range.NumberOfBytes = size ? std::min(size, memory.size - offset) : memory.size - offset;
+                PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+            }
+#else
+            MANGO_UNREFERENCED_PARAMETER(advice);
+            MANGO_UNREFERENCED_PARAMETER(offset);
+            MANGO_UNREFERENCED_PARAMETER(size);
+#endif
+        }
     };
 
     // -----------------------------------------------------------------
@@ -344,7 +344,8 @@ namespace
         rect.destStride = origin ? -surface.stride : surface.stride;
         rect.srcStride = block.width * block.format.bytes();
 
-        Buffer temp(block.height * rect.srcStride);
+        ArenaScope arena;
+        uint8* temp = arena.allocate(block.height * rect.srcStride);
         rect.srcImage = temp;
 
         const int pixelSize = block.width * surface.format.bytes();
@@ -532,18 +533,17 @@ namespace mango
         if (!encode)
             return;
 
-        ConcurrentQueue queue;
-
         uint8* address = memory.address;
 
         const int xblocks = round_to_next(surface.width, width);
         const int yblocks = round_to_next(surface.height, height);
 
-        for (int y = 0; y < yblocks; ++y)
+        parallel_for(0, yblocks, 1, [&] (int y0, int y1)
         {
-            queue.enqueue([this, y, xblocks, &surface, address]
+            Bitmap temp(width, height, format);
+
+            for (int y = y0; y < y1; ++y)
             {
-                Bitmap temp(width, height, format);
                 uint8* data = address + y * xblocks * bytes;
 
                 for (int x = 0; x < xblocks; ++x)
@@ -555,10 +555,8 @@ namespace mango
                     encode(*this, data, image, temp.stride);
                     data += bytes;
                 }
-            });
-        }
-
-        queue.wait();
+            }
+        });
     }
 
 } // namespace mango
@@ -999,7 +999,8 @@ namespace
         uint32 imagesize = height * stride;
         uint32 filesize = dataoffset + imagesize;
 
-        LittleEndianStream s(stream);
+        BufferedStream buffered(stream);
+        LittleEndianStream s(buffered);
 
         s.write16(0x4d42);      // 'BM'
         s.write32(filesize);    // filesize
@@ -7,6 +7,7 @@
 */
 #include <mango/core/pointer.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/memory.hpp>
 #include <mango/core/system.hpp>
 #include <mango/image/image.hpp>
 
@@ -100,13 +101,13 @@ namespace
 		int  color_table_size()  const { return 1 << ((field & 0x07) + 1); }
 	};
 
-	uint8* readBits(uint8*& data, int width, int height)
+	uint8* readBits(ArenaScope& arena, uint8*& data, int width, int height)
 	{
         uint8* p = data;
 
 		// initialize gif data stream decoder
 		const int samples = width * height;
-		uint8* q_buffer = new uint8[samples];
+		uint8* q_buffer = arena.allocate(samples);
 		uint8* q_buffer_end = q_buffer + samples;
 
 		const int MaxStackSize = 4096;
@@ -251,7 +252,6 @@ namespace
 
         if (terminator != 0)
 		{
-            //delete[] q_buffer;
 			//MANGO_EXCEPTION(ID"Terminator missing from the gif stream.");
 		}
 
@@ -332,14 +332,14 @@ namespace
         int height = image_desc.height;
 
 		// decode gif bit stream
-		uint8* bits = readBits(data, width, height);
+        ArenaScope arena;
+		uint8* bits = readBits(arena, data, width, height);
 
         // deinterlace
 		if (image_desc.interlaced())
 		{
-            uint8* temp = new uint8[width * height];
+            uint8* temp = arena.allocate(width * height);
 			deinterlace(temp, bits, width, height);
-            delete[] bits;
             bits = temp;
 		}
 
@@ -362,8 +362,6 @@ namespace
             int y = image_desc.top;
             surface.blit(x, y, temp);
         }
-
-		delete[] bits;
     }
 
 	void read_extension(uint8*& data)
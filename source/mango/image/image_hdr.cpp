@@ -4,7 +4,7 @@
 */
 #include <cmath>
 #include <mango/core/pointer.hpp>
-#include <mango/core/buffer.hpp>
+#include <mango/core/memory.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/core/system.hpp>
 #include <mango/image/image.hpp>
@@ -233,7 +233,8 @@ namespace
 
     void hdr_decode(Surface& surface, const uint8* data)
     {
-        Buffer buffer(surface.width * 4);
+        ArenaScope arena;
+        uint8* buffer = arena.allocate(surface.width * 4);
 
 		for (int y = 0; y < surface.height; ++y)
 		{
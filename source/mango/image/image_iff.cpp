@@ -4,6 +4,7 @@
 */
 #include <mango/core/pointer.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/memory.hpp>
 #include <mango/core/system.hpp>
 #include <mango/image/image.hpp>
 
@@ -327,7 +328,7 @@ namespace
             uint8 palette[1024];
             int palette_size = 0;
 
-            uint8* buffer_allocated = nullptr;
+            ArenaScope arena;
             uint8* buffer = nullptr;
 
             bool ham = false;
@@ -414,10 +415,10 @@ namespace
                         {
                             int scansize = ((xsize + 15) & ~15) / 8 * (nplanes + (mask == 1));
                             int bytes = scansize * ysize;
-                            buffer_allocated = new uint8[bytes];
+                            uint8* unpacked = arena.allocate(bytes);
 
-                            unpackBits(buffer_allocated, p, bytes, size);
-                            buffer = buffer_allocated;
+                            unpackBits(unpacked, p, bytes, size);
+                            buffer = unpacked;
                         }
                         else
                         {
@@ -493,8 +494,6 @@ namespace
                 }
             }
 
-            delete[] buffer_allocated;
-
 			// NOTE: we could directly decode into dest if the formats match.
             dest.blit(0, 0, temp);
         }
@@ -3,7 +3,7 @@
     Copyright (C) 2012-2017 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <mango/core/pointer.hpp>
-#include <mango/core/buffer.hpp>
+#include <mango/core/memory.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/core/system.hpp>
 #include <mango/image/image.hpp>
@@ -376,7 +376,8 @@ namespace
             if (!bytesPerLine) bytesPerLine = width * round_to_next(header.BitsPerPixel, 8);
             int scansize = header.NPlanes * bytesPerLine;
 
-            Buffer buffer(scansize * height);
+            ArenaScope arena;
+            uint8* buffer = arena.allocate(scansize * height);
 
             scanRLE(buffer, scansize * height, m_memory.address + 128);
 
@@ -152,11 +152,12 @@ namespace
         const int width = (surface.width + 3) & ~3;
         const int height = (surface.height + 3) & ~3;
 
-        BigEndianStream s(stream);
+        BufferedStream buffered(stream);
+        BigEndianStream s(buffered);
 
         // write magic
         const uint8 magic[] = { 'P', 'K', 'M', ' ', '1', '0' };
-        stream.write(magic, 6);
+        s.write(magic, 6);
 
         // write header
         s.write16(0);
@@ -181,7 +182,7 @@ namespace
         info.compress(buffer, surface);
 
         // write results
-        stream.write(buffer, bytes);
+        s.write(buffer, bytes);
     }
 
 } // namespace
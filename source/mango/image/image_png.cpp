@@ -601,12 +601,8 @@ namespace
     void ParserPNG::filter(uint8* buffer, int bytes, int height)
     {
         // zero scanline
-        uint8* zero = new uint8[bytes];
-        if (!zero)
-        {
-            setError("Memory allocation failed.");
-            return;
-        }
+        ArenaScope arena;
+        uint8* zero = arena.allocate(bytes);
         std::memset(zero, 0, bytes);
         const uint8* p = zero;
 
@@ -688,19 +684,13 @@ namespace
             p = s;
             s += bytes;
         }
-
-        delete[] zero;
     }
 
     uint8* ParserPNG::deinterlace1to4(uint8* buffer)
     {
+        // released with the decode buffer
         const int stride = FILTER_BYTE + m_bytes_per_line;
-        uint8* temp = new uint8[m_height * stride];
-        if (!temp)
-        {
-            setError("Memory allocation failed.");
-            return buffer;
-        }
+        uint8* temp = getThreadArena().allocate(m_height * stride);
         std::memset(temp, 0, m_height * stride);
 
         uint8* p = buffer;
@@ -744,19 +734,14 @@ namespace
         }
 
         // migrate to deinterleaved temp buffer
-        delete[] buffer;
         return temp;
     }
 
     uint8* ParserPNG::deinterlace8to16(uint8* buffer)
     {
+        // released with the decode buffer
         const int stride = FILTER_BYTE + m_bytes_per_line;
-        uint8* temp = new uint8[m_height * stride];
-        if (!temp)
-        {
-            setError("Memory allocation failed.");
-            return buffer;
-        }
+        uint8* temp = getThreadArena().allocate(m_height * stride);
 
         uint8* p = buffer;
         const int size = m_bytes_per_line / m_width;
@@ -796,7 +781,6 @@ namespace
         }
 
         // migrate to deinterleaved temp buffer
-        delete[] buffer;
         return temp;
     }
 
@@ -1228,14 +1212,10 @@ namespace
                 buffer_size = (FILTER_BYTE + m_bytes_per_line) * m_height;
             }
 
-            // allocate output buffer
+            // allocate output buffer; the scratch memory is released when the decoding is done
             print("  buffer bytes: %d\n", buffer_size);
-            uint8* buffer = new uint8[buffer_size];
-            if (!buffer)
-            {
-                setError("Memory allocation failed.");
-                return m_error;
-            }
+            ArenaScope arena;
+            uint8* buffer = arena.allocate(buffer_size);
 
             // decompress stream
             mz_stream stream;
@@ -1263,8 +1243,7 @@ namespace
             status = mz_inflateEnd(&stream);
 
             // process image
-            buffer = process(dest.image, dest.stride, buffer);
-            delete[] buffer;
+            process(dest.image, dest.stride, buffer);
         }
 
         return m_error;
@@ -1307,18 +1286,30 @@ namespace
     void write_IDAT(Stream& stream, const Surface& surface)
     {
         const int bytesPerLine = surface.width * sizeof(uint32);
-        const int bytes = (FILTER_BYTE + bytesPerLine) * surface.height;
+
+        // the compressed data goes straight into the buffer segments
+        ChunkedBuffer buffer;
+        BigEndianStream s(buffer);
+        s.write32(makeReverseFourCC('I', 'D', 'A', 'T'));
 
         z_stream z = { 0 };
         deflateInit(&z, -1);
 
-        z.avail_out = (unsigned int)deflateBound(&z, bytes);
-        Buffer buffer(4 + z.avail_out);
-
-        BigEndianStream s(buffer);
-        s.write32(makeReverseFourCC('I', 'D', 'A', 'T'));
+        auto compress = [&] (const uint8* data, size_t size, int flush)
+        {
+            z.next_in = const_cast<uint8*>(data);
+            z.avail_in = static_cast<unsigned int>(size);
 
-        z.next_out = buffer + 4;
+            int status;
+            do
+            {
+                Memory space = buffer.reserve();
+                z.next_out = space.address;
+                z.avail_out = static_cast<unsigned int>(space.size);
+                status = deflate(&z, flush);
+                buffer.commit(space.size - z.avail_out);
+            } while (z.avail_out == 0 || (flush == Z_FINISH && status == Z_OK));
+        };
 
         for (int y = 0; y < surface.height; ++y)
         {
@@ -1326,23 +1317,30 @@ namespace
 
             // compress filler byte
             uint8 zero = 0;
-            z.avail_in = 1;
-            z.next_in = &zero;
-            deflate(&z, Z_NO_FLUSH);
+            compress(&zero, 1, Z_NO_FLUSH);
 
             // compress scanline
-            z.avail_in = bytesPerLine;
-            z.next_in = surface.address<uint8>(0, y);
-            deflate(&z, last_scan ? Z_FINISH : Z_NO_FLUSH);
+            compress(surface.address<uint8>(0, y), bytesPerLine, last_scan ? Z_FINISH : Z_NO_FLUSH);
         }
 
-        // compressed size includes chunkID
-        const size_t compressed_size = int(z.next_out - buffer);
-
         deflateEnd(&z);
 
         // write chunkdID + compressed data
-        writeChunk(stream, Memory(buffer, compressed_size));
+        BigEndianStream c(stream);
+        uint32 chunk_crc = 0;
+        const std::vector<Memory> segments = buffer.segments();
+
+        for (const Memory& segment : segments)
+        {
+            chunk_crc = crc32(chunk_crc, segment);
+        }
+
+        c.write32(static_cast<uint32>(buffer.size() - 4));
+        for (const Memory& segment : segments)
+        {
+            stream.write(segment);
+        }
+        c.write32(chunk_crc);
     }
 
     void writePNG(Stream& stream, const Surface& surface)
@@ -1352,13 +1350,14 @@ namespace
             0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a
         };
 
-        BigEndianStream s(stream);
+        BufferedStream buffered(stream);
+        BigEndianStream s(buffered);
 
         // write magic
         s.write(magic, 8);
 
-        write_IHDR(stream, surface);
-        write_IDAT(stream, surface);
+        write_IHDR(buffered, surface);
+        write_IDAT(buffered, surface);
 
         // write IEND
         s.write32(0);
@@ -4,6 +4,7 @@
 */
 #include <mango/core/pointer.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/memory.hpp>
 #include <mango/image/image.hpp>
 
 #define ID "ImageStream.TGA: "
@@ -87,7 +88,7 @@ namespace
             p += idfield_length;
         }
 
-        void write(Stream& file)
+        void write(BufferedStream& file)
         {
             LittleEndianStream s(file);
 
@@ -208,7 +209,8 @@ namespace
         int y = 0;
 
         Blitter blitter(dest.format, src.format);
-        uint8* temp = NULL;
+        ArenaScope arena;
+        uint8* temp = nullptr;
 
         BlitRect rect;
         rect.destImage = dest.image;
@@ -233,7 +235,7 @@ namespace
 
             if (dest.format != src.format)
             {
-                temp = new uint8[src.width * depth];
+                temp = arena.allocate(src.width * depth);
                 buffer = temp;
                 rect.srcImage = temp;
             }
@@ -299,8 +301,6 @@ namespace
                 }
             }
         }
-
-        delete [] temp;
 	}
 
     // ------------------------------------------------------------
@@ -453,15 +453,17 @@ namespace
         header.pixel_size       = static_cast<uint8>(format.bits());
         header.descriptor       = 0x20 | (isalpha ? 8 : 0);
 
+        BufferedStream buffered(stream);
+
         // write header
-        header.write(stream);
+        header.write(buffered);
 
         // write image
         if (format != surface.format)
         {
             Bitmap temp(width, height, format);
             temp.blit(0, 0, surface);
-            stream.write(temp.image, width * height * format.bytes());
+            buffered.write(temp.image, width * height * format.bytes());
         }
         else
         {
@@ -470,7 +472,7 @@ namespace
 
             for (int y = 0; y < height; ++y)
             {
-                stream.write(image, bytesPerLine);
+                buffered.write(image, bytesPerLine);
                 image += surface.stride;
             }
         }
@@ -190,7 +190,7 @@ namespace
             surface.height = header.height;
             surface.format = format ? *format : header.format;
             surface.stride = surface.width * surface.format.bytes();
-            surface.image  = new uint8[surface.height * surface.stride];
+            surface.image  = reinterpret_cast<uint8*>(large_malloc(surface.height * surface.stride));
 
             // decode
             decoder.decode(surface, 0, 0, 0);
@@ -203,6 +203,9 @@ namespace
     {
         const std::string extension = getExtension(filename);
         File file(filename);
+
+        // decoders read the file front to back
+        file.advise(VirtualMemory::SEQUENTIAL);
         Surface surface = load_surface(file, extension, format);
         return surface;
     }
@@ -356,58 +359,31 @@ namespace mango
         rect.width = dest.width;
         rect.height = dest.height;
 
-        ConcurrentQueue queue("blit", Priority::HIGH);
-
         Blitter blitter(dest.format, source.format);
 
-        const int threads = ThreadPool::getInstanceSize();
-        const int tasksize = (rect.width * rect.height) / threads;
-
-        const bool fast = dest.format == source.format;
-
-        // don't use thread pool for:
-        // - really small tasks
-        // - when the pixel formats are identical ("fast mode")
-        const int N = (tasksize < 8192) || fast ? 1 : threads;
-        const int section = rect.height / N;
-
-        int ypos = 0;
-
-        // queue conversion tasks
-        for (int i = 0; i < N; ++i)
+        // don't use thread pool when the pixel formats are identical ("fast mode")
+        if (dest.format == source.format)
         {
-            const bool last = (i == (N - 1));
-            const int ycount = last ? rect.height - ypos : section;
-
-            if (N == 1)
-            {
-                // execute on main thread
-                BlitRect temp = rect;
-
-                temp.destImage += ypos * rect.destStride;
-                temp.srcImage += ypos * rect.srcStride;
-                temp.height = ycount;
+            blitter.convert(rect);
+            return;
+        }
 
-                blitter.convert(temp);
-            }
-            else
-            {
-                queue.enqueue([=, &blitter]
-                {
-                    BlitRect temp = rect;
+        // really small tasks are not worth it; at least 8192 pixels per task
+        const int grain = std::max(1, 8192 / rect.width);
 
-                    temp.destImage += ypos * rect.destStride;
-                    temp.srcImage += ypos * rect.srcStride;
-                    temp.height = ycount;
+        ConcurrentQueue queue("blit", Priority::HIGH);
+        queue.setLocality(dest.image);
 
-                    blitter.convert(temp);
-                });
-            }
+        parallel_for(queue, 0, rect.height, grain, [&] (int y0, int y1)
+        {
+            BlitRect temp = rect;
 
-            ypos += section;
-        }
+            temp.destImage += y0 * rect.destStride;
+            temp.srcImage += y0 * rect.srcStride;
+            temp.height = y1 - y0;
 
-        queue.wait();
+            blitter.convert(temp);
+        });
     }
 
     void Surface::xflip()
@@ -477,48 +453,66 @@ namespace mango
 
     Bitmap::Bitmap(int _width, int _height, const Format& _format, int _stride, uint8* _image)
     : Surface(_width, _height, _format, _stride, _image)
+    , m_large(!_image)
     {
         if (!stride)
             stride = width * format.bytes();
 
         if (!image)
-            image = new uint8[stride * height];
+            image = reinterpret_cast<uint8*>(large_malloc(stride * height));
     }
 
     Bitmap::Bitmap(Memory memory, const std::string& extension)
     : Surface(load_surface(memory, extension, nullptr))
+    , m_large(true)
     {
     }
 
     Bitmap::Bitmap(const std::string& filename, const Format& format)
     : Surface(load_surface(filename, &format))
+    , m_large(true)
     {
     }
 
     Bitmap::Bitmap(const std::string& filename)
     : Surface(load_surface(filename, nullptr))
+    , m_large(true)
     {
     }
 
     Bitmap::Bitmap(Bitmap&& bitmap)
     : Surface(bitmap)
+    , m_large(bitmap.m_large)
     {
         bitmap.image = nullptr;
     }
 
     Bitmap::~Bitmap()
     {
-        delete[] image;
+        if (m_large)
+            large_free(image);
+        else
+            delete[] image;
     }
 
     Bitmap& Bitmap::operator = (Bitmap&& bitmap)
     {
+        if (this == &bitmap)
+            return *this;
+
+        // release current image
+        if (m_large)
+            large_free(image);
+        else
+            delete[] image;
+
         // copy surface
         width = bitmap.width;
         height = bitmap.height;
         format = bitmap.format;
         stride = bitmap.stride;
         image = bitmap.image;
+        m_large = bitmap.m_large;
 
         // move image ownership
         bitmap.image = nullptr;
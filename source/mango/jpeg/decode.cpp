@@ -1343,6 +1343,7 @@ namespace jpeg
         uint8* image = m_surface->address<uint8>(0, 0);
 
         ConcurrentQueue queue("jpeg.sequential", Priority::HIGH);
+        queue.setLocality(image);
 
         if (!restartInterval)
         {
@@ -1590,53 +1591,42 @@ namespace jpeg
         BlockType* data = blockVector;
 
         ConcurrentQueue queue("jpeg.progressive", Priority::HIGH);
-        const int pool_size = ThreadPool::getInstanceSize();
-
-        const int S = pool_size > 1 ? 4 * pool_size : 1;
-        const int N = std::max(ymcu / S, pool_size);
+        queue.setLocality(image);
 
         // use threadpool to process blocks
-        for (int y = 0; y < ymcu; y += N)
+        parallel_for(queue, 0, ymcu, 1, [&] (int y0, int y1)
         {
-            const int y0 = y;
-            const int y1 = std::min(y + N, ymcu);
             jpegPrint("Process: [%d, %d] --> ThreadPool.\n", y0, y1 - 1);
 
-            // enqueue task
-            queue.enqueue([=] {
-                for (int y = y0; y < y1; ++y)
-                {
-                    uint8* dest = image + y * ystride;
-                    BlockType* source = data + y * xmcu * mcu_data_size;
+            for (int y = y0; y < y1; ++y)
+            {
+                uint8* dest = image + y * ystride;
+                BlockType* source = data + y * xmcu * mcu_data_size;
 
-                    ProcessFunc process = processState.process;
-                    int width = xblock;
-                    int height = yblock;
+                ProcessFunc process = processState.process;
+                int width = xblock;
+                int height = yblock;
 
-                    if (yclip && y == ymcu - 1)
+                if (yclip && y == ymcu - 1)
+                {
+                    process = processState.clipped;
+                    height = yclip;
+                }
+
+                for (int x = 0; x < xmcu; ++x)
+                {
+                    if (xclip && x == xmcu - 1)
                     {
                         process = processState.clipped;
-                        height = yclip;
+                        width = xclip;
                     }
 
-                    for (int x = 0; x < xmcu; ++x)
-                    {
-                        if (xclip && x == xmcu - 1)
-                        {
-                            process = processState.clipped;
-                            width = xclip;
-                        }
-
-                        process(dest, stride, source, &processState, width, height);
-                        source += mcu_data_size;
-                        dest += xstride;
-                    }
+                    process(dest, stride, source, &processState, width, height);
+                    source += mcu_data_size;
+                    dest += xstride;
                 }
-            });
-        }
-
-        // synchronize
-        queue.wait();
+            }
+        });
     }
 
 } // namespace jpeg